@@ -0,0 +1,969 @@
+#pragma once
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+#include <cstring>
+#include <random>
+#include <thread>
+
+#include "hittable.hpp"
+#include "material.hpp"
+#include "scene.hpp"
+#include "scene-parser.hpp"
+#include "camera.hpp"
+#include "scheduler.hpp"
+#include "framebuffer.hpp"
+#include "bvh.hpp"
+#include "wide-bvh.hpp"
+#include "utils.hpp"
+#include "timer.hpp"
+
+namespace art {
+
+	// helper for measuring short code sections
+	template<typename Func>
+	double MeasureSeconds(Func &&func) {
+		auto start = std::chrono::high_resolution_clock::now();
+		func();
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double>(end - start).count();
+	}
+
+	// random rays that start on a sphere around the unit cube and pass through it
+	std::vector<Ray> GenerateBenchmarkRays(uint32_t nRays) {
+		PCG32 rng(nRays);
+		std::vector<Ray> rays;
+		rays.reserve(nRays);
+		for (uint32_t i = 0; i != nRays; ++i) {
+			glm::vec3 ro = glm::vec3(0.5f) + 2.0f * RandomVec(rng);
+			glm::vec3 target = glm::vec3(Random(rng), Random(rng), Random(rng));
+			rays.emplace_back(ro, target - ro);
+		}
+		return rays;
+	}
+
+	// fills scene with n spheres randomly scattered inside unit cube
+	// radius shrinks with number of spheres so scene density stays the same
+	void GenerateSpheres(Scene &scene, uint32_t n) {
+		PCG32 rng(n);
+		float radius = 0.5f / std::cbrt(float(n));
+		for (uint32_t i = 0; i != n; ++i) {
+			glm::vec3 center(Random(rng), Random(rng), Random(rng));
+			scene.AddObject(std::make_unique<Sphere>(center, radius, 0));
+		}
+	}
+
+	// per-ray cost of closest hit query for growing number of spheres
+	void BenchmarkBVH() {
+		const uint32_t nRays = 1 << 18;
+		std::vector<Ray> rays = GenerateBenchmarkRays(nRays);
+
+		std::stringstream table;
+		table << "closest hit, " << nRays << " random rays per scene\n\n";
+		table << std::setw(10) << "spheres" << std::setw(14) << "ns / ray" << std::setw(18) << "ns / ray / log2N" << std::setw(10) << "hits" << "\n";
+
+		for (uint32_t n = 10; n <= 1000000; n *= 10) {
+			Scene scene;
+			GenerateSpheres(scene, n);
+			scene.Build();
+
+			uint32_t nHits = 0;
+			HitRecord rec;
+			double traceTime = MeasureSeconds([&]() {
+				for (const Ray &r : rays) {
+					nHits += scene.Intersect(r, Interval(0.001f, infinity), rec);
+				}
+			});
+
+			double nsPerRay = traceTime * 1e9 / nRays;
+			table << std::setw(10) << n
+			      << std::setw(14) << std::fixed << std::setprecision(1) << nsPerRay
+			      << std::setw(18) << std::setprecision(2) << nsPerRay / std::log2(double(n))
+			      << std::setw(10) << nHits << "\n";
+		}
+
+		std::cout << "\n" << table.str();
+	}
+
+	// build time for bounds of 10M random boxes
+	void BenchmarkBVHBuild() {
+		const uint32_t n = 10000000;
+		float size = 0.5f / std::cbrt(float(n));
+		PCG32 rng(n);
+
+		std::vector<AABB> bounds(n);
+		for (uint32_t i = 0; i != n; ++i) {
+			glm::vec3 center(Random(rng), Random(rng), Random(rng));
+			bounds[i] = AABB(center - size, center + size);
+		}
+
+		BVH bvh;
+		{
+			art::Timer timer{"BVH building (" + std::to_string(n) + " boxes)"};
+			bvh.Build(bounds);
+		}
+		std::cout << "nodes: " << bvh.GetNodes().size() << ", threads: " << std::thread::hardware_concurrency() << "\n";
+	}
+
+	// traversal of binary and wide bvh on quad-heavy scene:
+	// 'mirrors.yaml' pillars (two mirrors, light and floor) repeated on a grid
+	void BenchmarkWideBVH() {
+		std::vector<Quad> quads;
+		const int gridSize = 160;
+		for (int i = 0; i != gridSize; ++i) {
+			for (int j = 0; j != gridSize; ++j) {
+				glm::vec3 o(6.0f * i, 0.0f, 6.0f * j);
+				quads.emplace_back(o + glm::vec3(0, -2, -3), glm::vec3(2, 0, 5), glm::vec3(0, 6, 0), 0, false);
+				quads.emplace_back(o + glm::vec3(0, -2, -3), glm::vec3(-2, 0, 5), glm::vec3(0, 6, 0), 0, false);
+				quads.emplace_back(o + glm::vec3(-3, 2, -0.5), glm::vec3(6, 0, 0), glm::vec3(0, 0, 0.5), 0, false);
+				quads.emplace_back(o + glm::vec3(-3, 0, -1), glm::vec3(6, 0, 0), glm::vec3(0, 0, 2), 0, false);
+			}
+		}
+
+		std::vector<AABB> bounds(quads.size());
+		for (size_t i = 0; i != quads.size(); ++i) {
+			bounds[i] = quads[i].Bounds();
+		}
+
+		BVH bvh;
+		bvh.Build(bounds);
+		WideBVH wideBvh;
+		wideBvh.Build(bvh);
+
+		// quads are stored contiguously in leaf order, so benchmark measures traversal and not heap layout
+		std::vector<Quad> ordered;
+		ordered.reserve(quads.size());
+		for (uint32_t index : bvh.GetPrimIndices()) {
+			ordered.push_back(quads[index]);
+		}
+
+		// rays start at random points between pillars and go in random directions (like secondary rays)
+		const uint32_t nRays = 1 << 20;
+		AABB sceneBounds = bvh.Bounds();
+		PCG32 rng(nRays);
+		std::vector<Ray> rays;
+		rays.reserve(nRays);
+		for (uint32_t i = 0; i != nRays; ++i) {
+			glm::vec3 t(Random(rng), Random(rng), Random(rng));
+			glm::vec3 ro = sceneBounds.GetMin() + t * sceneBounds.Extent();
+			rays.emplace_back(ro, RandomVec(rng));
+		}
+
+		HitRecord rec;
+		// best of several runs, to filter out noise of other processes
+		auto trace = [&](const auto &accel) {
+			uint32_t nHits = 0;
+			double bestTime = infinity;
+			for (int run = 0; run != 3; ++run) {
+				nHits = 0;
+				double time = MeasureSeconds([&]() {
+					for (const Ray &r : rays) {
+						nHits += accel.Intersect(r, Interval(0.001f, infinity), [&](uint32_t index, Interval span, float &tClosest) {
+							if (!ordered[index].Intersect(r, span, rec)) {
+								return false;
+							}
+							tClosest = rec.t;
+							return true;
+						});
+					}
+				});
+				bestTime = std::min(bestTime, time);
+			}
+			return std::make_pair(bestTime * 1e9 / nRays, nHits);
+		};
+
+		auto binary = trace(bvh);
+		auto wide = trace(wideBvh);
+
+		std::cout << "closest hit, " << quads.size() << " quads, " << nRays << " random rays\n\n";
+		std::cout << std::setw(14) << "layout" << std::setw(14) << "nodes" << std::setw(14) << "ns / ray" << std::setw(10) << "hits" << "\n";
+		std::cout << std::setw(14) << "binary" << std::setw(14) << bvh.GetNodes().size() << std::setw(14) << std::fixed << std::setprecision(1) << binary.first << std::setw(10) << binary.second << "\n";
+		std::cout << std::setw(14) << "wide (" + std::to_string(WideBVH::kWidth) + ")" << std::setw(14) << wideBvh.GetNodeCount() << std::setw(14) << wide.first << std::setw(10) << wide.second << "\n";
+		std::cout << "\nspeedup: " << std::setprecision(2) << binary.first / wide.first << "x\n";
+	}
+
+	// closest hit against any hit query for shadow-like rays (segments between random points)
+	void BenchmarkOcclusion() {
+		const uint32_t nRays = 1 << 18;
+		PCG32 rng(nRays);
+
+		std::vector<Ray>   rays;
+		std::vector<float> lengths;
+		rays.reserve(nRays);
+		lengths.reserve(nRays);
+		for (uint32_t i = 0; i != nRays; ++i) {
+			glm::vec3 from(Random(rng), Random(rng), Random(rng));
+			glm::vec3 to(Random(rng), Random(rng), Random(rng));
+			rays.emplace_back(from, to - from);
+			lengths.push_back(glm::length(to - from));
+		}
+
+		std::stringstream table;
+		table << "segments between random points, " << nRays << " rays per scene\n\n";
+		table << std::setw(10) << "spheres" << std::setw(18) << "closest ns / ray" << std::setw(18) << "any ns / ray" << std::setw(10) << "speedup" << std::setw(10) << "hits" << "\n";
+
+		for (uint32_t n = 100; n <= 1000000; n *= 10) {
+			Scene scene;
+			GenerateSpheres(scene, n);
+			scene.Build();
+
+			uint32_t nClosest = 0;
+			uint32_t nAny = 0;
+			HitRecord rec;
+			double closestTime = MeasureSeconds([&]() {
+				for (uint32_t i = 0; i != nRays; ++i) {
+					nClosest += scene.Intersect(rays[i], Interval(0.001f, lengths[i]), rec);
+				}
+			});
+			double anyTime = MeasureSeconds([&]() {
+				for (uint32_t i = 0; i != nRays; ++i) {
+					nAny += scene.Occluded(rays[i], Interval(0.001f, lengths[i]));
+				}
+			});
+
+			// both queries must agree on visibility
+			if (nClosest != nAny) {
+				std::cerr << "occlusion benchmark error! closest hits: " << nClosest << ", any hits: " << nAny << "\n";
+				exit(1);
+			}
+
+			table << std::setw(10) << n
+			      << std::setw(18) << std::fixed << std::setprecision(1) << closestTime * 1e9 / nRays
+			      << std::setw(18) << anyTime * 1e9 / nRays
+			      << std::setw(9) << std::setprecision(2) << closestTime / anyTime << "x"
+			      << std::setw(10) << nAny << "\n";
+		}
+
+		std::cout << table.str();
+	}
+
+	// interface that materials had before the variant table, materials were allocated one by one
+	// with their textures and called through pointers (used only as baseline of benchmark)
+	struct IVirtualMaterial {
+		virtual ~IVirtualMaterial() = default;
+		virtual bool Scatter(const Ray &rayIn, const HitInfo &hitInfo, glm::vec3 &attenuation, Ray &rayOut, float &pdf, float uLobe, const glm::vec2 &uDir) const = 0;
+		virtual glm::vec3 Emitted(const HitInfo &hitInfo) const = 0;
+	};
+
+	template<typename MaterialType>
+	struct VirtualMaterial final : IVirtualMaterial {
+		explicit VirtualMaterial(const MaterialType &mat) : mat(mat) {}
+
+		bool Scatter(const Ray &rayIn, const HitInfo &hitInfo, glm::vec3 &attenuation, Ray &rayOut, float &pdf, float uLobe, const glm::vec2 &uDir) const override {
+			return mat.Scatter(rayIn, hitInfo, attenuation, rayOut, pdf, uLobe, uDir);
+		}
+		glm::vec3 Emitted(const HitInfo &hitInfo) const override { return mat.Emitted(hitInfo); }
+
+		MaterialType mat;
+	};
+
+	// shading of hits with mixed materials: virtual calls (as before the variant table),
+	// variant table of scene in order of hits and hits sorted by material with one dispatch per
+	// material (as hits of one bounce are shaded in wavefront renderer), time of sorting is included
+	void BenchmarkMaterials() {
+		const uint32_t nHits = 1 << 20;
+		const uint32_t nMaterials = 64;
+		PCG32 rng(nHits);
+
+		SolidColorTexture white(glm::vec3(0.9f));
+		SolidColorTexture black(glm::vec3(0.1f));
+		CheckerTexture checker(4.0f, &white, &black);
+
+		Scene scene;
+		std::vector<std::unique_ptr<IVirtualMaterial>> virtualMaterials;
+		for (uint32_t i = 0; i != nMaterials; ++i) {
+			glm::vec3 albedo(Random(rng), Random(rng), Random(rng));
+			switch (i % 5) {
+				case 0: scene.AddMaterial(Lambertian(albedo, Random(rng), Random(rng), nullptr, 1.0f)); break;
+				case 1: scene.AddMaterial(Lambertian(&checker, 0.0f, 0.0f, nullptr, 1.0f)); break;
+				case 2: scene.AddMaterial(Metal(albedo, Random(rng))); break;
+				case 3: scene.AddMaterial(Dielectric(1.5f, albedo, Random(rng))); break;
+				case 4: scene.AddMaterial(DiffuseLight(albedo)); break;
+			}
+			scene.GetMaterial(i).Visit([&](const auto &mat) {
+				using MaterialType = std::decay_t<decltype(mat)>;
+				virtualMaterials.push_back(std::make_unique<VirtualMaterial<MaterialType>>(mat));
+			});
+		}
+
+		struct Hit {
+			Ray       ray;
+			HitInfo   info;
+			float     uLobe;
+			glm::vec2 uDir;
+		};
+		std::vector<Hit> hits(nHits);
+		for (Hit &hit : hits) {
+			glm::vec3 N = RandomVec(rng);
+			hit.ray = Ray(glm::vec3(0), -RandomOnHemisphere(N, rng));
+			hit.info.p = glm::vec3(Random(rng), Random(rng), Random(rng));
+			hit.info.N = N;
+			hit.info.matIndex = std::min(uint32_t(Random(rng) * nMaterials), nMaterials - 1);
+			hit.info.frontFace = true;
+			hit.info.u = Random(rng);
+			hit.info.v = Random(rng);
+			hit.uLobe = Random(rng);
+			hit.uDir = glm::vec2(Random(rng), Random(rng));
+		}
+
+		glm::vec3 sum(0);
+		auto shadeHit = [&](const auto &mat, const Hit &hit) {
+			glm::vec3 attenuation;
+			Ray rayOut;
+			float pdf;
+			if (mat.Scatter(hit.ray, hit.info, attenuation, rayOut, pdf, hit.uLobe, hit.uDir)) {
+				sum += attenuation;
+			}
+			sum += mat.Emitted(hit.info);
+		};
+
+		// best of several runs, to filter out noise of other processes
+		// hits are shuffled back to their order before every run, so sorting is measured every time
+		std::vector<Hit> original = hits;
+		auto measure = [&](const auto &shade) {
+			double bestTime = infinity;
+			for (int run = 0; run != 3; ++run) {
+				hits = original;
+				bestTime = std::min(bestTime, MeasureSeconds(shade));
+			}
+			return bestTime * 1e9 / nHits;
+		};
+
+		double virtualTime = measure([&]() {
+			for (const Hit &hit : hits) {
+				shadeHit(*virtualMaterials[hit.info.matIndex], hit);
+			}
+		});
+		double variantTime = measure([&]() {
+			for (const Hit &hit : hits) {
+				shadeHit(scene.GetMaterial(hit.info.matIndex), hit);
+			}
+		});
+
+		// materials ordered by type, so hits of one type are adjacent too
+		std::vector<uint32_t> materialOrder(nMaterials);
+		for (uint32_t i = 0; i != nMaterials; ++i) {
+			materialOrder[i] = i;
+		}
+		std::stable_sort(materialOrder.begin(), materialOrder.end(), [&](uint32_t a, uint32_t b) {
+			return scene.GetMaterial(a).GetType() < scene.GetMaterial(b).GetType();
+		});
+
+		// counting sort by material as compaction of wavefront renderer
+		std::vector<Hit> sorted(nHits);
+		std::vector<uint32_t> counts(nMaterials);
+		std::vector<uint32_t> offsets(nMaterials);
+		double sortTime = infinity;
+		double sortedTime = measure([&]() {
+			double time = MeasureSeconds([&]() {
+				std::fill(counts.begin(), counts.end(), 0);
+				for (const Hit &hit : hits) {
+					++counts[hit.info.matIndex];
+				}
+				uint32_t offset = 0;
+				for (uint32_t m : materialOrder) {
+					offsets[m] = offset;
+					offset += counts[m];
+				}
+				for (const Hit &hit : hits) {
+					sorted[offsets[hit.info.matIndex]++] = hit;
+				}
+			});
+			sortTime = std::min(sortTime, time * 1e9 / nHits);
+
+			for (size_t begin = 0, end; begin != sorted.size(); begin = end) {
+				const uint32_t matIndex = sorted[begin].info.matIndex;
+				for (end = begin + 1; end != sorted.size() && sorted[end].info.matIndex == matIndex; ++end) {}
+				scene.GetMaterial(matIndex).Visit([&](const auto &mat) {
+					for (size_t i = begin; i != end; ++i) {
+						shadeHit(mat, sorted[i]);
+					}
+				});
+			}
+		});
+
+		std::stringstream table;
+		table << nHits << " hits, " << nMaterials << " materials of " << Material::kTypeCount << " types\n\n";
+		table << std::setw(28) << "dispatch" << std::setw(14) << "ns / hit" << std::setw(10) << "speedup" << "\n";
+		table << std::setw(28) << "virtual, order of hits" << std::setw(14) << std::fixed << std::setprecision(1) << virtualTime << "\n";
+		table << std::setw(28) << "variant, order of hits" << std::setw(14) << variantTime
+		      << std::setw(9) << std::setprecision(2) << virtualTime / variantTime << "x\n";
+		table << std::setw(28) << "variant, sorted by material" << std::setw(14) << std::setprecision(1) << sortedTime
+		      << std::setw(9) << std::setprecision(2) << virtualTime / sortedTime << "x   (" << std::setprecision(1) << sortTime << " of it is sorting)\n";
+		table << "\nchecksum " << std::setprecision(0) << (sum.x + sum.y + sum.z) << "\n";
+		std::cout << table.str();
+	}
+
+	// path tracing with and without russian roulette (camera parameters of scene) on 'mirrors.yaml'
+	// efficiency is 1 / (variance * time), so it compares speed at equal noise
+	struct SamplingResult {
+		double samplesPerSecond;
+		double variance;  // mean variance of one sample
+		double mean;      // mean radiance, must be the same for unbiased integrators
+	};
+
+	// every pixel gets the same number of independent samples, variance is estimated per pixel
+	SamplingResult MeasureSampling(const Camera &camera, const Scene &scene, uint32_t width, uint32_t height, uint32_t nSamples) {
+		camera.Setup(width, height);
+
+		double varianceSum = 0;
+		double meanSum = 0;
+		double time = MeasureSeconds([&]() {
+			for (uint32_t j = 0; j != height; ++j) {
+				for (uint32_t i = 0; i != width; ++i) {
+					glm::dvec3 sum(0), sumSq(0);
+					for (uint32_t s = 0; s != nSamples; ++s) {
+						Sampler sampler = IndependentSampler(j * width + i, s);
+						glm::dvec3 c = camera.SamplePixel(i, j, sampler, scene);
+						sum += c;
+						sumSq += c * c;
+					}
+					glm::dvec3 mean = sum / double(nSamples);
+					glm::dvec3 variance = (sumSq - double(nSamples) * mean * mean) / double(nSamples - 1);
+					varianceSum += (variance.x + variance.y + variance.z) / 3.0;
+					meanSum += (mean.x + mean.y + mean.z) / 3.0;
+				}
+			}
+		});
+		uint32_t nPixels = width * height;
+		return SamplingResult{ nPixels * double(nSamples) / time, varianceSum / nPixels, meanSum / nPixels };
+	}
+
+	// efficiency is inverse of variance * time, ratio shows speedup at equal noise
+	void PrintSamplingComparison(const std::string &label, const std::string &baseName, const SamplingResult &base, const std::string &name, const SamplingResult &result) {
+		double efficiency = (base.variance / base.samplesPerSecond) / (result.variance / result.samplesPerSecond);
+
+		// variance and mean are printed with significant digits, they can be small
+		std::cout << std::setw(10) << label << std::setw(16) << baseName << std::setw(16) << std::fixed << std::setprecision(0) << base.samplesPerSecond
+		          << std::defaultfloat << std::setprecision(4) << std::setw(12) << base.variance << std::setw(12) << base.mean << "\n";
+		std::cout << std::setw(10) << label << std::setw(16) << name << std::setw(16) << std::fixed << std::setprecision(0) << result.samplesPerSecond
+		          << std::defaultfloat << std::setprecision(4) << std::setw(12) << result.variance << std::setw(12) << result.mean
+		          << std::fixed << std::setw(19) << std::setprecision(2) << efficiency << "x\n";
+	}
+
+	void PrintSamplingHeader(const std::string &label) {
+		std::cout << std::setw(10) << label << std::setw(16) << "integrator" << std::setw(16) << "samples / s"
+		          << std::setw(12) << "variance" << std::setw(12) << "mean" << std::setw(20) << "equal noise speedup" << "\n";
+	}
+
+	void BenchmarkRoulette() {
+		SceneParser parser{"mirrors"};
+		Scene scene;
+		Camera camera = parser.GetCamera();
+		parser.PopulateScene(scene);
+		scene.Build();
+
+		// smaller image, every pixel gets the same number of independent samples
+		const uint32_t width = 200;
+		const uint32_t height = 60;
+		const uint32_t nSamples = 32;
+
+		std::cout << "\n'mirrors.yaml' " << width << "x" << height << ", " << nSamples << " samples per pixel\n\n";
+		PrintSamplingHeader("bounces");
+
+		const uint32_t rouletteDepth = camera.GetRouletteDepth();
+		for (uint32_t bounces : { 10u, 50u }) {
+			camera.SetMaxDepth(bounces);
+
+			// roulette disabled is the same as recursion to max depth
+			camera.SetRouletteDepth(std::numeric_limits<uint32_t>::max());
+			SamplingResult full = MeasureSampling(camera, scene, width, height, nSamples);
+			camera.SetRouletteDepth(rouletteDepth);
+			SamplingResult roulette = MeasureSampling(camera, scene, width, height, nSamples);
+
+			PrintSamplingComparison(std::to_string(bounces), "full depth", full, "roulette", roulette);
+		}
+	}
+
+	// light sampling with MIS against scattering only, on scenes lit by area lights
+	void BenchmarkLightSampling() {
+		const uint32_t width = 100;
+		const uint32_t height = 100;
+		const uint32_t nSamples = 32;
+
+		std::cout << "\n" << width << "x" << height << ", " << nSamples << " samples per pixel\n\n";
+		PrintSamplingHeader("scene");
+
+		for (const std::string name : { "example", "mirrors" }) {
+			SceneParser parser{name};
+			Scene scene;
+			Camera camera = parser.GetCamera();
+			parser.PopulateScene(scene);
+			scene.Build();
+
+			camera.SetLightSampling(false);
+			SamplingResult scattering = MeasureSampling(camera, scene, width, height, nSamples);
+			camera.SetLightSampling(true);
+			SamplingResult mis = MeasureSampling(camera, scene, width, height, nSamples);
+
+			PrintSamplingComparison(name, "scattering", scattering, "nee + mis", mis);
+		}
+	}
+
+	// path and wavefront integrators on scenes from 'scenes' folder (quarter of resolution, 16 samples)
+	// mean of image must be the same, integrators differ only in order of work
+	void BenchmarkWavefront() {
+		const uint32_t nSamples = 16;
+
+		std::cout << nSamples << " samples per pixel, quarter of scene resolution\n\n";
+		std::cout << std::setw(12) << "scene" << std::setw(14) << "integrator" << std::setw(12) << "seconds" << std::setw(10) << "mean" << std::setw(10) << "speedup" << "\n";
+
+		for (const std::string name : { "example", "mirrors", "mesh", "instances" }) {
+			SceneParser parser{name};
+			Scene scene;
+			Camera camera = parser.GetCamera();
+			std::unique_ptr<Image> sceneImage = parser.GetImage();
+			parser.PopulateScene(scene);
+			scene.Build();
+			camera.SetSamples(nSamples);
+
+			Image image(sceneImage->GetWidth() / 4, sceneImage->GetHeight() / 4);
+			auto render = [&](Integrator integrator, double &mean) {
+				camera.SetIntegrator(integrator);
+
+				// progress output of renders is hidden
+				std::stringstream progress;
+				std::streambuf *out = std::cout.rdbuf(progress.rdbuf());
+				double time = MeasureSeconds([&]() { camera.Render(image, scene); });
+				std::cout.rdbuf(out);
+
+				mean = 0;
+				for (uint32_t j = 0; j != image.GetHeight(); ++j) {
+					for (uint32_t i = 0; i != image.GetWidth(); ++i) {
+						glm::vec3 color = image.GetPixelColor(i, j);
+						mean += (color.r + color.g + color.b) / 3.0;
+					}
+				}
+				mean /= double(image.GetWidth()) * image.GetHeight();
+				return time;
+			};
+
+			double pathMean, wavefrontMean;
+			double pathTime = render(Integrator::Path, pathMean);
+			double wavefrontTime = render(Integrator::Wavefront, wavefrontMean);
+
+			std::cout << std::setw(12) << name << std::setw(14) << "path" << std::setw(12) << std::fixed << std::setprecision(3) << pathTime << std::setw(10) << pathMean << "\n";
+			std::cout << std::setw(12) << name << std::setw(14) << "wavefront" << std::setw(12) << wavefrontTime << std::setw(10) << wavefrontMean
+			          << std::setw(9) << std::setprecision(2) << pathTime / wavefrontTime << "x\n";
+		}
+	}
+
+	// rendering of 'example.yaml' (half of resolution, 16 samples) with static bands of rows per thread
+	// and with tile scheduler for different tile sizes, utilization is share of time threads were busy
+	void BenchmarkTiles() {
+		const uint32_t nSamples = 16;
+
+		SceneParser parser{"example"};
+		Scene scene;
+		Camera camera = parser.GetCamera();
+		std::unique_ptr<Image> sceneImage = parser.GetImage();
+		parser.PopulateScene(scene);
+		scene.Build();
+
+		const uint32_t width = sceneImage->GetWidth() / 2;
+		const uint32_t height = sceneImage->GetHeight() / 2;
+		camera.Setup(width, height);
+		auto renderPixel = [&](uint32_t i, uint32_t j) {
+			glm::vec3 color(0);
+			for (uint32_t s = 0; s != nSamples; ++s) {
+				Sampler sampler = Sampler::Create(SamplerType::Sobol, j * width + i, s);
+				color += camera.SamplePixel(i, j, sampler, scene);
+			}
+			return color;
+		};
+
+		const uint32_t nThreads = std::max(1u, std::thread::hardware_concurrency());
+		std::cout << nSamples << " samples per pixel, " << width << "x" << height << ", " << nThreads << " hardware threads\n\n";
+		std::cout << std::setw(28) << "scheduler" << std::setw(10) << "threads" << std::setw(12) << "seconds" << std::setw(14) << "utilization" << "\n";
+
+		// every thread renders equal band of rows, without stealing
+		double rowsTime = MeasureSeconds([&]() {
+			std::vector<std::thread> threads;
+			for (uint32_t t = 0; t != nThreads; ++t) {
+				threads.emplace_back([&, t]() {
+					for (uint32_t j = height * t / nThreads; j != height * (t + 1) / nThreads; ++j) {
+						for (uint32_t i = 0; i != width; ++i) {
+							renderPixel(i, j);
+						}
+					}
+				});
+			}
+			for (std::thread &thread : threads) {
+				thread.join();
+			}
+		});
+		std::cout << std::setw(28) << "rows (static bands)" << std::setw(10) << nThreads << std::setw(12) << std::fixed << std::setprecision(3) << rowsTime << std::setw(14) << "-" << "\n";
+
+		for (uint32_t threads : { nThreads, 2 * nThreads }) {
+			for (uint32_t tileSize : { 4, 8, 16, 32, 64 }) {
+				TileScheduler scheduler(threads, tileSize);
+				double time = MeasureSeconds([&]() {
+					scheduler.Run(width, height, [&](const Tile &tile) {
+						for (uint32_t j = tile.y0; j != tile.y1; ++j) {
+							for (uint32_t i = tile.x0; i != tile.x1; ++i) {
+								renderPixel(i, j);
+							}
+						}
+					}, [](uint32_t, uint32_t) {});
+				});
+
+				std::stringstream name;
+				name << "tiles " << tileSize << "x" << tileSize;
+				std::cout << std::setw(28) << name.str() << std::setw(10) << scheduler.GetWorkerCount() << std::setw(12) << std::setprecision(3) << time
+				          << std::setw(13) << std::setprecision(1) << scheduler.GetUtilization() * 100 << "%\n";
+			}
+		}
+	}
+
+	// error of scenes (eighth of resolution) rendered with independent and Sobol samplers,
+	// reference is rendered with 1024 Sobol samples, equal error speedup is (error ratio)^2 * time ratio
+	void BenchmarkSampler() {
+		const uint32_t nReference = 1024;
+
+		for (const std::string name : { "example", "instances" }) {
+			SceneParser parser{name};
+			Scene scene;
+			Camera camera = parser.GetCamera();
+			std::unique_ptr<Image> sceneImage = parser.GetImage();
+			parser.PopulateScene(scene);
+			scene.Build();
+
+			const uint32_t width = std::max(1u, sceneImage->GetWidth() / 8);
+			const uint32_t height = std::max(1u, sceneImage->GetHeight() / 8);
+			camera.Setup(width, height);
+
+			auto render = [&](SamplerType type, uint32_t nSamples) {
+				std::vector<glm::dvec3> pixels(width * height, glm::dvec3(0));
+				for (uint32_t j = 0; j != height; ++j) {
+					for (uint32_t i = 0; i != width; ++i) {
+						for (uint32_t s = 0; s != nSamples; ++s) {
+							Sampler sampler = Sampler::Create(type, j * width + i, s);
+							pixels[j * width + i] += glm::dvec3(camera.SamplePixel(i, j, sampler, scene));
+						}
+						pixels[j * width + i] /= double(nSamples);
+					}
+				}
+				return pixels;
+			};
+
+			std::cout << "\n" << name << ", " << width << "x" << height << ", reference with " << nReference << " samples\n\n";
+			std::vector<glm::dvec3> reference = render(SamplerType::Sobol, nReference);
+
+			auto rmse = [&](const std::vector<glm::dvec3> &pixels) {
+				double sum = 0;
+				for (size_t p = 0; p != pixels.size(); ++p) {
+					glm::dvec3 d = pixels[p] - reference[p];
+					sum += glm::dot(d, d) / 3.0;
+				}
+				return std::sqrt(sum / pixels.size());
+			};
+
+			std::cout << std::setw(10) << "samples" << std::setw(14) << "sampler" << std::setw(12) << "seconds" << std::setw(12) << "rmse" << std::setw(22) << "equal error speedup" << "\n";
+			for (uint32_t nSamples : { 4u, 16u, 25u, 64u }) {
+				std::vector<glm::dvec3> independent, sobol;
+				double independentTime = MeasureSeconds([&]() { independent = render(SamplerType::Independent, nSamples); });
+				double sobolTime = MeasureSeconds([&]() { sobol = render(SamplerType::Sobol, nSamples); });
+				double independentError = rmse(independent);
+				double sobolError = rmse(sobol);
+				double speedup = (independentError * independentError * independentTime) / (sobolError * sobolError * sobolTime);
+
+				std::cout << std::setw(10) << nSamples << std::setw(14) << "independent" << std::setw(12) << std::fixed << std::setprecision(3) << independentTime
+				          << std::setw(12) << std::setprecision(4) << independentError << "\n";
+				std::cout << std::setw(10) << nSamples << std::setw(14) << "sobol" << std::setw(12) << std::setprecision(3) << sobolTime
+				          << std::setw(12) << std::setprecision(4) << sobolError << std::setw(21) << std::setprecision(2) << speedup << "x\n";
+			}
+		}
+	}
+
+	// cost of one random number: thread local mt19937 with distribution (as before) against
+	// PCG32 generator of path, including seeding it once per path of 32 numbers
+	void BenchmarkRandom() {
+		const uint32_t nPaths = 1 << 20;
+		const uint32_t nPerPath = 32;
+
+		double sum = 0;
+		double mtTime = MeasureSeconds([&]() {
+			for (uint32_t path = 0; path != nPaths; ++path) {
+				for (uint32_t k = 0; k != nPerPath; ++k) {
+					static thread_local std::mt19937 generator(std::random_device{}());
+					std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+					sum += distribution(generator);
+				}
+			}
+		});
+		double pcgTime = MeasureSeconds([&]() {
+			for (uint32_t path = 0; path != nPaths; ++path) {
+				PCG32 rng(path, 0);
+				for (uint32_t k = 0; k != nPerPath; ++k) {
+					sum += Random(rng);
+				}
+			}
+		});
+
+		double n = double(nPaths) * nPerPath;
+		std::cout << nPaths << " paths, " << nPerPath << " numbers per path\n\n";
+		std::cout << std::setw(24) << "generator" << std::setw(14) << "ns / number" << std::setw(16) << "state bytes" << "\n";
+		std::cout << std::setw(24) << "thread_local mt19937" << std::setw(14) << std::fixed << std::setprecision(2) << mtTime * 1e9 / n << std::setw(16) << sizeof(std::mt19937) << "\n";
+		std::cout << std::setw(24) << "PCG32 per path" << std::setw(14) << pcgTime * 1e9 / n << std::setw(16) << sizeof(PCG32) << "\n";
+		std::cout << "\nspeedup: " << std::setprecision(2) << mtTime / pcgTime << "x (checksum " << std::setprecision(0) << sum << ")\n";
+	}
+
+	// converting accumulated radiance of 4k frame to 8-bit image: pixel by pixel with Image::SetPixelColor()
+	// (as renderer did before framebuffer) against SIMD resolve of framebuffer on one and all threads
+	void BenchmarkResolve() {
+		const uint32_t width = 3840;
+		const uint32_t height = 2160;
+		const uint32_t nSamples = 64;
+		const uint32_t nRuns = 5;
+
+		// radiance in [0, 2), so some pixels are clamped
+		std::vector<glm::vec3> sums(size_t(width) * height);
+		Framebuffer framebuffer(width, height, 16);
+		PCG32 rng(width);
+		for (uint32_t j = 0; j != height; ++j) {
+			for (uint32_t i = 0; i != width; ++i) {
+				glm::vec3 sum = glm::vec3(Random(rng), Random(rng), Random(rng)) * 2.0f * float(nSamples);
+				sums[size_t(j) * width + i] = sum;
+				framebuffer.AddSamples(i, j, sum, nSamples);
+			}
+		}
+
+		Image scalarImage(width, height);
+		Image simdImage(width, height);
+		double scalarTime = infinity, oneThreadTime = infinity, allThreadsTime = infinity;
+		for (uint32_t run = 0; run != nRuns; ++run) {
+			scalarTime = std::min(scalarTime, MeasureSeconds([&]() {
+				for (uint32_t j = 0; j != height; ++j) {
+					for (uint32_t i = 0; i != width; ++i) {
+						scalarImage.SetPixelColor(i, j, sums[size_t(j) * width + i] / float(nSamples));
+					}
+				}
+			}));
+			oneThreadTime = std::min(oneThreadTime, MeasureSeconds([&]() { framebuffer.Resolve(simdImage, 1); }));
+			allThreadsTime = std::min(allThreadsTime, MeasureSeconds([&]() { framebuffer.Resolve(simdImage); }));
+		}
+
+		// division and sqrt are correctly rounded in both versions, so bytes must be equal
+		size_t differing = 0;
+		for (size_t k = 0; k != size_t(width) * height * 3; ++k) {
+			differing += scalarImage.GetData()[k] != simdImage.GetData()[k];
+		}
+
+		std::cout << width << "x" << height << " pixels, best of " << nRuns << " runs, " << std::thread::hardware_concurrency() << " hardware threads\n\n";
+		std::cout << std::setw(28) << "method" << std::setw(12) << "ms" << std::setw(12) << "speedup" << "\n";
+		std::cout << std::setw(28) << "SetPixelColor per pixel" << std::setw(12) << std::fixed << std::setprecision(2) << scalarTime * 1e3 << std::setw(12) << 1.0 << "\n";
+		std::cout << std::setw(28) << "resolve (1 thread)" << std::setw(12) << oneThreadTime * 1e3 << std::setw(12) << scalarTime / oneThreadTime << "\n";
+		std::cout << std::setw(28) << "resolve (all threads)" << std::setw(12) << allThreadsTime * 1e3 << std::setw(12) << scalarTime / allThreadsTime << "\n";
+		std::cout << "\ndiffering bytes: " << differing << "\n" << std::defaultfloat;
+	}
+
+	// saving of 4k image with stb_image_write against PngWriter on one and all threads,
+	// image is smooth gradient with noise of few samples per pixel, like unfinished render
+	void BenchmarkPng() {
+		const uint32_t width = 3840;
+		const uint32_t height = 2160;
+		const uint32_t nRuns = 3;
+
+		Image image(width, height);
+		PCG32 rng(width);
+		for (uint32_t j = 0; j != height; ++j) {
+			for (uint32_t i = 0; i != width; ++i) {
+				glm::vec3 color(float(i) / width, float(j) / height, 0.5f + 0.5f * std::sin(i * 0.01f + j * 0.02f));
+				image.SetPixelColor(i, j, color * (0.8f + 0.2f * Random(rng)));
+			}
+		}
+
+		const std::string stbPath = GetOutputPath("benchmark-stb", "png");
+		const std::string writerPath = GetOutputPath("benchmark-writer", "png");
+		auto save = [&](uint32_t nThreads) {
+			PngWriter png(writerPath, width, height, 3, nThreads);
+			png.WriteRows(image.GetData(), 0, height);
+			png.Finish();
+		};
+
+		double stbTime = infinity, oneThreadTime = infinity, allThreadsTime = infinity;
+		for (uint32_t run = 0; run != nRuns; ++run) {
+			stbTime = std::min(stbTime, MeasureSeconds([&]() { stbi_write_png(stbPath.c_str(), width, height, 3, image.GetData(), width * 3); }));
+			oneThreadTime = std::min(oneThreadTime, MeasureSeconds([&]() { save(1); }));
+			allThreadsTime = std::min(allThreadsTime, MeasureSeconds([&]() { save(0); }));
+		}
+
+		// written file must decode to the same pixels
+		size_t differing = 0;
+		int w, h, n;
+		uint8_t *decoded = stbi_load(writerPath.c_str(), &w, &h, &n, 3);
+		if (decoded == nullptr || uint32_t(w) != width || uint32_t(h) != height) {
+			std::cerr << "failed to decode " << writerPath << "\n";
+			exit(1);
+		}
+		for (size_t k = 0; k != size_t(width) * height * 3; ++k) {
+			differing += decoded[k] != image.GetData()[k];
+		}
+		stbi_image_free(decoded);
+
+		auto megabytes = [](const std::string &path) { return std::filesystem::file_size(path) / 1e6; };
+		std::cout << width << "x" << height << " pixels, best of " << nRuns << " runs, " << std::thread::hardware_concurrency() << " hardware threads\n\n";
+		std::cout << std::setw(28) << "method" << std::setw(12) << "ms" << std::setw(12) << "speedup" << std::setw(12) << "MB" << "\n";
+		std::cout << std::setw(28) << "stbi_write_png" << std::setw(12) << std::fixed << std::setprecision(2) << stbTime * 1e3 << std::setw(12) << 1.0 << std::setw(12) << megabytes(stbPath) << "\n";
+		std::cout << std::setw(28) << "PngWriter (1 thread)" << std::setw(12) << oneThreadTime * 1e3 << std::setw(12) << stbTime / oneThreadTime << std::setw(12) << megabytes(writerPath) << "\n";
+		std::cout << std::setw(28) << "PngWriter (all threads)" << std::setw(12) << allThreadsTime * 1e3 << std::setw(12) << stbTime / allThreadsTime << std::setw(12) << megabytes(writerPath) << "\n";
+		std::cout << "\ndiffering bytes: " << differing << "\n" << std::defaultfloat;
+	}
+
+	// street-like scene: ground with n small lamps above it, total area and power of lamps don't depend on n
+	// lamps are one-sided quads tilted randomly (up to 30 degrees) downwards, so camera above sees only lit ground
+	void GenerateLamps(Scene &scene, uint32_t n) {
+		uint32_t ground = scene.AddMaterial(Lambertian(glm::vec3(0.6f), 0.0f, 0.0f, nullptr, 1.0f));
+		scene.AddObject(std::make_unique<Quad>(glm::vec3(-10, 0, -10), glm::vec3(20, 0, 0), glm::vec3(0, 0, 20), ground, false));
+
+		const float size = 1.6f / std::sqrt(float(n));
+		PCG32 rng(n);
+		for (uint32_t i = 0; i != n; ++i) {
+			glm::vec3 color = glm::vec3(Random(rng), Random(rng), Random(rng)) * 8.0f;
+			uint32_t mat = scene.AddMaterial(DiffuseLight(color));
+
+			// one-sided quad is visible against its normal (cross(u, v)), so normal points up
+			glm::vec3 normal = RandomInCone(glm::vec3(0, 1, 0), 0.866f, glm::vec2(Random(rng), Random(rng)));
+			glm::vec3 u = size * glm::normalize(glm::cross(normal, RandomVec(rng)));
+			glm::vec3 v = glm::cross(normal, u);
+			glm::vec3 p(Random(-10, 10, rng), Random(1.0f, 3.0f, rng), Random(-10, 10, rng));
+
+			auto lamp = std::make_unique<Quad>(p, u, v, mat, true);
+			scene.AddLight(lamp.get());
+			scene.AddObject(std::move(lamp));
+		}
+	}
+
+	// uniform light selection against light hierarchy for growing number of lights
+	void BenchmarkManyLights() {
+		const uint32_t width = 200;
+		const uint32_t height = 200;
+		const uint32_t nSamples = 8;
+
+		std::cout << "\nground with lamps, " << width << "x" << height << ", " << nSamples << " samples per pixel\n\n";
+		PrintSamplingHeader("lights");
+
+		for (uint32_t nLights : { 16u, 256u, 4096u, 65536u }) {
+			Scene scene;
+			GenerateLamps(scene, nLights);
+			scene.Build();
+			Camera camera(nSamples, 4, glm::vec3(0, 15, 3), glm::vec3(0, 0, 0), 60, 0, 1, 3, 0.1f);
+
+			scene.SetUniformLightSelection(true);
+			SamplingResult uniform = MeasureSampling(camera, scene, width, height, nSamples);
+			scene.SetUniformLightSelection(false);
+			SamplingResult hierarchy = MeasureSampling(camera, scene, width, height, nSamples);
+
+			PrintSamplingComparison(std::to_string(nLights), "uniform", uniform, "light bvh", hierarchy);
+		}
+	}
+
+	// equirectangular hdr sky with small bright sun, written to output directory
+	// (sun disk has radius of about 2 degrees and gives most of the light)
+	std::string WriteBenchmarkSky() {
+		const uint32_t width = 1024;
+		const uint32_t height = 512;
+		const glm::vec3 sunDir = glm::normalize(glm::vec3(-1.0f, 1.2f, 0.5f));
+		const float cosSun = std::cos(glm::radians(2.0f));
+
+		std::vector<float> data(width * height * 3);
+		for (uint32_t y = 0; y != height; ++y) {
+			for (uint32_t x = 0; x != width; ++x) {
+				// texel center to direction, the same mapping as ImageTexture
+				float theta = pi * (y + 0.5f) / height;
+				float phi = 2.0f * pi * (x + 0.5f) / width - pi;
+				glm::vec3 dir(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+
+				glm::vec3 color = dir.y > 0 ? glm::mix(glm::vec3(0.8f, 0.9f, 1.0f), glm::vec3(0.2f, 0.4f, 0.9f), dir.y) : glm::vec3(0.1f);
+				if (glm::dot(dir, sunDir) > cosSun) {
+					color = glm::vec3(1000.0f, 900.0f, 800.0f);
+				}
+				std::memcpy(&data[(y * width + x) * 3], &color, sizeof(color));
+			}
+		}
+
+		const std::string name = "benchmark-sky.hdr";
+		std::string filePath = name;
+		#ifdef OUTPUT_DIR
+			filePath = std::string(OUTPUT_DIR) + "/" + name;
+		#endif
+		if (!stbi_write_hdr(filePath.c_str(), width, height, 3, data.data())) {
+			std::cerr << "error! can't write sky image: " << filePath << "\n";
+			exit(1);
+		}
+		return name;
+	}
+
+	// skybox importance sampling with MIS against scattering only
+	// ground and glossy sphere under hdr sky with sun (uniform skies are not importance sampled)
+	void BenchmarkSkybox() {
+		const uint32_t width = 160;
+		const uint32_t height = 90;
+		const uint32_t nSamples = 32;
+
+		Scene scene;
+		scene.AddSkybox(std::make_unique<ImageTexture>(WriteBenchmarkSky(), true, 2000.0f));
+
+		uint32_t ground = scene.AddMaterial(Lambertian(glm::vec3(0.6f), 0.0f, 0.0f, nullptr, 1.0f));
+		uint32_t plastic = scene.AddMaterial(Lambertian(glm::vec3(0.8f, 0.3f, 0.3f), 0.9f, 0.1f, nullptr, 1.0f));
+		scene.AddObject(std::make_unique<Quad>(glm::vec3(-5, 0, -5), glm::vec3(10, 0, 0), glm::vec3(0, 0, 10), ground, false));
+		scene.AddObject(std::make_unique<Sphere>(glm::vec3(0, 1, 0), 1.0f, plastic));
+		scene.Build();
+
+		Camera camera(nSamples, 10, glm::vec3(5, 3, -7), glm::vec3(0, 1, 0), 30, 0, 9.11f, 3, 0.1f);
+
+		std::cout << "\n" << width << "x" << height << ", " << nSamples << " samples per pixel\n\n";
+		PrintSamplingHeader("skybox");
+
+		camera.SetLightSampling(false);
+		SamplingResult scattering = MeasureSampling(camera, scene, width, height, nSamples);
+		camera.SetLightSampling(true);
+		SamplingResult mis = MeasureSampling(camera, scene, width, height, nSamples);
+
+		PrintSamplingComparison("hdr sun", "scattering", scattering, "skybox + mis", mis);
+	}
+
+	void RunBenchmark(const std::string &name) {
+		std::cout << "\n=== Benchmark: " << name << " ===\n\n";
+
+		if (name == "bvh") {
+			BenchmarkBVH();
+		} else if (name == "bvh-build") {
+			BenchmarkBVHBuild();
+		} else if (name == "bvh-wide") {
+			BenchmarkWideBVH();
+		} else if (name == "occlusion") {
+			BenchmarkOcclusion();
+		} else if (name == "materials") {
+			BenchmarkMaterials();
+		} else if (name == "roulette") {
+			BenchmarkRoulette();
+		} else if (name == "nee") {
+			BenchmarkLightSampling();
+		} else if (name == "wavefront") {
+			BenchmarkWavefront();
+		} else if (name == "tiles") {
+			BenchmarkTiles();
+		} else if (name == "sampler") {
+			BenchmarkSampler();
+		} else if (name == "resolve") {
+			BenchmarkResolve();
+		} else if (name == "png") {
+			BenchmarkPng();
+		} else if (name == "rng") {
+			BenchmarkRandom();
+		} else if (name == "lights") {
+			BenchmarkManyLights();
+		} else if (name == "skybox") {
+			BenchmarkSkybox();
+		} else {
+			std::cerr << "unknown benchmark - " << name << "\n";
+			exit(1);
+		}
+
+		std::cout << "\n";
+	}
+}
@@ -0,0 +1,502 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <future>
+#include <thread>
+
+#include "hittable.hpp"
+
+namespace art {
+
+	// flattened bvh node (32 bytes, two nodes per cache line)
+	// interior node: first child is the next node in array, offset is index of second child
+	// leaf node: offset is index of first primitive in reordered primitive list
+	struct BVHNode {
+		AABB     bounds;
+		uint32_t offset;
+		uint16_t nPrims;  // 0 for interior nodes
+		uint8_t  axis;    // split axis, used to visit near child first
+		uint8_t  pad;
+	};
+
+
+	// bounding volume hierarchy built with binned surface area heuristic
+	// BVH knows only primitive bounds, owner of primitives must reorder them
+	// with GetPrimIndices() after building so that leaves reference contiguous ranges
+	class BVH final {
+	public:
+		BVH() = default;
+
+		void Build(const std::vector<AABB> &primBounds) {
+			m_nodes.clear();
+			m_primIndices.clear();
+
+			uint32_t nPrims = static_cast<uint32_t>(primBounds.size());
+			if (nPrims == 0) {
+				return;
+			}
+
+			// primitive references are partitioned in place, so every pass over a range is sequential in memory
+			m_refs.resize(nPrims);
+			for (uint32_t i = 0; i != nPrims; ++i) {
+				m_refs[i] = PrimRef{ primBounds[i], i };
+			}
+
+			// top levels of the tree are built by separate tasks (2^depth of them),
+			// a few more tasks than cores helps to balance uneven subtrees
+			uint32_t nThreads = std::max(1u, std::thread::hardware_concurrency());
+			m_nThreads = nThreads;
+			m_spawnDepth = 3;
+			while ((1u << (m_spawnDepth - 3)) < nThreads) {
+				++m_spawnDepth;
+			}
+
+			BuildRange root(0, nPrims);
+			ComputeRangeBounds(root);
+
+			std::unique_ptr<Subtree> tree = BuildParallel(root, 0);
+
+			m_nodes.reserve(2 * nPrims / kMaxLeafPrims + 1);
+			Flatten(*tree);
+			m_nodes.shrink_to_fit();
+
+			m_primIndices.resize(nPrims);
+			for (uint32_t i = 0; i != nPrims; ++i) {
+				m_primIndices[i] = m_refs[i].index;
+			}
+			std::vector<PrimRef>().swap(m_refs);  // free build scratch memory
+		}
+
+		// primHit(primIndex, tSpan, tClosest) is called for every primitive in visited leaves,
+		// it must return true and update tClosest if primitive was hit
+		template<typename PrimHit>
+		bool Intersect(const Ray &r, Interval tSpan, PrimHit &&primHit) const {
+			if (m_nodes.empty()) {
+				return false;
+			}
+
+			glm::vec3 ro = r.GetOrigin();
+			glm::vec3 invDir = 1.0f / r.GetDirection();
+			bool dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+			float tClosest = tSpan.GetMax();
+			bool hit = false;
+
+			uint32_t stack[kMaxDepth + 1];
+			uint32_t stackSize = 0;
+			uint32_t current = 0;
+
+			while (true) {
+				const BVHNode &node = m_nodes[current];
+
+				if (node.bounds.Hit(ro, invDir, Interval(tSpan.GetMin(), tClosest))) {
+					if (node.nPrims > 0) {
+						for (uint32_t i = node.offset, ie = node.offset + node.nPrims; i != ie; ++i) {
+							if (primHit(i, Interval(tSpan.GetMin(), tClosest), tClosest)) {
+								hit = true;
+							}
+						}
+					} else {
+						// visit near child first, far child goes to stack
+						if (dirIsNeg[node.axis]) {
+							stack[stackSize++] = current + 1;
+							current = node.offset;
+						} else {
+							stack[stackSize++] = node.offset;
+							current = current + 1;
+						}
+						continue;
+					}
+				}
+
+				if (stackSize == 0) {
+					break;
+				}
+				current = stack[--stackSize];
+			}
+
+			return hit;
+		}
+
+		// any hit query, primHit(primIndex, tSpan) must return true if primitive was hit
+		// traversal stops at the first hit, so order of children doesn't matter
+		template<typename PrimHit>
+		bool Occluded(const Ray &r, Interval tSpan, PrimHit &&primHit) const {
+			if (m_nodes.empty()) {
+				return false;
+			}
+
+			glm::vec3 ro = r.GetOrigin();
+			glm::vec3 invDir = 1.0f / r.GetDirection();
+
+			uint32_t stack[kMaxDepth + 1];
+			uint32_t stackSize = 0;
+			uint32_t current = 0;
+
+			while (true) {
+				const BVHNode &node = m_nodes[current];
+
+				if (node.bounds.Hit(ro, invDir, tSpan)) {
+					if (node.nPrims > 0) {
+						for (uint32_t i = node.offset, ie = node.offset + node.nPrims; i != ie; ++i) {
+							if (primHit(i, tSpan)) {
+								return true;
+							}
+						}
+					} else {
+						stack[stackSize++] = node.offset;
+						current = current + 1;
+						continue;
+					}
+				}
+
+				if (stackSize == 0) {
+					return false;
+				}
+				current = stack[--stackSize];
+			}
+		}
+
+		AABB Bounds() const { return m_nodes.empty() ? AABB() : m_nodes[0].bounds; }
+
+		const std::vector<uint32_t> &GetPrimIndices() const { return m_primIndices; }
+		const std::vector<BVHNode>  &GetNodes()       const { return m_nodes; }
+
+	private:
+		static constexpr uint32_t kBins               = 32;
+		static constexpr uint32_t kMaxDepth           = 64;
+		static constexpr uint32_t kMaxLeafPrims       = 4;
+		static constexpr uint32_t kParallelBuildMin   = 1 << 12;  // smaller subtrees are built by one thread
+		static constexpr uint32_t kParallelBinningMin = 1 << 16;  // larger ranges are binned by all threads
+		static constexpr float    kTraversalCost      = 1.0f;     // relative to cost of one primitive intersection
+
+		struct PrimRef {
+			AABB     bounds;
+			uint32_t index;
+
+			glm::vec3 Centroid() const { return bounds.Centroid(); }
+		};
+
+		// bounds are empty until they are computed or expanded
+		struct BuildRange {
+			uint32_t begin = 0;
+			uint32_t end = 0;
+			AABB     bounds;          // bounds of all primitives in range
+			AABB     centroidBounds;  // bounds of primitive centroids, used for binning
+
+			BuildRange() = default;
+			BuildRange(uint32_t begin, uint32_t end) : begin(begin), end(end) {}
+		};
+
+		// plain data without constructor, only bins in use are initialized
+		struct Bin {
+			glm::vec3 bMin, bMax;
+			glm::vec3 cMin, cMax;
+			uint32_t  count;
+
+			void Reset() {
+				bMin = cMin = glm::vec3(+infinity);
+				bMax = cMax = glm::vec3(-infinity);
+				count = 0;
+			}
+
+			AABB Bounds()         const { return count ? AABB(bMin, bMax) : AABB(); }
+			AABB CentroidBounds() const { return count ? AABB(cMin, cMax) : AABB(); }
+		};
+
+		struct Split {
+			int        axis = -1;
+			uint32_t   bin = 0;
+			uint32_t   nBins = 0;
+			float      cost = infinity;
+			BuildRange left;
+			BuildRange right;
+		};
+
+		// part of the tree built by one task, either interior node with two subtrees
+		// or sequentially built nodes with offsets relative to the start of this subtree
+		struct Subtree {
+			BVHNode                  node;
+			std::unique_ptr<Subtree> children[2];
+			std::vector<BVHNode>     nodes;
+		};
+
+		struct Bins {
+			uint32_t nBins;
+			Bin      bins[3][kBins];
+
+			explicit Bins(uint32_t n) : nBins(n) {
+				for (int axis = 0; axis != 3; ++axis) {
+					for (uint32_t b = 0; b != nBins; ++b) {
+						bins[axis][b].Reset();
+					}
+				}
+			}
+		};
+
+		void ComputeRangeBounds(BuildRange &range) const {
+			range.bounds = AABB();
+			range.centroidBounds = AABB();
+			for (uint32_t i = range.begin; i != range.end; ++i) {
+				range.bounds.Expand(m_refs[i].bounds);
+				range.centroidBounds.Expand(m_refs[i].Centroid());
+			}
+		}
+
+		// maps centroid to bin along every axis of range
+		struct BinMapping {
+			glm::vec3 cMin;
+			glm::vec3 scale;
+			uint32_t  nBins;
+
+			BinMapping(const BuildRange &range, uint32_t n) : cMin(range.centroidBounds.GetMin()), nBins(n) {
+				glm::vec3 extent = range.centroidBounds.Extent();
+				for (int axis = 0; axis != 3; ++axis) {
+					scale[axis] = extent[axis] > 0 ? nBins / extent[axis] : 0.0f;
+				}
+			}
+
+			uint32_t operator()(const glm::vec3 &c, int axis) const {
+				uint32_t b = static_cast<uint32_t>((c[axis] - cMin[axis]) * scale[axis]);
+				return std::min(b, nBins - 1);
+			}
+		};
+
+		void FillBins(const BuildRange &range, uint32_t begin, uint32_t end, Bins &bins) const {
+			BinMapping mapping(range, bins.nBins);
+			for (uint32_t i = begin; i != end; ++i) {
+				const PrimRef &ref = m_refs[i];
+				glm::vec3 c = ref.Centroid();
+				for (int axis = 0; axis != 3; ++axis) {
+					Bin &bin = bins.bins[axis][mapping(c, axis)];
+					bin.bMin = glm::min(bin.bMin, ref.bounds.GetMin());
+					bin.bMax = glm::max(bin.bMax, ref.bounds.GetMax());
+					bin.cMin = glm::min(bin.cMin, c);
+					bin.cMax = glm::max(bin.cMax, c);
+					bin.count++;
+				}
+			}
+		}
+
+		// bins primitive centroids along every axis and finds split with the lowest SAH cost
+		// large ranges are binned in parallel chunks which are merged afterwards,
+		// ranges at depth d share cores with 2^d - 1 other subtree tasks, so they get 1 / 2^d of threads
+		// and below depth log2(threads) subtree tasks alone cover all cores
+		bool FindSplit(const BuildRange &range, uint32_t depth, Split &split) const {
+			uint32_t count = range.end - range.begin;
+			uint32_t nChunks = depth < 32 ? m_nThreads >> depth : 0;
+
+			// small ranges don't need many bins, this keeps cost of deep levels low
+			Bins bins(std::min(kBins, count));
+			if (count < kParallelBinningMin || nChunks <= 1) {
+				FillBins(range, range.begin, range.end, bins);
+			} else {
+				uint32_t chunkSize = (count + nChunks - 1) / nChunks;
+				std::vector<Bins> chunkBins(nChunks, Bins(bins.nBins));
+				std::vector<std::future<void>> tasks;
+				for (uint32_t t = 0; t != nChunks; ++t) {
+					uint32_t begin = range.begin + t * chunkSize;
+					uint32_t end = std::min(range.end, begin + chunkSize);
+					if (begin < end) {
+						tasks.push_back(std::async(std::launch::async, [&, t, begin, end]() {
+							FillBins(range, begin, end, chunkBins[t]);
+						}));
+					}
+				}
+				for (auto &task : tasks) {
+					task.wait();
+				}
+
+				for (const Bins &chunk : chunkBins) {
+					for (int axis = 0; axis != 3; ++axis) {
+						for (uint32_t b = 0; b != bins.nBins; ++b) {
+							Bin &bin = bins.bins[axis][b];
+							const Bin &other = chunk.bins[axis][b];
+							bin.bMin = glm::min(bin.bMin, other.bMin);
+							bin.bMax = glm::max(bin.bMax, other.bMax);
+							bin.cMin = glm::min(bin.cMin, other.cMin);
+							bin.cMax = glm::max(bin.cMax, other.cMax);
+							bin.count += other.count;
+						}
+					}
+				}
+			}
+
+			glm::vec3 extent = range.centroidBounds.Extent();
+			for (int axis = 0; axis != 3; ++axis) {
+				if (extent[axis] <= 0) {
+					continue;
+				}
+
+				// sweep bins from right, then from left evaluating every bin boundary
+				const Bin *axisBins = bins.bins[axis];
+				float rightAreas[kBins];
+				uint32_t rightCounts[kBins];
+				AABB right;
+				uint32_t rightCount = 0;
+				for (uint32_t b = bins.nBins - 1; b > 0; --b) {
+					right.Expand(axisBins[b].Bounds());
+					rightCount += axisBins[b].count;
+					rightAreas[b] = right.SurfaceArea();
+					rightCounts[b] = rightCount;
+				}
+
+				AABB left;
+				uint32_t leftCount = 0;
+				for (uint32_t b = 1; b != bins.nBins; ++b) {
+					left.Expand(axisBins[b - 1].Bounds());
+					leftCount += axisBins[b - 1].count;
+					if (leftCount == 0 || rightCounts[b] == 0) {
+						continue;
+					}
+
+					float cost = left.SurfaceArea() * leftCount + rightAreas[b] * rightCounts[b];
+					if (cost < split.cost) {
+						split.cost = cost;
+						split.axis = axis;
+						split.bin = b;
+					}
+				}
+			}
+
+			if (split.axis == -1) {
+				return false;
+			}
+
+			// children bounds are known from bins, no need for another pass over primitives
+			split.nBins = bins.nBins;
+			split.left = BuildRange{};
+			split.right = BuildRange{};
+			uint32_t nLeft = 0;
+			for (uint32_t b = 0; b != bins.nBins; ++b) {
+				const Bin &bin = bins.bins[split.axis][b];
+				BuildRange &child = (b < split.bin) ? split.left : split.right;
+				child.bounds.Expand(bin.Bounds());
+				child.centroidBounds.Expand(bin.CentroidBounds());
+				nLeft += (b < split.bin) ? bin.count : 0;
+			}
+			split.left.begin = range.begin;
+			split.left.end = range.begin + nLeft;
+			split.right.begin = split.left.end;
+			split.right.end = range.end;
+
+			return true;
+		}
+
+		void Partition(const BuildRange &range, const Split &split) {
+			BinMapping mapping(range, split.nBins);
+			std::partition(m_refs.begin() + range.begin, m_refs.begin() + range.end, [&](const PrimRef &ref) {
+				return mapping(ref.Centroid(), split.axis) < split.bin;
+			});
+		}
+
+		// used when all centroids are the same and SAH can't separate primitives
+		void MedianSplit(const BuildRange &range, Split &split) const {
+			uint32_t mid = range.begin + (range.end - range.begin) / 2;
+			split.axis = 0;
+			split.left = BuildRange(range.begin, mid);
+			split.right = BuildRange(mid, range.end);
+			ComputeRangeBounds(split.left);
+			ComputeRangeBounds(split.right);
+		}
+
+		std::unique_ptr<Subtree> BuildParallel(const BuildRange &range, uint32_t depth) {
+			auto subtree = std::make_unique<Subtree>();
+
+			uint32_t count = range.end - range.begin;
+			Split split;
+			if (count < kParallelBuildMin || depth >= m_spawnDepth || !FindSplit(range, depth, split)) {
+				BuildSequential(subtree->nodes, range, depth);
+				return subtree;
+			}
+
+			Partition(range, split);
+
+			// left subtree goes to another thread, right one is built by current thread
+			auto left = std::async(std::launch::async, [&]() {
+				return BuildParallel(split.left, depth + 1);
+			});
+			subtree->children[1] = BuildParallel(split.right, depth + 1);
+			subtree->children[0] = left.get();
+
+			subtree->node.bounds = range.bounds;
+			subtree->node.nPrims = 0;
+			subtree->node.axis = static_cast<uint8_t>(split.axis);
+			return subtree;
+		}
+
+		uint32_t BuildSequential(std::vector<BVHNode> &nodes, const BuildRange &range, uint32_t depth) {
+			uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+			nodes.emplace_back();
+			nodes[nodeIndex].bounds = range.bounds;
+
+			uint32_t count = range.end - range.begin;
+			if (count == 1 || depth == kMaxDepth) {
+				MakeLeaf(nodes[nodeIndex], range);
+				return nodeIndex;
+			}
+
+			Split split;
+			if (FindSplit(range, depth, split)) {
+				float area = range.bounds.SurfaceArea();
+				float splitCost = kTraversalCost + (area > 0 ? split.cost / area : count);
+				if (count <= kMaxLeafPrims && splitCost >= count) {
+					MakeLeaf(nodes[nodeIndex], range);
+					return nodeIndex;
+				}
+				Partition(range, split);
+			} else if (count <= kMaxLeafPrims) {
+				MakeLeaf(nodes[nodeIndex], range);
+				return nodeIndex;
+			} else {
+				MedianSplit(range, split);
+			}
+
+			BuildSequential(nodes, split.left, depth + 1);
+			uint32_t secondChild = BuildSequential(nodes, split.right, depth + 1);
+
+			nodes[nodeIndex].offset = secondChild;
+			nodes[nodeIndex].nPrims = 0;
+			nodes[nodeIndex].axis = static_cast<uint8_t>(split.axis);
+			return nodeIndex;
+		}
+
+		static void MakeLeaf(BVHNode &node, const BuildRange &range) {
+			node.offset = range.begin;
+			node.nPrims = static_cast<uint16_t>(range.end - range.begin);
+			node.axis = 0;
+		}
+
+		// writes subtrees into final depth-first node array
+		void Flatten(Subtree &subtree) {
+			if (!subtree.children[0]) {
+				uint32_t base = static_cast<uint32_t>(m_nodes.size());
+				for (BVHNode node : subtree.nodes) {
+					if (node.nPrims == 0) {
+						node.offset += base;
+					}
+					m_nodes.push_back(node);
+				}
+				std::vector<BVHNode>().swap(subtree.nodes);
+				return;
+			}
+
+			uint32_t nodeIndex = static_cast<uint32_t>(m_nodes.size());
+			m_nodes.push_back(subtree.node);
+			Flatten(*subtree.children[0]);
+			m_nodes[nodeIndex].offset = static_cast<uint32_t>(m_nodes.size());
+			Flatten(*subtree.children[1]);
+		}
+
+		std::vector<BVHNode>  m_nodes;
+		std::vector<uint32_t> m_primIndices;
+
+		// build scratch data
+		std::vector<PrimRef> m_refs;
+		uint32_t             m_nThreads = 1;
+		uint32_t             m_spawnDepth = 0;
+	};
+}
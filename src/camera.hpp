@@ -3,42 +3,192 @@
 #include <iostream> // output
 #include <iomanip>  // formatting output
 #include <vector>
-#include <thread>
-#include <execution>
+#include <sstream>
+#include <chrono>
+#include <functional>
+#include <atomic>
 
 #include "hittable.hpp"
 #include "image.hpp"
 #include "utils.hpp"
 #include "material.hpp"
 #include "scene.hpp"
+#include "direct-light.hpp"
+#include "wavefront.hpp"
+#include "scheduler.hpp"
+#include "sampler.hpp"
+#include "framebuffer.hpp"
 
 namespace art {
+
+	// path integrator traces every path from start to finish,
+	// wavefront integrator advances many paths one bounce at a time (see WavefrontIntegrator)
+	enum class Integrator {
+		Path,
+		Wavefront
+	};
+
+
 	class Camera final {
 	public:
 
 		Camera() : 
 			m_nSamples(10), 
 			m_maxDepth(10),
+			m_rouletteDepth(3),
+			m_rouletteThreshold(0.1f),
+			m_lightSampling(true),
+			m_integrator(Integrator::Path),
+			m_samplerType(SamplerType::Sobol),
+			m_adaptiveThreshold(0),
+			m_timeLimit(0),
+			m_targetError(0),
+			m_checkpointInterval(60),
+			m_nThreads(0),
+			m_tileSize(16),
 			m_pos(glm::vec3(0.0)),
 			m_lookAt(glm::vec3(0, 0, -1)),
 			m_fov(45),
 			m_defocusAngle(0),
 			m_focusDist(1) {}
 
-		Camera(uint32_t nSamples, uint32_t maxDepth, glm::vec3 Pos, glm::vec3 lookAt, float fov, float defocusAngle, float focusDist) :
+		Camera(uint32_t nSamples, uint32_t maxDepth, glm::vec3 Pos, glm::vec3 lookAt, float fov, float defocusAngle, float focusDist, uint32_t rouletteDepth, float rouletteThreshold) :
 			m_nSamples(nSamples), 
 			m_maxDepth(maxDepth), 
+			m_rouletteDepth(rouletteDepth),
+			m_rouletteThreshold(rouletteThreshold),
+			m_lightSampling(true),
+			m_integrator(Integrator::Path),
+			m_samplerType(SamplerType::Sobol),
+			m_adaptiveThreshold(0),
+			m_timeLimit(0),
+			m_targetError(0),
+			m_checkpointInterval(60),
+			m_nThreads(0),
+			m_tileSize(16),
 			m_pos(Pos),
 			m_lookAt(lookAt),
 			m_fov(fov),
 			m_defocusAngle(defocusAngle),
 			m_focusDist(focusDist) {}
 
+		// called with unfinished framebuffer during progressive rendering
+		using Checkpoint = std::function<void(const Framebuffer &)>;
+
+		// called when rows [y0, y1) of framebuffer have all their samples (from rendering threads),
+		// so they can be saved while the rest of image is rendered, every row is reported once
+		using RowsDone = std::function<void(uint32_t y0, uint32_t y1)>;
+
+		// renders and resolves image
 		void Render(Image &image, Scene &scene) const {
+			Framebuffer framebuffer = CreateFramebuffer(image.GetWidth(), image.GetHeight());
+			Render(framebuffer, scene);
+			framebuffer.Resolve(image, m_nThreads);
+		}
+
+		// framebuffer has tiles of camera and tracks variance when it is needed (see CreateFramebuffer())
+		void Render(Framebuffer &framebuffer, Scene &scene, const Checkpoint &checkpoint = nullptr, const RowsDone &rowsDone = nullptr) const {
+			const uint32_t width = framebuffer.GetWidth();
+			const uint32_t height = framebuffer.GetHeight();
+			Setup(width, height);
+
+			// these modes finish all rows at once
+			if (m_integrator == Integrator::Wavefront || IsProgressive()) {
+				if (m_integrator == Integrator::Wavefront) {
+					RenderWavefront(framebuffer, scene);
+				} else {
+					RenderPasses(framebuffer, scene, checkpoint);
+				}
+				if (rowsDone) {
+					rowsDone(0, height);
+				}
+				return;
+			}
+
+			// main loop
+			std::cout << "Starting to render...\n" << std::flush;
+
+			// tiles left in every row of tiles, the last tile of row reports it
+			std::vector<std::atomic<uint32_t>> tilesLeft((height + m_tileSize - 1) / m_tileSize);
+			for (std::atomic<uint32_t> &left : tilesLeft) {
+				left = (width + m_tileSize - 1) / m_tileSize;
+			}
+
+			TileScheduler scheduler(m_nThreads, m_tileSize);
+			scheduler.Run(width, height,
+				[&](const Tile &tile) {
+					RenderTile(tile, 0, width, framebuffer, scene);
+					if (rowsDone && --tilesLeft[tile.y0 / m_tileSize] == 0) {
+						rowsDone(tile.y0, tile.y1);
+					}
+				},
+				[](uint32_t done, uint32_t total) { PrintProgress(done, total); }
+			);
+
+			// precision of local stream, so it doesn't change later output of std::cout
+			std::stringstream msg;
+			msg << "\t" << scheduler.GetTileCount() << " tiles on " << scheduler.GetWorkerCount() << " threads, utilization " 
+			    << std::fixed << std::setprecision(1) << scheduler.GetUtilization() * 100 << "%\n";
+			std::cout << msg.str();
+		}
+
+		// called with finished band of rows [y0, y0 + band height) of image
+		using BandFlush = std::function<void(const Framebuffer &band, uint32_t y0)>;
+
+		// renders image by bands of tile rows, every band is passed to flush and its memory is reused,
+		// so memory doesn't depend on height of image (for images that don't fit into memory)
+		// samples are the same as in Render(), only fixed number of samples is supported
+		void RenderStreaming(uint32_t width, uint32_t height, Scene &scene, const BandFlush &flush) const {
+			if (m_integrator == Integrator::Wavefront || IsProgressive()) {
+				std::cerr << "streaming output supports only path integrator with fixed number of samples\n";
+				exit(1);
+			}
+			Setup(width, height);
+
+			// band has enough tiles to keep all threads busy
+			TileScheduler scheduler(m_nThreads, m_tileSize);
+			const uint32_t nThreads = m_nThreads != 0 ? m_nThreads : std::max(1u, std::thread::hardware_concurrency());
+			const uint32_t tilesX = (width + m_tileSize - 1) / m_tileSize;
+			const uint32_t bandRows = (kStreamingTilesPerThread * nThreads + tilesX - 1) / tilesX * m_tileSize;
+			const uint32_t nBands = (height + bandRows - 1) / bandRows;
+
+			std::cout << "Starting to render (streaming, " << nBands << " bands of " << bandRows << " rows)...\n" << std::flush;
+
+			Framebuffer band(width, std::min(bandRows, height), m_tileSize, false, m_aovs);
+			for (uint32_t y0 = 0, b = 0; y0 < height; y0 += bandRows, ++b) {
+				const uint32_t rows = std::min(bandRows, height - y0);
+				if (rows != band.GetHeight()) {
+					band = Framebuffer(width, rows, m_tileSize, false, m_aovs);  // last band is shorter
+				} else {
+					band.Clear();
+				}
+
+				std::vector<Tile> tiles = scheduler.Split(width, rows);
+				for (Tile &tile : tiles) {
+					tile.y0 += y0;
+					tile.y1 += y0;
+				}
+				scheduler.Run(std::move(tiles),
+					[&](const Tile &tile) { RenderTile(tile, y0, width, band, scene); },
+					[](uint32_t, uint32_t) {}
+				);
+
+				flush(band, y0);
+				PrintProgress(b + 1, nBands);
+			}
+		}
+
+		// framebuffer for image of given size that matches tiles of this camera
+		Framebuffer CreateFramebuffer(uint32_t width, uint32_t height) const {
+			return Framebuffer(width, height, m_tileSize, IsProgressive(), m_aovs);
+		}
+
+		// computes viewport for image of given size, must be called before SamplePixel()
+		void Setup(uint32_t width, uint32_t height) const {
 			// camera
 			float h = std::tan(glm::radians(m_fov) / 2);
 			float viewportHeight = 2 * h * m_focusDist;
-			float viewportWidth = viewportHeight * (float(image.GetWidth()) / image.GetHeight());
+			float viewportWidth = viewportHeight * (float(width) / height);
 
 			// vieport basis
 			glm::vec3 u, v, w;
@@ -49,8 +199,8 @@ namespace art {
 			// viewport vectors
 			glm::vec3 viewportU = viewportWidth * u;
 			glm::vec3 viewportV = viewportHeight * -v;
-			m_pixelDeltaU = viewportU / float(image.GetWidth());
-			m_pixelDeltaV = viewportV / float(image.GetHeight());
+			m_pixelDeltaU = viewportU / float(width);
+			m_pixelDeltaV = viewportV / float(height);
 			glm::vec3 viewportUpperLeft = m_pos - (m_focusDist * w) - viewportU / 2.0f - viewportV / 2.0f;
 			m_pixel00Pos = viewportUpperLeft + 0.5f * (m_pixelDeltaU + m_pixelDeltaV);
 
@@ -58,91 +208,365 @@ namespace art {
 			float defocusRadius = m_focusDist * std::tan(glm::radians(m_defocusAngle / 2));
 			m_defocusU = u * defocusRadius;
 			m_defocusV = v * defocusRadius;
+		}
+
+		// radiance of one path through pixel, sampler gives all numbers of path
+		// (first two dimensions are position inside pixel, next two are position on lens)
+		// output variables of path are written to aov if it is not null
+		glm::vec3 SamplePixel(uint32_t i, uint32_t j, Sampler &sampler, const Scene &scene, AovSample *aov = nullptr) const {
+			glm::vec2 uPixel = sampler.Get2D();
+			glm::vec2 uLens = sampler.Get2D();
+			return RayColor(GetRay(i, j, uPixel - 0.5f, uLens), scene, sampler, aov);
+		}
+
+		void SetSamples(uint32_t nSamples) { m_nSamples = nSamples; }
+		void SetMaxDepth(uint32_t depth) { m_maxDepth = depth; }
+		void SetRouletteDepth(uint32_t depth) { m_rouletteDepth = depth; }
+		uint32_t GetRouletteDepth() const { return m_rouletteDepth; }
+		void SetLightSampling(bool enabled) { m_lightSampling = enabled; }
+		void SetIntegrator(Integrator integrator) { m_integrator = integrator; }
+		void SetSampler(SamplerType type) { m_samplerType = type; }
+		void SetAdaptiveThreshold(float threshold) { m_adaptiveThreshold = threshold; }
+		bool IsAdaptive() const { return m_adaptiveThreshold > 0; }
+		void SetTimeLimit(float seconds) { m_timeLimit = seconds; }
+		void SetTargetError(float error) { m_targetError = error; }
+		void SetCheckpointInterval(float seconds) { m_checkpointInterval = seconds; }
 
-			// stratification
-			stratNumRow = static_cast<int>(std::sqrt(m_nSamples));
-			stratRegionEdgeLength = 1.0 / stratNumRow;
+		// image is rendered in passes until it is good enough
+		bool IsProgressive() const { return IsAdaptive() || m_timeLimit > 0 || m_targetError > 0; }
+		void SetThreads(uint32_t nThreads) { m_nThreads = nThreads; }
+		void SetTileSize(uint32_t tileSize) { m_tileSize = std::max(1u, tileSize); }
+
+		// output variables of framebuffers created by camera
+		void SetAovs(const std::vector<Aov> &aovs) { m_aovs = aovs; }
+
+	private:
+		static constexpr uint32_t kAdaptiveFirstPass = 16;        // samples of every pixel before first error estimate
+		static constexpr uint32_t kStreamingTilesPerThread = 4;   // tiles of every thread in band of streaming render
 
-			// multi-threading
-			uint32_t height = image.GetHeight();
-			m_iteratorV.resize(height);
-			for (uint32_t i = 0; i < height; i++) {
-				m_iteratorV[i] = i;
+		// all samples of pixels of tile, framebuffer holds rows of image starting at y0
+		void RenderTile(const Tile &tile, uint32_t y0, uint32_t width, Framebuffer &framebuffer, const Scene &scene) const {
+			const bool aovs = framebuffer.HasAovs();
+			for (uint32_t j = tile.y0; j != tile.y1; ++j) {
+				for (uint32_t i = tile.x0; i != tile.x1; ++i) {
+
+					// every sample has its own sampler, so pixel doesn't depend on thread and tile size
+					uint32_t pixel = j * width + i;
+					glm::vec3 pixelColor(0);
+					for (uint32_t s = 0; s != m_nSamples; ++s) {
+						Sampler sampler = Sampler::Create(m_samplerType, pixel, s);
+						AovSample aov;
+						pixelColor += SamplePixel(i, j, sampler, scene, aovs ? &aov : nullptr);
+						if (aovs) {
+							framebuffer.AddAovSample(i, j - y0, aov);
+						}
+					}
+
+					framebuffer.AddSamples(i, j - y0, pixelColor, m_nSamples);
+				}
+			}
+		}
+
+		static void PrintProgress(uint32_t done, uint32_t total) {
+			// percent is printed only when it changes
+			if (uint64_t(done) * 100 / total != uint64_t(done - 1) * 100 / total) {
+				std::stringstream msg;
+				msg << "\tProgress: " << uint64_t(done) * 100 / total << "%\n";
+				std::cout << msg.str();
 			}
+		}
 
-			// pre compute
-			float pixel_scale = 1.0f / (stratNumRow * stratNumRow);
+		// image is rendered in passes, samples of every pass are added to framebuffer
+		// with adaptive sampling every pass doubles samples of tiles that are not converged
+		// (sampler gives well distributed points for every power of two), tile is converged when
+		// rms of errors of its pixels is below threshold
+		// rendering stops at m_nSamples samples, time limit or target error (rms of errors of all pixels),
+		// passes are shortened, so they fit into time limit and checkpoint interval
+		void RenderPasses(Framebuffer &framebuffer, const Scene &scene, const Checkpoint &checkpoint) const {
+			std::cout << "Starting to render (" << (IsAdaptive() ? "adaptive" : "progressive") << ")...\n" << std::flush;
 
-			// main loop
-			std::cout << "Starting to render...\n" << std::flush;
+			const uint32_t width = framebuffer.GetWidth();
+			const uint32_t height = framebuffer.GetHeight();
 
-#define MT 1
-#if MT
-			std::for_each(std::execution::par, m_iteratorV.begin(), m_iteratorV.end(),
-				[&](uint32_t j) {
+			TileScheduler scheduler(m_nThreads, m_tileSize);
+			std::vector<Tile> active = scheduler.Split(width, height);
+			const size_t nTiles = active.size();
+			uint64_t nPaths = 0;
 
-					for (uint32_t i = 0, ie = image.GetWidth(); i != ie; ++i) {
+			auto start = std::chrono::steady_clock::now();
+			double lastCheckpoint = 0;
+			std::string stopReason = "maximum samples";
 
-						glm::vec3 pixelColor(0);
-						for (uint32_t s_j = 0; s_j < stratNumRow; s_j++) {
-							for (uint32_t s_i = 0; s_i < stratNumRow; s_i++) {
-								art::Ray r = GetRay(i, j, s_i, s_j);
-								pixelColor += RayColor(r, m_maxDepth, scene);
+			const bool aovs = framebuffer.HasAovs();
+			uint32_t begin = 0;
+			uint32_t end = std::min(m_nSamples, IsAdaptive() ? kAdaptiveFirstPass : 1);
+			for (uint32_t pass = 1; ; ++pass) {
+				auto passStart = std::chrono::steady_clock::now();
+				scheduler.Run(active,
+					[&](const Tile &tile) {
+						for (uint32_t j = tile.y0; j != tile.y1; ++j) {
+							for (uint32_t i = tile.x0; i != tile.x1; ++i) {
+								uint32_t pixel = j * width + i;
+								for (uint32_t s = begin; s != end; ++s) {
+									Sampler sampler = Sampler::Create(m_samplerType, pixel, s);
+									AovSample aov;
+									framebuffer.AddSample(i, j, SamplePixel(i, j, sampler, scene, aovs ? &aov : nullptr));
+									if (aovs) {
+										framebuffer.AddAovSample(i, j, aov);
+									}
+								}
 							}
 						}
+					},
+					[](uint32_t, uint32_t) {}
+				);
 
-						image.SetPixelColor(i, j, pixelColor * pixel_scale);
-					}
+				auto now = std::chrono::steady_clock::now();
+				double elapsed = std::chrono::duration<double>(now - start).count();
+				double sampleTime = std::chrono::duration<double>(now - passStart).count() / (end - begin);  // one sample of all active pixels
+				nPaths += uint64_t(end - begin) * CountPixels(active);
 
-					std::stringstream msg;
-					msg << "\tRow " << j << "/" << height << " done\n";
-					std::cout << msg.str();
+				std::stringstream msg;
+				msg << "\tPass " << pass << ": " << active.size() << " of " << nTiles << " tiles, " << end << " samples per pixel, "
+				    << std::fixed << std::setprecision(1) << elapsed << " s\n";
+				std::cout << msg.str();
 
+				if (end == m_nSamples) {
+					break;
+				}
+				if (m_targetError > 0 && ImageError(framebuffer) <= m_targetError) {
+					stopReason = "target error";
+					break;
 				}
-			);
-#else
-			for (uint32_t j = 0, je = image.GetHeight(); j != je; ++j) {
-				std::cout << std::setprecision(2) << "\tProgress: " << int((float(j) / float(image.GetHeight())) * 100) << "%" << '\n' << std::flush;
-				for (uint32_t i = 0, ie = image.GetWidth(); i != ie; ++i) {
 
-					glm::vec3 pixelColor(0);
-					for (uint32_t s_j = 0; s_j < stratNumRow; s_j++) {
-						for (uint32_t s_i = 0; s_i < stratNumRow; s_i++) {
-							art::Ray r = GetRay(i, j, s_i, s_j);
-							pixelColor += RayColor(r, m_maxDepth, scene);
+				if (IsAdaptive()) {
+					std::vector<Tile> next;
+					for (const Tile &tile : active) {
+						if (TileError(tile, framebuffer) > m_adaptiveThreshold) {
+							next.push_back(tile);
 						}
 					}
+					active.swap(next);
+					if (active.empty()) {
+						stopReason = "all tiles converged";
+						break;
+					}
+				}
+
+				// next pass doubles samples, but doesn't go past time limit and next checkpoint
+				uint64_t nextEnd = std::min(uint64_t(end) * 2, uint64_t(m_nSamples));
+				if (checkpoint && m_checkpointInterval > 0) {
+					nextEnd = std::min(nextEnd, end + std::max(uint64_t(1), uint64_t(m_checkpointInterval / sampleTime)));
+				}
+				if (m_timeLimit > 0) {
+					nextEnd = std::min(nextEnd, end + uint64_t(std::max(m_timeLimit - elapsed, 0.0) / sampleTime));
+					if (nextEnd == end) {
+						stopReason = "time limit";
+						break;
+					}
+				}
 
-					image.SetPixelColor(i, j, pixelColor * pixel_scale);
+				if (checkpoint && m_checkpointInterval > 0 && elapsed - lastCheckpoint >= m_checkpointInterval) {
+					checkpoint(framebuffer);
+					lastCheckpoint = elapsed;
+				}
+
+				begin = end;
+				end = static_cast<uint32_t>(nextEnd);
+			}
+
+			uint32_t minCount = m_nSamples;
+			uint32_t maxCount = 0;
+			for (uint32_t j = 0; j != height; ++j) {
+				for (uint32_t i = 0; i != width; ++i) {
+					minCount = std::min(minCount, framebuffer.GetCount(i, j));
+					maxCount = std::max(maxCount, framebuffer.GetCount(i, j));
 				}
 			}
-#endif
+			const double nPixels = double(width) * height;
+
+			std::cout << "\tstopped by " << stopReason << ", error " << ImageError(framebuffer) << "\n";
+			std::stringstream msg;
+			msg << "\tsamples per pixel: min " << minCount << ", max " << maxCount << ", average "
+			    << std::fixed << std::setprecision(1) << double(nPaths) / nPixels
+			    << " (" << double(nPaths) * 100 / (double(m_nSamples) * nPixels) << "% of maximum)\n";
+			std::cout << msg.str();
+			if (IsAdaptive()) {
+				PrintSampleMap(framebuffer);
+			}
 		}
 
-	private:
-		glm::vec3 RayColor(const art::Ray &r, int currDepth, const art::Scene &scene) const {
-			if (currDepth <= 0) {  // reached bounce limit
-				return glm::vec3(0.0);
+		// rms of errors of pixels of tile
+		static float TileError(const Tile &tile, const Framebuffer &framebuffer) {
+			float sum = 0;
+			for (uint32_t j = tile.y0; j != tile.y1; ++j) {
+				for (uint32_t i = tile.x0; i != tile.x1; ++i) {
+					float error = framebuffer.GetError(i, j);
+					sum += error * error;
+				}
 			}
+			return std::sqrt(sum / ((tile.x1 - tile.x0) * (tile.y1 - tile.y0)));
+		}
 
-			// return background (skybox) if no hit
-			art::HitInfo info;
-			if (!scene.Hit(r, art::Interval(0.001, art::infinity), info)) {
-				return scene.SampleSkybox(r.GetDirection());
+		static float ImageError(const Framebuffer &framebuffer) {
+			double sum = 0;
+			for (uint32_t j = 0; j != framebuffer.GetHeight(); ++j) {
+				for (uint32_t i = 0; i != framebuffer.GetWidth(); ++i) {
+					float error = framebuffer.GetError(i, j);
+					sum += double(error) * error;
+				}
 			}
+			return static_cast<float>(std::sqrt(sum / (double(framebuffer.GetWidth()) * framebuffer.GetHeight())));
+		}
 
-			Ray rayOut;
-			glm::vec3 attenuation;
+		static uint64_t CountPixels(const std::vector<Tile> &tiles) {
+			uint64_t count = 0;
+			for (const Tile &tile : tiles) {
+				count += uint64_t(tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+			}
+			return count;
+		}
 
-			if (!info.mat->Scatter(r, info, attenuation, rayOut)) {
-				return attenuation;
-			} else {
-				return attenuation * RayColor(rayOut, currDepth - 1, scene);
+		// coarse map of samples per pixel, one character is average of block of pixels
+		// (' ' - few samples, '@' - maximum)
+		void PrintSampleMap(const Framebuffer &framebuffer) const {
+			const uint32_t width = framebuffer.GetWidth();
+			const uint32_t height = framebuffer.GetHeight();
+			const char *ramp = " .:-=+*#%@";
+			const uint32_t columns = std::min(width, 64u);
+			const uint32_t rows = std::max(1u, std::min(height, uint32_t(uint64_t(columns) * height / width / 2)));  // characters are twice as tall
+
+			std::cout << "\tsample map (" << columns << "x" << rows << "):\n";
+			for (uint32_t r = 0; r != rows; ++r) {
+				std::string line = "\t";
+				for (uint32_t c = 0; c != columns; ++c) {
+					uint64_t sum = 0, n = 0;
+					for (uint32_t j = r * height / rows; j != (r + 1) * height / rows; ++j) {
+						for (uint32_t i = c * width / columns; i != (c + 1) * width / columns; ++i) {
+							sum += framebuffer.GetCount(i, j);
+							++n;
+						}
+					}
+					float level = n != 0 ? float(sum) / (n * m_nSamples) : 0;
+					line += ramp[std::min(int(level * 10), 9)];
+				}
+				std::cout << line << "\n";
+			}
+		}
+
+		// the same samples as path integrator, traced in waves
+		void RenderWavefront(Framebuffer &framebuffer, const Scene &scene) const {
+			std::cout << "Starting to render (wavefront)...\n" << std::flush;
+
+			WavefrontIntegrator integrator(m_maxDepth, m_rouletteDepth, m_rouletteThreshold, m_lightSampling, m_nThreads);
+			std::vector<glm::vec3> pixels;
+			const uint32_t width = framebuffer.GetWidth();
+			integrator.Render(width, framebuffer.GetHeight(), m_nSamples, [&](uint32_t i, uint32_t j, uint32_t sample, Sampler &sampler) {
+				sampler = Sampler::Create(m_samplerType, j * width + i, sample);
+				glm::vec2 uPixel = sampler.Get2D();
+				glm::vec2 uLens = sampler.Get2D();
+				return GetRay(i, j, uPixel - 0.5f, uLens);
+			}, scene, pixels);
+
+			// integrator gives averages of samples
+			for (uint32_t j = 0; j != framebuffer.GetHeight(); ++j) {
+				for (uint32_t i = 0; i != width; ++i) {
+					framebuffer.AddSamples(i, j, pixels[size_t(j) * width + i] * float(m_nSamples), m_nSamples);
+				}
 			}
 		}
 
-		Ray GetRay(uint32_t i, uint32_t j, uint32_t s_i, uint32_t s_j) const {
-			glm::vec2 offset = art::RandomInStratifiedSquare(s_i, s_j, stratRegionEdgeLength);
+		// path is traced in a loop, throughput is product of attenuations along the path
+		// after roulette depth paths with throughput below threshold are terminated randomly
+		// (the lower throughput the higher probability), survived paths are weighted by
+		// 1 / probability, so the estimate stays unbiased
+		//
+		// at every vertex one light is sampled directly (next event estimation), light hit
+		// by scattered ray is counted too, both are weighted with power heuristic (MIS)
+		// skybox with importance map is sampled the same way with separate shadow ray
+		//
+		// output variables are taken from the first hit that doesn't scatter with perfect reflection
+		// or refraction (pdf 0), so mirrors and glass show what is seen through them
+		glm::vec3 RayColor(const art::Ray &r, const art::Scene &scene, Sampler &sampler, AovSample *aov = nullptr) const {
+			glm::vec3 color(0.0f);
+			glm::vec3 throughput(1.0f);
+			Ray ray = r;
+			float pathLength = 0;
+			float scatterPdf = 0;  // pdf of ray direction, 0 for camera ray and perfect reflections
+			glm::vec3 scatterN(0);  // normal at origin of ray, light selection depends on it
+
+			for (uint32_t depth = 0; depth != m_maxDepth; ++depth) {
+				// add background (skybox) if no hit
+				art::HitRecord rec;
+				if (!scene.Intersect(ray, art::Interval(0.001, art::infinity), rec)) {
+					float weight = m_lightSampling ? SkyboxWeight(ray, scatterPdf, scene) : 1;
+					color += throughput * scene.SampleSkybox(ray.GetDirection()) * weight;
+					break;
+				}
+
+				art::HitInfo info;
+				scene.ComputeSurfaceInteraction(ray, rec, info);
+
+				const Material &mat = scene.GetMaterial(info.matIndex);
+				glm::vec3 emitted = mat.Emitted(info);
+				if (emitted != glm::vec3(0)) {
+					float weight = m_lightSampling ? EmissionWeight(ray, rec, scatterPdf, scatterN, scene) : 1;
+					color += throughput * emitted * weight;
+				}
+
+				// all numbers of vertex are drawn even if some of them are not used
+				VertexSamples u(sampler);
+
+				// light is not sampled at last vertex, scattered ray wouldn't reach it either
+				if (m_lightSampling && depth + 1 != m_maxDepth) {
+					ShadowRay shadow;
+					if (scene.GetLightCount() != 0 && SampleLight(ray, info, scene, u.light, u.lightDir, shadow) && !scene.Occluded(shadow.ray, Interval(0.001, shadow.tMax))) {
+						color += throughput * shadow.contribution;
+					}
+					if (scene.IsSkyboxSampled() && SampleSkybox(ray, info, scene, u.skybox, shadow) && !scene.Occluded(shadow.ray, Interval(0.001, shadow.tMax))) {
+						color += throughput * shadow.contribution;
+					}
+				}
+
+				Ray rayOut;
+				glm::vec3 attenuation;
+				bool scattered = mat.Scatter(ray, info, attenuation, rayOut, scatterPdf, u.lobe, u.scatter);
+
+				if (aov != nullptr) {
+					pathLength += glm::length(info.p - ray.GetOrigin());
+					if (!scattered || scatterPdf > 0) {
+						aov->albedo = mat.Albedo(info);
+						aov->normal = mat.ShadingNormal(info);
+						aov->position = info.p;
+						aov->depth = pathLength;
+						aov->materialId = info.matIndex + 1;
+						aov->objectId = info.objectId;
+						aov = nullptr;  // written once
+					}
+				}
+
+				if (!scattered) {
+					break;
+				}
+
+				throughput *= attenuation;
+				ray = rayOut;
+				scatterN = info.N;
+
+				if (depth + 1 >= m_rouletteDepth) {
+					float survival = std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)) / m_rouletteThreshold, 1.0f);
+					if (u.roulette >= survival) {
+						break;
+					}
+					throughput /= survival;
+				}
+			}
+
+			return color;
+		}
+
+		// offset is position inside pixel in range [-0.5, 0.5], uLens is point on lens in [0, 1)^2
+		Ray GetRay(uint32_t i, uint32_t j, const glm::vec2 &offset, const glm::vec2 &uLens) const {
 			glm::vec3 pixelPos = m_pixel00Pos + ((i + offset.x) * m_pixelDeltaU) + ((j + offset.y) * m_pixelDeltaV);		
 
 			glm::vec3 ro;
@@ -151,7 +575,7 @@ namespace art {
 				ro = m_pos;
 			} else {
 				// apply defocus blur
-				glm::vec3 p = RandomOnDisk();
+				glm::vec3 p = RandomOnDisk(uLens);
 				ro = m_pos + (p.x * m_defocusU) + (p.y * m_defocusV);
 			}
 			glm::vec3 rd = glm::normalize(pixelPos - ro);
@@ -162,6 +586,18 @@ namespace art {
 	private:
 		uint32_t  m_nSamples;
 		uint32_t  m_maxDepth;
+		uint32_t  m_rouletteDepth;      // number of bounces before russian roulette starts
+		float     m_rouletteThreshold;  // paths with lower throughput can be terminated
+		bool      m_lightSampling;      // next event estimation, disabled only for benchmarks
+		Integrator m_integrator;
+		SamplerType m_samplerType;
+		float     m_adaptiveThreshold;  // error of converged tiles, 0 - adaptive sampling is disabled
+		float     m_timeLimit;          // seconds of progressive rendering, 0 - no limit
+		float     m_targetError;        // error of whole image that stops progressive rendering, 0 - no target
+		float     m_checkpointInterval; // seconds between saving unfinished image, 0 - never
+		uint32_t  m_nThreads;           // 0 - all hardware threads
+		uint32_t  m_tileSize;           // edge of square tile in pixels
+		std::vector<Aov> m_aovs;        // output variables besides radiance
 		glm::vec3 m_pos;
 		glm::vec3 m_lookAt;
 		float     m_fov;
@@ -175,12 +611,5 @@ namespace art {
 		mutable glm::vec3 m_pixelDeltaV;
 		mutable glm::vec3 m_defocusU;
 		mutable glm::vec3 m_defocusV;
-
-		// stratification
-		mutable int stratNumRow;              // number of stratification regions in pixel row
-		mutable float stratRegionEdgeLength;  // edge length of each stratification region
-
-		// multi-threading
-		mutable std::vector<uint32_t> m_iteratorV;
 	};
 }
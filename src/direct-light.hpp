@@ -0,0 +1,95 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "hittable.hpp"
+#include "material.hpp"
+#include "scene.hpp"
+#include "utils.hpp"
+
+namespace art {
+
+	// shadow ray of next event estimation, contribution is added only if ray is not occluded in (0.001, tMax)
+	// visibility is checked by caller, so integrators can trace shadow rays right away or in batches
+	struct ShadowRay {
+		Ray       ray;
+		float     tMax;
+		glm::vec3 contribution;  // not multiplied by throughput of path
+	};
+
+
+	// light is chosen by scene with uLight, point on it with uDir,
+	// contribution is weighted with power heuristic against scattering
+	inline bool SampleLight(const Ray &rayIn, const HitInfo &info, const Scene &scene, float uLight, const glm::vec2 &uDir, ShadowRay &shadow) {
+		const IHittable *light;
+		float lightPmf;
+		if (!scene.SampleLight(info.p, info.N, uLight, light, lightPmf)) {
+			return false;
+		}
+
+		Ray shadowRay(info.p, light->SampleDirection(info.p, uDir));
+		float lightPdf = light->PdfValue(info.p, shadowRay.GetDirection()) * lightPmf;
+		if (lightPdf <= 0) {
+			return false;
+		}
+
+		glm::vec3 value;
+		float scatterPdf;
+		if (!scene.GetMaterial(info.matIndex).Evaluate(rayIn, info, shadowRay.GetDirection(), value, scatterPdf) || value == glm::vec3(0)) {
+			return false;
+		}
+
+		HitRecord lightRec;
+		if (!light->Intersect(shadowRay, Interval(0.001, infinity), lightRec)) {
+			return false;
+		}
+
+		HitInfo lightInfo;
+		light->ComputeSurfaceInteraction(shadowRay, lightRec, lightInfo);
+		shadow.ray = shadowRay;
+		shadow.tMax = lightRec.t * (1 - 1e-4f);
+		shadow.contribution = value * scene.GetMaterial(lightInfo.matIndex).Emitted(lightInfo) * PowerHeuristic(lightPdf, scatterPdf) / lightPdf;
+		return true;
+	}
+
+
+	// direction is chosen by luminance of skybox, it is visible if shadow ray escapes scene
+	inline bool SampleSkybox(const Ray &rayIn, const HitInfo &info, const Scene &scene, const glm::vec2 &u, ShadowRay &shadow) {
+		glm::vec3 dir;
+		float skyboxPdf;
+		if (!scene.SampleSkyboxDirection(u, dir, skyboxPdf)) {
+			return false;
+		}
+
+		glm::vec3 value;
+		float scatterPdf;
+		if (!scene.GetMaterial(info.matIndex).Evaluate(rayIn, info, dir, value, scatterPdf) || value == glm::vec3(0)) {
+			return false;
+		}
+
+		shadow.ray = Ray(info.p, dir);
+		shadow.tMax = infinity;
+		shadow.contribution = value * scene.SampleSkybox(dir) * PowerHeuristic(skyboxPdf, scatterPdf) / skyboxPdf;
+		return true;
+	}
+
+
+	// weight of light hit by scattered ray, scatterPdf is pdf of ray direction
+	// and scatterN is normal at its origin (light selection depends on it)
+	inline float EmissionWeight(const Ray &ray, const HitRecord &rec, float scatterPdf, const glm::vec3 &scatterN, const Scene &scene) {
+		if (scatterPdf <= 0 || !scene.IsLight(rec)) {
+			return 1;
+		}
+		float lightPdf = rec.object->PdfValue(ray.GetOrigin(), ray.GetDirection()) * scene.LightPmf(ray.GetOrigin(), scatterN, rec.object);
+		return PowerHeuristic(scatterPdf, lightPdf);
+	}
+
+
+	// weight of skybox seen by scattered ray
+	inline float SkyboxWeight(const Ray &ray, float scatterPdf, const Scene &scene) {
+		if (scatterPdf <= 0 || !scene.IsSkyboxSampled()) {
+			return 1;
+		}
+		return PowerHeuristic(scatterPdf, scene.SkyboxPdf(ray.GetDirection()));
+	}
+}
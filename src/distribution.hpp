@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+namespace art {
+
+	// piecewise constant distribution over [0, 1) given by n function values
+	class Distribution1D final {
+	public:
+		Distribution1D() = default;
+
+		Distribution1D(const float *f, uint32_t n) : m_func(f, f + n), m_cdf(n + 1) {
+			m_cdf[0] = 0;
+			for (uint32_t i = 0; i != n; ++i) {
+				m_cdf[i + 1] = m_cdf[i] + m_func[i] / n;
+			}
+			m_integral = m_cdf[n];
+
+			// zero function is sampled uniformly, caller should check integral
+			for (uint32_t i = 1; i <= n; ++i) {
+				m_cdf[i] = m_integral > 0 ? m_cdf[i] / m_integral : float(i) / n;
+			}
+		}
+
+		// returns point in [0, 1) and its density, offset is index of chosen segment
+		float Sample(float u, float &pdf, uint32_t &offset) const {
+			auto it = std::upper_bound(m_cdf.begin(), m_cdf.end(), u);
+			offset = static_cast<uint32_t>(std::clamp<ptrdiff_t>(it - m_cdf.begin() - 1, 0, m_func.size() - 1));
+
+			float du = u - m_cdf[offset];
+			float width = m_cdf[offset + 1] - m_cdf[offset];
+			if (width > 0) {
+				du /= width;
+			}
+
+			pdf = Pdf(offset);
+			return std::min((offset + du) / m_func.size(), 0.99999994f);
+		}
+
+		float Pdf(uint32_t offset) const {
+			return m_integral > 0 ? m_func[offset] / m_integral : 1.0f;
+		}
+
+		uint32_t Count()    const { return static_cast<uint32_t>(m_func.size()); }
+		float    Integral() const { return m_integral; }
+
+	private:
+		std::vector<float> m_func;
+		std::vector<float> m_cdf;
+		float              m_integral = 0;
+	};
+
+
+	// piecewise constant distribution over [0, 1)^2 given by nu * nv values (row by row)
+	// v is chosen by marginal distribution of rows, then u by distribution inside row
+	class Distribution2D final {
+	public:
+		Distribution2D() = default;
+
+		Distribution2D(const float *f, uint32_t nu, uint32_t nv) {
+			m_conditional.reserve(nv);
+			std::vector<float> marginal(nv);
+			for (uint32_t v = 0; v != nv; ++v) {
+				m_conditional.emplace_back(f + v * nu, nu);
+				marginal[v] = m_conditional.back().Integral();
+			}
+			m_marginal = Distribution1D(marginal.data(), nv);
+			m_maxValue = *std::max_element(f, f + nu * nv);
+		}
+
+		glm::vec2 Sample(const glm::vec2 &u, float &pdf) const {
+			float pdfV, pdfU;
+			uint32_t v, offsetU;
+			float sv = m_marginal.Sample(u.y, pdfV, v);
+			float su = m_conditional[v].Sample(u.x, pdfU, offsetU);
+			pdf = pdfU * pdfV;
+			return glm::vec2(su, sv);
+		}
+
+		float Pdf(const glm::vec2 &p) const {
+			uint32_t nu = m_conditional[0].Count();
+			uint32_t nv = m_marginal.Count();
+			uint32_t iu = std::min(static_cast<uint32_t>(std::max(p.x, 0.0f) * nu), nu - 1);
+			uint32_t iv = std::min(static_cast<uint32_t>(std::max(p.y, 0.0f) * nv), nv - 1);
+			return m_marginal.Integral() > 0 ? m_conditional[iv].Pdf(iu) * m_conditional[iv].Integral() / m_marginal.Integral() : 0;
+		}
+
+		float Integral() const { return m_marginal.Integral(); }
+
+		// highest density over cells, 1 for constant function
+		float MaxPdf() const { return Integral() > 0 ? m_maxValue / Integral() : 0; }
+
+	private:
+		std::vector<Distribution1D> m_conditional;
+		Distribution1D              m_marginal;
+		float                       m_maxValue = 0;
+	};
+}
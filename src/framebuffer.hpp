@@ -0,0 +1,332 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define ART_USE_SSE 1
+	#include <emmintrin.h>
+#else
+	#define ART_USE_SSE 0
+#endif
+
+#include <glm/glm.hpp>
+
+#include "image.hpp"
+#include "utils.hpp"
+#include "scheduler.hpp"
+
+namespace art {
+
+	// arbitrary output variables: properties of the first hit that is not a perfect reflection or
+	// refraction, they are written once per sample and averaged like radiance
+	// ids are not averaged: pixel keeps id of majority of its samples (see Framebuffer::VoteId())
+	enum class Aov {
+		Albedo,     // reflectance of material
+		Normal,     // shading normal in world space, faces the ray
+		Depth,      // length of path from camera to hit
+		Position,   // hit point in world space
+		MaterialId, // index of material in scene + 1, 0 - nothing was hit
+		ObjectId    // number of object or instance in scene file (from 1), 0 - nothing was hit
+	};
+
+	inline const char *AovName(Aov aov) {
+		switch (aov) {
+			case Aov::Albedo:     return "albedo";
+			case Aov::Normal:     return "normal";
+			case Aov::Depth:      return "depth";
+			case Aov::Position:   return "position";
+			case Aov::MaterialId: return "material id";
+			case Aov::ObjectId:   return "object id";
+		}
+		return "";
+	}
+
+	inline bool IsAovId(Aov aov) {
+		return aov == Aov::MaterialId || aov == Aov::ObjectId;
+	}
+
+	// channels of output file
+	inline uint32_t AovChannels(Aov aov) {
+		return aov == Aov::Depth || IsAovId(aov) ? 1 : 3;
+	}
+
+	// all variables of one sample, samples that hit nothing leave zeros
+	struct AovSample {
+		glm::vec3 albedo = glm::vec3(0);
+		glm::vec3 normal = glm::vec3(0);
+		glm::vec3 position = glm::vec3(0);
+		float     depth = 0;
+		uint32_t  materialId = 0;
+		uint32_t  objectId = 0;
+	};
+
+
+	// linear radiance of image accumulated over samples, 8-bit image is produced by Resolve()
+	// pixels are stored by tiles (the same tiles as TileScheduler renders), every tile starts
+	// at its own cache line, so threads rendering different tiles never write to one line
+	class Framebuffer final {
+	public:
+		// sum of samples and number of samples, 16 bytes - one SSE register
+		struct Pixel {
+			glm::vec3 sum = glm::vec3(0);
+			uint32_t  count = 0;
+		};
+
+		// variance tracks luminance moments of samples, they are needed only to estimate error
+		// every aov has its own float plane in the same tile-major order as pixels
+		Framebuffer(uint32_t width, uint32_t height, uint32_t tileSize, bool variance = false, const std::vector<Aov> &aovs = {}) :
+			m_width(width),
+			m_height(height),
+			m_tileSize(std::max(1u, tileSize)),
+			m_tilesX((width + m_tileSize - 1) / m_tileSize),
+			m_tileStride((m_tileSize * m_tileSize + kMomentLinePixels - 1) / kMomentLinePixels * kMomentLinePixels),
+			m_aovs(aovs)
+		{
+			size_t nTiles = size_t(m_tilesX) * ((height + m_tileSize - 1) / m_tileSize);
+			m_lines.resize(nTiles * m_tileStride / kLinePixels);
+			if (variance) {
+				m_moments.resize(nTiles * m_tileStride / kMomentLinePixels);
+			}
+			for (Aov aov : m_aovs) {
+				m_aovPlanes.emplace_back(nTiles * m_tileStride * PlaneChannels(aov), 0.0f);
+			}
+		}
+
+		// removes all samples, memory is kept
+		void Clear() {
+			std::fill(m_lines.begin(), m_lines.end(), PixelLine());
+			std::fill(m_moments.begin(), m_moments.end(), MomentLine());
+			for (std::vector<float> &plane : m_aovPlanes) {
+				std::fill(plane.begin(), plane.end(), 0.0f);
+			}
+		}
+
+		uint32_t GetWidth()  const { return m_width; }
+		uint32_t GetHeight() const { return m_height; }
+
+		void AddSample(uint32_t x, uint32_t y, const glm::vec3 &color) {
+			AddSamples(x, y, color, 1);
+			if (!m_moments.empty()) {
+				float lum = Luminance(color);
+				glm::vec2 &moments = Moments(Index(x, y));
+				moments.x += lum;
+				moments.y += lum * lum;
+			}
+		}
+
+		// sum of several samples at once (moments are not updated)
+		void AddSamples(uint32_t x, uint32_t y, const glm::vec3 &sum, uint32_t count) {
+			Pixel &pixel = At(Index(x, y));
+			pixel.sum += sum;
+			pixel.count += count;
+		}
+
+		const std::vector<Aov> &GetAovs() const { return m_aovs; }
+		bool HasAovs() const { return !m_aovs.empty(); }
+
+		// one sample of output variables, the same pixel gets its radiance with AddSample(s)
+		void AddAovSample(uint32_t x, uint32_t y, const AovSample &sample) {
+			size_t index = Index(x, y);
+			for (size_t k = 0; k != m_aovs.size(); ++k) {
+				float *value = m_aovPlanes[k].data() + index * PlaneChannels(m_aovs[k]);
+				switch (m_aovs[k]) {
+					case Aov::Albedo:     AddVec(value, sample.albedo); break;
+					case Aov::Normal:     AddVec(value, sample.normal); break;
+					case Aov::Position:   AddVec(value, sample.position); break;
+					case Aov::Depth:      value[0] += sample.depth; break;
+					case Aov::MaterialId: VoteId(value, sample.materialId); break;
+					case Aov::ObjectId:   VoteId(value, sample.objectId); break;
+				}
+			}
+		}
+
+		// average of k-th output variable, one channel variables are repeated in all channels
+		glm::vec3 GetAov(size_t k, uint32_t x, uint32_t y) const {
+			size_t index = Index(x, y);
+			const uint32_t nChannels = AovChannels(m_aovs[k]);
+			const float *value = m_aovPlanes[k].data() + index * PlaneChannels(m_aovs[k]);
+			glm::vec3 result = nChannels == 3 ? glm::vec3(value[0], value[1], value[2]) : glm::vec3(value[0]);
+			uint32_t count = At(index).count;
+			if (IsAovId(m_aovs[k]) || count == 0) {
+				return result;
+			}
+			return result / float(count);
+		}
+
+		const Pixel &GetPixel(uint32_t x, uint32_t y) const { return At(Index(x, y)); }
+		uint32_t GetCount(uint32_t x, uint32_t y) const { return GetPixel(x, y).count; }
+
+		glm::vec3 GetColor(uint32_t x, uint32_t y) const {
+			const Pixel &pixel = GetPixel(x, y);
+			return pixel.count != 0 ? pixel.sum / float(pixel.count) : glm::vec3(0);
+		}
+
+		// visible error of pixel: half of confidence interval of mean in display (gamma) space,
+		// values above 1 are clamped in image, so their noise is not visible
+		// (needs variance, pixel with less than 2 samples has infinite error)
+		float GetError(uint32_t x, uint32_t y) const {
+			size_t index = Index(x, y);
+			uint32_t count = At(index).count;
+			if (count < 2 || m_moments.empty()) {
+				return infinity;
+			}
+			const glm::vec2 &moments = Moments(index);
+			float mean = moments.x / count;
+			float variance = std::max(moments.y / count - mean * mean, 0.0f) / (count - 1);
+			float stdErr = std::sqrt(variance);
+			float hi = std::min(mean + stdErr, 1.0f);
+			float lo = std::clamp(mean - stdErr, 0.0f, 1.0f);
+			return (std::sqrt(hi) - std::sqrt(lo)) / 2;
+		}
+
+		// average of samples with gamma correction to 8-bit image of the same size,
+		// tiles are resolved in parallel and four pixels are converted at once
+		void Resolve(Image &image, uint32_t nThreads = 0) const {
+			TileScheduler scheduler(nThreads, m_tileSize);
+			scheduler.Run(m_width, m_height, [&](const Tile &tile) { ResolveTile(tile, image); }, [](uint32_t, uint32_t) {});
+		}
+
+		// the same for rows [y0, y1) on calling thread (for rows that are finished before the rest of image)
+		void ResolveRows(Image &image, uint32_t y0, uint32_t y1) const {
+			for (uint32_t x = 0; x < m_width; x += m_tileSize) {
+				ResolveTile({ x, y0, std::min(x + m_tileSize, m_width), y1 }, image);
+			}
+		}
+
+		// number of samples of every pixel as brightness (pixel with most samples is white)
+		void ResolveCounts(Image &image) const {
+			uint32_t maxCount = 1;
+			for (const PixelLine &line : m_lines) {
+				for (const Pixel &pixel : line.pixels) {
+					maxCount = std::max(maxCount, pixel.count);
+				}
+			}
+			for (uint32_t y = 0; y != m_height; ++y) {
+				for (uint32_t x = 0; x != m_width; ++x) {
+					image.SetPixelColor(x, y, glm::vec3(float(GetCount(x, y)) / maxCount), false);
+				}
+			}
+		}
+
+	private:
+		static constexpr uint32_t kLinePixels = 4;        // pixels in cache line
+		static constexpr uint32_t kMomentLinePixels = 8;  // moments of pixels in cache line
+
+		struct alignas(64) PixelLine {
+			Pixel pixels[kLinePixels];
+		};
+
+		struct alignas(64) MomentLine {
+			glm::vec2 moments[kMomentLinePixels];
+		};
+
+		// index of pixel in tile-major order
+		size_t Index(uint32_t x, uint32_t y) const {
+			size_t tile = size_t(y / m_tileSize) * m_tilesX + x / m_tileSize;
+			return tile * m_tileStride + (y % m_tileSize) * m_tileSize + x % m_tileSize;
+		}
+
+		static void AddVec(float *value, const glm::vec3 &v) {
+			value[0] += v.x;
+			value[1] += v.y;
+			value[2] += v.z;
+		}
+
+		// ids are stored with their votes: Boyer-Moore majority vote keeps id of more than half
+		// of samples if there is one, result depends only on order of samples of pixel (not on
+		// passes or threads), so edges of objects are the same in every render with the same samples
+		static void VoteId(float *value, uint32_t id) {
+			if (value[1] == 0) {
+				value[0] = float(id);
+				value[1] = 1;
+			} else {
+				value[1] += value[0] == float(id) ? 1.0f : -1.0f;
+			}
+		}
+
+		// floats in plane per pixel, ids have their votes too
+		static uint32_t PlaneChannels(Aov aov) {
+			return IsAovId(aov) ? 2 : AovChannels(aov);
+		}
+
+		Pixel &At(size_t index) { return m_lines[index / kLinePixels].pixels[index % kLinePixels]; }
+		const Pixel &At(size_t index) const { return m_lines[index / kLinePixels].pixels[index % kLinePixels]; }
+		glm::vec2 &Moments(size_t index) { return m_moments[index / kMomentLinePixels].moments[index % kMomentLinePixels]; }
+		const glm::vec2 &Moments(size_t index) const { return m_moments[index / kMomentLinePixels].moments[index % kMomentLinePixels]; }
+
+		void ResolveTile(const Tile &tile, Image &image) const {
+			uint8_t *data = image.GetData();
+			const uint32_t nChannels = image.GetNumChannels();
+
+			for (uint32_t y = tile.y0; y != tile.y1; ++y) {
+				size_t first = Index(tile.x0, y);  // pixels of tile row are consecutive
+				uint8_t *out = data + (size_t(y) * m_width + tile.x0) * nChannels;
+				uint32_t x = tile.x0;
+
+#if ART_USE_SSE
+				for (; nChannels == 3 && x + 4 <= tile.x1; x += 4, first += 4, out += 12) {
+					alignas(16) uint8_t bytes[16];
+					_mm_store_si128(reinterpret_cast<__m128i *>(bytes), ResolvePixels(&At(first), &At(first + 1), &At(first + 2), &At(first + 3)));
+					// every copy of 4 bytes writes r of next pixel too, it is overwritten by the next copy
+					for (uint32_t p = 0; p != 3; ++p) {
+						std::memcpy(out + p * 3, bytes + p * 4, 4);
+					}
+					std::memcpy(out + 9, bytes + 12, 3);
+				}
+#endif
+
+				for (; x != tile.x1; ++x, ++first) {
+					const Pixel &pixel = At(first);
+					image.SetPixelColor(x, y, pixel.count != 0 ? pixel.sum / float(pixel.count) : glm::vec3(0));
+				}
+			}
+		}
+
+#if ART_USE_SSE
+		// four pixels as bytes r, g, b, 0 of every pixel, the same as Image::SetPixelColor() with gamma
+		// (NaN becomes black), pixels are transposed, so every lane of registers is used
+		static __m128i ResolvePixels(const Pixel *p0, const Pixel *p1, const Pixel *p2, const Pixel *p3) {
+			__m128 r = _mm_loadu_ps(&p0->sum.x);
+			__m128 g = _mm_loadu_ps(&p1->sum.x);
+			__m128 b = _mm_loadu_ps(&p2->sum.x);
+			__m128 n = _mm_loadu_ps(&p3->sum.x);
+			_MM_TRANSPOSE4_PS(r, g, b, n);
+
+			__m128 count = _mm_max_ps(_mm_cvtepi32_ps(_mm_castps_si128(n)), _mm_set1_ps(1.0f));
+			__m128i ir = ResolveChannel(_mm_div_ps(r, count));
+			__m128i ig = ResolveChannel(_mm_div_ps(g, count));
+			__m128i ib = ResolveChannel(_mm_div_ps(b, count));
+
+			// channels to bytes of pixels: r0 g0 b0 0 r1 g1 b1 0 ...
+			__m128i rg = _mm_or_si128(ir, _mm_slli_epi32(ig, 8));
+			return _mm_or_si128(rg, _mm_slli_epi32(ib, 16));
+		}
+
+		// gamma, clamping and scaling in double like in Image, so results are the same in every pixel
+		static __m128i ResolveChannel(__m128 mean) {
+			__m128 gamma = _mm_sqrt_ps(_mm_max_ps(mean, _mm_setzero_ps()));
+			__m128 clamped = _mm_min_ps(gamma, _mm_set1_ps(1.0f));
+
+			__m128d scale = _mm_set1_pd(255.999);
+			__m128i low = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(clamped), scale));
+			__m128i high = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(clamped, clamped)), scale));
+			return _mm_unpacklo_epi64(low, high);
+		}
+#endif
+
+		uint32_t m_width;
+		uint32_t m_height;
+		uint32_t m_tileSize;
+		uint32_t m_tilesX;
+		uint32_t m_tileStride;  // pixels reserved for every tile, multiple of lines
+
+		std::vector<PixelLine> m_lines;
+		std::vector<MomentLine> m_moments;  // luminance sum and sum of squares, empty without variance
+
+		std::vector<Aov>                m_aovs;
+		std::vector<std::vector<float>> m_aovPlanes;  // sums of samples (id and its votes for ids) of every aov
+	};
+}
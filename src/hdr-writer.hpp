@@ -0,0 +1,289 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+
+#include "framebuffer.hpp"
+#include "image.hpp"
+#include "scheduler.hpp"
+
+namespace art {
+
+	// linear radiance of framebuffer without gamma and clamping, for compositing
+	enum class HdrFormat {
+		None,
+		PFM,       // portable float map, 32-bit float rgb
+		EXRHalf,   // scanline OpenEXR without compression, 16-bit float channels
+		EXRFloat   // the same with 32-bit float channels
+	};
+
+
+	inline std::string HdrExtension(HdrFormat format) {
+		return format == HdrFormat::PFM ? "pfm" : "exr";
+	}
+
+
+	// float to 16-bit float with rounding to nearest even, values above half range become infinity
+	// (F. Giesen, "float->half variants")
+	inline uint16_t FloatToHalf(float value) {
+		const uint32_t f32Infinity = 255u << 23;
+		const uint32_t f16Max = (127u + 16) << 23;
+		const uint32_t denormMagic = ((127u - 15) + (23 - 10) + 1) << 23;
+
+		uint32_t u;
+		std::memcpy(&u, &value, 4);
+		uint32_t sign = u & 0x80000000u;
+		u ^= sign;
+
+		uint16_t result;
+		if (u >= f16Max) {
+			result = u > f32Infinity ? 0x7e00 : 0x7c00;  // NaN stays NaN
+		} else if (u < (113u << 23)) {
+			// denormal half, float addition rounds mantissa into place
+			float f, magic;
+			std::memcpy(&f, &u, 4);
+			std::memcpy(&magic, &denormMagic, 4);
+			f += magic;
+			std::memcpy(&u, &f, 4);
+			result = static_cast<uint16_t>(u - denormMagic);
+		} else {
+			uint32_t mantissaOdd = (u >> 13) & 1;
+			u += ((15u - 127) << 23) + 0xfff;  // rebias exponent and round
+			u += mantissaOdd;
+			result = static_cast<uint16_t>(u >> 13);
+		}
+		return static_cast<uint16_t>(result | (sign >> 16));
+	}
+
+
+	// rows of file are converted in chunks of kChunkRows on nThreads threads (0 - all hardware threads)
+	// and written in order, so memory for conversion doesn't depend on height of image
+	// convert(row, data) fills rowBytes of row number row (in order of file)
+	template<typename ConvertFunc>
+	void WriteRowChunks(std::ofstream &file, uint32_t nRows, size_t rowBytes, uint32_t nThreads, const ConvertFunc &convert) {
+		const uint32_t kChunkRows = 64;
+
+		TileScheduler scheduler(nThreads, 1);
+		std::vector<uint8_t> chunk(rowBytes * kChunkRows);
+		for (uint32_t first = 0; first < nRows; first += kChunkRows) {
+			uint32_t count = std::min(kChunkRows, nRows - first);
+			scheduler.ParallelFor(count, 1, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t row = begin; row != end; ++row) {
+					convert(first + row, chunk.data() + row * rowBytes);
+				}
+			});
+			file.write(reinterpret_cast<const char *>(chunk.data()), std::streamsize(rowBytes * count));
+		}
+	}
+
+	inline std::ofstream OpenOutputFile(const std::string &filePath) {
+		std::ofstream file(filePath, std::ios::binary);
+		if (!file) {
+			std::cerr << "failed to open file for writing - " << filePath << "\n";
+			exit(1);
+		}
+		return file;
+	}
+
+	template<typename T>
+	void WriteValue(std::ofstream &file, const T &value) {
+		file.write(reinterpret_cast<const char *>(&value), sizeof(T));  // file formats are little endian as x86 and arm
+	}
+
+
+	// hdr file that is written by bands of rows (band can be the whole image)
+	// PFM: text header and rows of rgb floats from bottom to top, negative scale means little endian
+	// OpenEXR: header with attributes, table of offsets of scanlines and uncompressed scanlines,
+	// every scanline is its y, size of data and values of channels B, G and R (channels are sorted by name)
+	// sizes of rows are known, so bands can be written at their place in any order
+	// rows are converted on nThreads threads (0 - all hardware threads)
+	class HdrWriter final {
+	public:
+		HdrWriter(const std::string &filePath, HdrFormat format, uint32_t width, uint32_t height, uint32_t nThreads = 0) :
+			m_file(OpenOutputFile(filePath)),
+			m_format(format),
+			m_width(width),
+			m_height(height),
+			m_nThreads(nThreads)
+		{
+			const uint32_t sampleBytes = format == HdrFormat::EXRHalf ? 2 : 4;
+			if (format == HdrFormat::PFM) {
+				m_file << "PF\n" << width << " " << height << "\n-1.0\n";
+				m_rowBytes = size_t(width) * 3 * sampleBytes;
+			} else {
+				WriteExrHeader(sampleBytes);
+				m_rowBytes = 8 + size_t(width) * 3 * sampleBytes;
+			}
+			m_dataStart = static_cast<uint64_t>(m_file.tellp());
+			if (format != HdrFormat::PFM) {
+				m_dataStart += uint64_t(height) * 8;  // offsets of scanlines
+				uint64_t offset = m_dataStart;
+				for (uint32_t y = 0; y != height; ++y, offset += m_rowBytes) {
+					WriteValue(m_file, offset);
+				}
+			}
+		}
+
+		// rows [y0, y0 + band height) of image
+		void WriteRows(const Framebuffer &band, uint32_t y0) {
+			WriteRows(y0, band.GetHeight(), [&](uint32_t x, uint32_t y) { return band.GetColor(x, y); });
+		}
+
+		// rows [y0, y0 + nRows) of image, color(x, y) gives pixel of row y of band (from several threads)
+		template<typename ColorFunc>
+		void WriteRows(uint32_t y0, uint32_t nRows, const ColorFunc &color) {
+			if (m_format == HdrFormat::PFM) {
+				// last row of band is the first in file
+				m_file.seekp(std::streamoff(m_dataStart + uint64_t(m_height - y0 - nRows) * m_rowBytes));
+				WriteRowChunks(m_file, nRows, m_rowBytes, m_nThreads, [&](uint32_t row, uint8_t *data) {
+					WritePfmRow(color, nRows - 1 - row, data);
+				});
+			} else {
+				m_file.seekp(std::streamoff(m_dataStart + uint64_t(y0) * m_rowBytes));
+				WriteRowChunks(m_file, nRows, m_rowBytes, m_nThreads, [&](uint32_t row, uint8_t *data) {
+					WriteExrRow(color, row, y0 + row, data);
+				});
+			}
+		}
+
+	private:
+		void WriteExrHeader(uint32_t sampleBytes) {
+			const int32_t pixelType = sampleBytes == 2 ? 1 : 2;  // 1 - HALF, 2 - FLOAT
+
+			auto attribute = [&](const std::string &name, const std::string &type, uint32_t size) {
+				m_file.write(name.c_str(), name.size() + 1);
+				m_file.write(type.c_str(), type.size() + 1);
+				WriteValue(m_file, size);
+			};
+
+			WriteValue(m_file, uint32_t(20000630));  // magic number
+			WriteValue(m_file, uint32_t(2));         // version 2, single part scanline image
+
+			attribute("channels", "chlist", 3 * (2 + 16) + 1);
+			for (const char *channel : { "B", "G", "R" }) {
+				m_file.write(channel, 2);
+				WriteValue(m_file, pixelType);
+				WriteValue(m_file, uint32_t(0));  // pLinear and reserved
+				WriteValue(m_file, int32_t(1));   // x sampling
+				WriteValue(m_file, int32_t(1));   // y sampling
+			}
+			m_file.put(0);
+
+			attribute("compression", "compression", 1);
+			m_file.put(0);  // no compression, one scanline per block
+
+			const int32_t window[4] = { 0, 0, int32_t(m_width) - 1, int32_t(m_height) - 1 };
+			attribute("dataWindow", "box2i", 16);
+			WriteValue(m_file, window);
+			attribute("displayWindow", "box2i", 16);
+			WriteValue(m_file, window);
+
+			attribute("lineOrder", "lineOrder", 1);
+			m_file.put(0);  // increasing y
+
+			attribute("pixelAspectRatio", "float", 4);
+			WriteValue(m_file, 1.0f);
+			attribute("screenWindowCenter", "v2f", 8);
+			WriteValue(m_file, glm::vec2(0));
+			attribute("screenWindowWidth", "float", 4);
+			WriteValue(m_file, 1.0f);
+			m_file.put(0);  // end of header
+		}
+
+		template<typename ColorFunc>
+		void WritePfmRow(const ColorFunc &getColor, uint32_t y, uint8_t *data) const {
+			for (uint32_t x = 0; x != m_width; ++x) {
+				glm::vec3 color = getColor(x, y);
+				std::memcpy(data + size_t(x) * 3 * sizeof(float), &color.x, 3 * sizeof(float));
+			}
+		}
+
+		template<typename ColorFunc>
+		void WriteExrRow(const ColorFunc &getColor, uint32_t y, uint32_t imageY, uint8_t *data) const {
+			const bool half = m_format == HdrFormat::EXRHalf;
+			const size_t sampleBytes = half ? 2 : 4;
+			int32_t header[2] = { int32_t(imageY), int32_t(m_rowBytes - 8) };
+			std::memcpy(data, header, 8);
+			uint8_t *channels = data + 8;
+			for (uint32_t x = 0; x != m_width; ++x) {
+				glm::vec3 color = getColor(x, y);
+				float values[3] = { color.b, color.g, color.r };
+				for (uint32_t c = 0; c != 3; ++c) {
+					uint8_t *out = channels + (size_t(c) * m_width + x) * sampleBytes;
+					if (half) {
+						uint16_t h = FloatToHalf(values[c]);
+						std::memcpy(out, &h, 2);
+					} else {
+						std::memcpy(out, &values[c], 4);
+					}
+				}
+			}
+		}
+
+		std::ofstream m_file;
+		HdrFormat     m_format;
+		uint32_t      m_width;
+		uint32_t      m_height;
+		uint32_t      m_nThreads;
+		size_t        m_rowBytes;   // bytes of row (scanline block of exr)
+		uint64_t      m_dataStart;  // offset of first row in file
+	};
+
+
+	// saves framebuffer to output directory with extension of format
+	inline void SaveHdr(const Framebuffer &framebuffer, const std::string &name, HdrFormat format, uint32_t nThreads = 0) {
+		if (format == HdrFormat::None) {
+			return;
+		}
+
+		std::string filePath = GetOutputPath(name, HdrExtension(format));
+		std::cout << "saving hdr image: " << filePath << "\n";
+
+		HdrWriter writer(filePath, format, framebuffer.GetWidth(), framebuffer.GetHeight(), nThreads);
+		writer.WriteRows(framebuffer, 0);
+	}
+
+
+	// every output variable of framebuffer is written to its own file <name>-<aov> (spaces become dashes),
+	// ids, depth and positions need precision of floats (half keeps integers only up to 2048),
+	// so they are never half exr, without hdr format all variables are float exr
+	class AovWriter final {
+	public:
+		AovWriter(const std::string &name, HdrFormat format, const std::vector<Aov> &aovs, uint32_t width, uint32_t height, uint32_t nThreads = 0) {
+			std::string stem = std::filesystem::path(name).replace_extension().string();
+			m_writers.reserve(aovs.size());
+			for (Aov aov : aovs) {
+				bool needsFloat = IsAovId(aov) || aov == Aov::Depth || aov == Aov::Position;
+				HdrFormat aovFormat = format == HdrFormat::None || (needsFloat && format == HdrFormat::EXRHalf) ? HdrFormat::EXRFloat : format;
+				std::string suffix = AovName(aov);
+				std::replace(suffix.begin(), suffix.end(), ' ', '-');
+				std::string filePath = GetOutputPath(stem + "-" + suffix, HdrExtension(aovFormat));
+				std::cout << "saving aov: " << filePath << "\n";
+				m_writers.emplace_back(filePath, aovFormat, width, height, nThreads);
+			}
+		}
+
+		// rows [y0, y0 + band height) of all variables
+		void WriteRows(const Framebuffer &band, uint32_t y0) {
+			for (size_t k = 0; k != m_writers.size(); ++k) {
+				m_writers[k].WriteRows(y0, band.GetHeight(), [&](uint32_t x, uint32_t y) { return band.GetAov(k, x, y); });
+			}
+		}
+
+	private:
+		std::vector<HdrWriter> m_writers;
+	};
+
+
+	inline void SaveAovs(const Framebuffer &framebuffer, const std::string &name, HdrFormat format, uint32_t nThreads = 0) {
+		if (framebuffer.HasAovs()) {
+			AovWriter writer(name, format, framebuffer.GetAovs(), framebuffer.GetWidth(), framebuffer.GetHeight(), nThreads);
+			writer.WriteRows(framebuffer, 0);
+		}
+	}
+}
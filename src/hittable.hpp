@@ -5,18 +5,17 @@
 #include <glm/glm.hpp>
 
 #include "ray.hpp"
+#include "utils.hpp"
 
 namespace art {
-	const float infinity = std::numeric_limits<float>::infinity();
-	const float pi = 3.1415926;
 
-	class IMaterial;  // to solve circular dependency
 	struct HitInfo {
 		glm::vec3 p;
 		glm::vec3 N;
 		glm::vec3 T;
 		glm::vec3 BT;
-		IMaterial *mat;
+		uint32_t  matIndex;  // index in material table of scene
+		uint32_t  objectId;  // id of object of scene file that was hit (see IHittable::SetObjectId())
 
 		float t;
 		float u;
@@ -53,19 +52,162 @@ namespace art {
 	const Interval Interval::full = Interval(-infinity, +infinity);
 
 
+	// axis-aligned bounding box, used by acceleration structures
+	class AABB final {
+	public:
+		AABB() : m_min(glm::vec3(+infinity)), m_max(glm::vec3(-infinity)) {}
+		AABB(const glm::vec3 &a, const glm::vec3 &b) : m_min(glm::min(a, b)), m_max(glm::max(a, b)) {}
+
+		void Expand(const glm::vec3 &p) {
+			m_min = glm::min(m_min, p);
+			m_max = glm::max(m_max, p);
+		}
+
+		void Expand(const AABB &box) {
+			m_min = glm::min(m_min, box.m_min);
+			m_max = glm::max(m_max, box.m_max);
+		}
+
+		bool IsEmpty() const { return m_min.x > m_max.x || m_min.y > m_max.y || m_min.z > m_max.z; }
+
+		glm::vec3 Centroid() const { return 0.5f * (m_min + m_max); }
+		glm::vec3 Extent()   const { return m_max - m_min; }
+
+		float SurfaceArea() const {
+			if (IsEmpty()) {
+				return 0.0f;
+			}
+			glm::vec3 e = Extent();
+			return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+		}
+
+		int LongestAxis() const {
+			glm::vec3 e = Extent();
+			if (e.x > e.y && e.x > e.z) {
+				return 0;
+			}
+			return e.y > e.z ? 1 : 2;
+		}
+
+		// slab test, invDir is precomputed once per ray by the caller
+		bool Hit(const glm::vec3 &ro, const glm::vec3 &invDir, Interval tSpan) const {
+			glm::vec3 t0 = (m_min - ro) * invDir;
+			glm::vec3 t1 = (m_max - ro) * invDir;
+			glm::vec3 tNear = glm::min(t0, t1);
+			glm::vec3 tFar = glm::max(t0, t1);
+
+			// plain comparisons compile to minss/maxss, std::fmin/fmax do not
+			float tMin = tNear.x > tNear.y ? tNear.x : tNear.y;
+			tMin = tNear.z > tMin ? tNear.z : tMin;
+			tMin = tSpan.GetMin() > tMin ? tSpan.GetMin() : tMin;
+
+			float tMax = tFar.x < tFar.y ? tFar.x : tFar.y;
+			tMax = tFar.z < tMax ? tFar.z : tMax;
+			tMax = tSpan.GetMax() < tMax ? tSpan.GetMax() : tMax;
+
+			return tMin <= tMax;
+		}
+
+		const glm::vec3 &GetMin() const { return m_min; }
+		const glm::vec3 &GetMax() const { return m_max; }
+
+	private:
+		glm::vec3 m_min;
+		glm::vec3 m_max;
+	};
+
+
+	class IHittable;
+
+	// emitter description used by light hierarchy
+	// normals of emitting surface lie inside cone around axis (cosTheta is -1 if they point everywhere)
+	struct LightBounds {
+		AABB             bounds;
+		glm::vec3        axis;
+		float            cosTheta;
+		float            area;     // of one emitting side
+		bool             twoSided;
+		uint32_t         matIndex;
+	};
+
+
+	// result of intersection, enough to find surface data later
+	struct HitRecord {
+		float t;
+		float b1;        // primitive specific coordinates of hit
+		float b2;        // (barycentrics for triangles, planar coordinates for quads)
+		uint32_t primId; // primitive index inside object (triangle of mesh)
+
+		const IHittable *object;    // primitive that was hit
+		const IHittable *instance;  // instance through which primitive was hit, null if none
+	};
+
+
+	// intersection is split into two phases: Intersect() finds only closest distance and
+	// primitive, ComputeSurfaceInteraction() computes hit info once for the closest hit
 	class IHittable {
 	public:
 		virtual ~IHittable() = default;
 
-		virtual bool Hit(const Ray& r, Interval tSpan, HitInfo& hitInfo) const = 0;
+		// record is written only if hit is closer than tSpan max
+		virtual bool Intersect(const Ray& r, Interval tSpan, HitRecord& rec) const = 0;
+		virtual void ComputeSurfaceInteraction(const Ray& r, const HitRecord& rec, HitInfo& hitInfo) const = 0;
+		virtual AABB Bounds() const = 0;
+
+		// any hit in tSpan, used by shadow and visibility rays
+		// aggregates override it to stop traversal at the first hit
+		virtual bool Occluded(const Ray& r, Interval tSpan) const {
+			HitRecord rec;
+			return Intersect(r, tSpan, rec);
+		}
+
+		// light sampling, implemented by primitives that can be sampled as area lights
+		// returns direction (not normalized) from origin to point of surface chosen by u in [0, 1)^2
+		virtual glm::vec3 SampleDirection(const glm::vec3 & /*origin*/, const glm::vec2 & /*u*/) const {
+			return glm::vec3(0, 1, 0);
+		}
+
+		// solid angle density of SampleDirection() for given direction
+		virtual float PdfValue(const glm::vec3 & /*origin*/, const glm::vec3 & /*dir*/) const {
+			return 0;
+		}
+
+		// returns false if primitive can't be sampled as light
+		virtual bool GetLightBounds(LightBounds & /*lightBounds*/) const {
+			return false;
+		}
+
+		// objects and instances of scene file are numbered from 1 in order of file, primitives write id
+		// of their object to hit info, instance replaces ids of its group with its own one
+		void     SetObjectId(uint32_t id) { m_objectId = id; }
+		uint32_t GetObjectId() const { return m_objectId; }
+
+		// closest hit with full surface information
+		bool Hit(const Ray& r, Interval tSpan, HitInfo& hitInfo) const {
+			HitRecord rec;
+			if (!Intersect(r, tSpan, rec)) {
+				return false;
+			}
+			ComputeSurfaceInteraction(r, rec, hitInfo);
+			return true;
+		}
+
+	protected:
+		// surface data is computed by instance (it transforms hit back to world) or by primitive itself
+		static void ForwardSurfaceInteraction(const Ray& r, const HitRecord& rec, HitInfo& hitInfo) {
+			const IHittable *owner = rec.instance ? rec.instance : rec.object;
+			owner->ComputeSurfaceInteraction(r, rec, hitInfo);
+		}
+
+		uint32_t m_objectId = 0;
 	};
 
 
 	class Sphere : public IHittable {
 	public:
-		Sphere(const glm::vec3 &center, float radius, IMaterial *mat) : m_center(center), m_radius(std::fmax(0, radius)), m_mat(mat) {}
+		Sphere(const glm::vec3 &center, float radius, uint32_t matIndex) : m_center(center), m_radius(std::fmax(0, radius)), m_matIndex(matIndex) {}
 
-		bool Hit(const Ray& r, Interval tSpan, HitInfo& hitInfo) const override {
+		bool Intersect(const Ray& r, Interval tSpan, HitRecord& rec) const override {
 			glm::vec3 no = m_center - r.GetOrigin();
 			float a = glm::dot(r.GetDirection(), r.GetDirection());
 			float h = glm::dot(r.GetDirection(), no);
@@ -86,18 +228,60 @@ namespace art {
 				}
 			}
 
-			hitInfo.t = t;
+			rec.t = t;
+			rec.primId = 0;
+			rec.object = this;
+			rec.instance = nullptr;
+			return true;
+		}
+
+		void ComputeSurfaceInteraction(const Ray& r, const HitRecord& rec, HitInfo& hitInfo) const override {
+			hitInfo.t = rec.t;
 			hitInfo.p = r.At(hitInfo.t);
 			glm::vec3 outN = glm::normalize((hitInfo.p - m_center) / m_radius);
 			hitInfo.SetFaceNormal(r, outN);
 			GetSphereUV(outN, hitInfo.u, hitInfo.v);
-			hitInfo.mat = m_mat;
+			hitInfo.matIndex = m_matIndex;
+			hitInfo.objectId = m_objectId;
 
 			// calculate tangent space for normal maps
 			float phi = std::atan2(-hitInfo.p.z, hitInfo.p.x) + pi;
 			hitInfo.T = -glm::vec3(-sin(phi), 0, cos(phi));
 			hitInfo.BT = glm::cross(hitInfo.N, hitInfo.T);
+		}
+
+		AABB Bounds() const override {
+			return AABB(m_center - glm::vec3(m_radius), m_center + glm::vec3(m_radius));
+		}
+
+		// directions are sampled uniformly inside cone that contains sphere
+		glm::vec3 SampleDirection(const glm::vec3 &origin, const glm::vec2 &u) const override {
+			glm::vec3 toCenter = m_center - origin;
+			float distSq = glm::dot(toCenter, toCenter);
+			if (distSq <= m_radius * m_radius) {
+				return toCenter;  // origin is inside, PdfValue() is 0 for it
+			}
+			float cosThetaMax = std::sqrt(1 - m_radius * m_radius / distSq);
+			return RandomInCone(toCenter / std::sqrt(distSq), cosThetaMax, u);
+		}
 
+		float PdfValue(const glm::vec3 &origin, const glm::vec3 &dir) const override {
+			HitRecord rec;
+			if (!Intersect(Ray(origin, dir), Interval(0.001f, infinity), rec)) {
+				return 0;
+			}
+
+			glm::vec3 toCenter = m_center - origin;
+			float distSq = glm::dot(toCenter, toCenter);
+			if (distSq <= m_radius * m_radius) {
+				return 0;
+			}
+			float cosThetaMax = std::sqrt(1 - m_radius * m_radius / distSq);
+			return 1 / (2 * pi * (1 - cosThetaMax));
+		}
+
+		bool GetLightBounds(LightBounds &lightBounds) const override {
+			lightBounds = LightBounds{ Bounds(), glm::vec3(0, 1, 0), -1, 4 * pi * m_radius * m_radius, false, m_matIndex };
 			return true;
 		}
 
@@ -112,16 +296,16 @@ namespace art {
 	private:
 		glm::vec3 m_center;
 		float     m_radius;
-		IMaterial *m_mat;
+		uint32_t  m_matIndex;
 	};
 
 	class Quad : public IHittable {
 	public:
-		Quad(const glm::vec3 &Q, const glm::vec3 &u, const glm::vec3 &v, IMaterial *mat, bool oneSided) :
+		Quad(const glm::vec3 &Q, const glm::vec3 &u, const glm::vec3 &v, uint32_t matIndex, bool oneSided) :
 				m_Q(Q),
 				m_u(u), 
 				m_v(v), 
-				m_mat(mat),
+				m_matIndex(matIndex),
 				m_oneSided(oneSided) 
 		{
 			glm::vec3 n = glm::cross(u, v);
@@ -130,7 +314,7 @@ namespace art {
 			m_w = n / glm::dot(n, n);
 		}
 
-		bool Hit(const Ray& r, Interval tSpan, HitInfo& hitInfo) const override {
+		bool Intersect(const Ray& r, Interval tSpan, HitRecord& rec) const override {
 			float denom = glm::dot(m_N, r.GetDirection());
 
 			// if ray is parallel to plane or opposite side
@@ -154,40 +338,78 @@ namespace art {
 			float alpha = glm::dot(m_w, glm::cross(planarHitVec, m_v));
 			float beta = glm::dot(m_w, glm::cross(m_u, planarHitVec));
 
-			if (!isInside(alpha, beta, hitInfo)) {
+			if (!isInside(alpha, beta)) {
 				return false;
 			}
 
-			// set rest of hit info
-			hitInfo.t = t;
-			hitInfo.p = p;
-			hitInfo.mat = m_mat;
+			rec.t = t;
+			rec.b1 = alpha;
+			rec.b2 = beta;
+			rec.primId = 0;
+			rec.object = this;
+			rec.instance = nullptr;
+			return true;
+		}
+
+		void ComputeSurfaceInteraction(const Ray& r, const HitRecord& rec, HitInfo& hitInfo) const override {
+			hitInfo.t = rec.t;
+			hitInfo.p = r.At(rec.t);
+			hitInfo.u = rec.b1;
+			hitInfo.v = rec.b2;
+			hitInfo.matIndex = m_matIndex;
+			hitInfo.objectId = m_objectId;
 			hitInfo.SetFaceNormal(r, m_N);
 
 			// calculate tangent space for normal maps
 			hitInfo.T = glm::normalize(m_u);
 			hitInfo.BT = glm::cross(hitInfo.N, hitInfo.T);
+		}
 
-			return true;
+		AABB Bounds() const override {
+			AABB box(m_Q, m_Q + m_u + m_v);
+			box.Expand(AABB(m_Q + m_u, m_Q + m_v));
+
+			// pad flat boxes so slab test doesn't miss axis-aligned quads
+			glm::vec3 pad = 1e-4f * glm::vec3(glm::lessThan(box.Extent(), glm::vec3(1e-4f)));
+			return AABB(box.GetMin() - pad, box.GetMax() + pad);
 		}
 
-		virtual bool isInside(float a, float b, HitInfo &info) const {
-			Interval unitInt = Interval{0, 1};
+		// points are sampled uniformly on quad area
+		glm::vec3 SampleDirection(const glm::vec3 &origin, const glm::vec2 &u) const override {
+			glm::vec3 p = m_Q + u.x * m_u + u.y * m_v;
+			return p - origin;
+		}
 
-			if (!unitInt.Contains(a) || !unitInt.Contains(b)) {
-				return false;
+		float PdfValue(const glm::vec3 &origin, const glm::vec3 &dir) const override {
+			Ray r(origin, dir);
+			HitRecord rec;
+			if (!Intersect(r, Interval(0.001f, infinity), rec)) {
+				return 0;
 			}
 
-			info.u = a;
-			info.v = b;
+			// area density converted to solid angle density
+			float area = glm::length(glm::cross(m_u, m_v));
+			float cosine = std::fabs(glm::dot(r.GetDirection(), m_N));
+			return (rec.t * rec.t) / (cosine * area);
+		}
+
+		bool GetLightBounds(LightBounds &lightBounds) const override {
+			// one-sided quad is hit only by rays going along normal, so it emits against normal
+			float area = glm::length(glm::cross(m_u, m_v));
+			lightBounds = LightBounds{ Bounds(), -m_N, 1, area, !m_oneSided, m_matIndex };
 			return true;
 		}
 
+		virtual bool isInside(float a, float b) const {
+			Interval unitInt = Interval{0, 1};
+			return unitInt.Contains(a) && unitInt.Contains(b);
+		}
+
 	private:
 		glm::vec3  m_Q;
 		glm::vec3  m_u;
 		glm::vec3  m_v;
-		IMaterial *m_mat;
+		uint32_t   m_matIndex;
 		bool       m_oneSided;
 
 		glm::vec3 m_N, m_w;
@@ -1,6 +1,18 @@
 #pragma once
 
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define ART_USE_SSE 1
+	#include <emmintrin.h>
+#else
+	#define ART_USE_SSE 0
+#endif
+
 #include "image.hpp"
+#include "scheduler.hpp"
 
 namespace art {
 
@@ -8,53 +20,138 @@ namespace art {
 		return 0.39894 * exp(-0.5 * x * x / (sigma * sigma)) / sigma;
 	}
 
-	float Normpdf3(glm::vec3 v, float sigma) {
-		return 0.39894 * exp(-0.5 * glm::dot(v, v) / (sigma * sigma)) / sigma;
-	}
+#if ART_USE_SSE
+	// 2^t of four values t <= 0: nearest integer goes to exponent bits, 2^f of the rest (|f| <= 0.5)
+	// is minimax cubic with relative error below 1e-4, weights of filter don't need more
+	inline __m128 FastExp2(__m128 t) {
+		t = _mm_max_ps(t, _mm_set1_ps(-126.0f));  // smaller values would need denormals
+		__m128i i = _mm_cvtps_epi32(t);
+		__m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(i));
 
-	std::unique_ptr<Image> BilateralFilter(const Image &img, uint32_t msize, float sigma, float bsigma) {
-		// shadertoy.com/view/4dfGDH
+		__m128 p = _mm_set1_ps(0.0551716691f);
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.242611122f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.693260985f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.999928074f));
 
-		// declare stuff
-		const int kSize = (msize - 1) / 2;
-		std::vector<float> kernel;
-		kernel.resize(msize);
+		__m128i exponent = _mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23);
+		return _mm_mul_ps(p, _mm_castsi128_ps(exponent));
+	}
+#endif
+
+	// shadertoy.com/view/4dfGDH
+	// image is converted once to planes of floats with border of kernel radius (edge pixels are repeated),
+	// so taps don't need clamping, and rows are filtered on nThreads threads (0 - all hardware threads)
+	// with SSE four neighbouring pixels are filtered at once: they share spatial weights of taps
+	// and read taps from consecutive floats, range weights use fast exp (see FastExp2())
+	std::unique_ptr<Image> BilateralFilter(const Image &img, uint32_t msize, float sigma, float bsigma, uint32_t nThreads = 0) {
+		const int32_t kSize = (msize - 1) / 2;
+		const int32_t width = img.GetWidth();
+		const int32_t height = img.GetHeight();
+		const int32_t taps = 2 * kSize + 1;
 
 		// create new image
 		std::unique_ptr<Image> newImg = std::make_unique<Image>(img.GetWidth(), img.GetHeight(), img.GetNumChannels());
 
-		// create the 1-D kernel
+		// spatial weights of all taps from 1-D kernel, normalization of range weight cancels out
+		std::vector<float> kernel(taps);
 		for (int32_t j = 0; j <= kSize; ++j) {
 			kernel[kSize + j] = kernel[kSize - j] = Normpdf(float(j), sigma);
 		}
+		std::vector<float> spatial(size_t(taps) * taps);
+		for (int32_t i = 0; i != taps; ++i) {
+			for (int32_t j = 0; j != taps; ++j) {
+				spatial[i * taps + j] = kernel[i] * kernel[j];
+			}
+		}
+		const float rangeScale = -0.5f / (bsigma * bsigma);
+		const float rangeScale2 = rangeScale * 1.44269504f;  // the same for 2^x (log2(e) is folded)
+
+		// rows have 3 more pixels, so the last group of four pixels can be read as a whole
+		const int32_t stride = width + 2 * kSize + 3;
+		const int32_t rows = height + 2 * kSize;
+		std::vector<float> planes[3];
+		for (std::vector<float> &plane : planes) {
+			plane.resize(size_t(stride) * rows);
+		}
+
+		const uint32_t kPlaneRows = 16;  // copying is cheap, so rows of planes are converted in bands
+		TileScheduler scheduler(nThreads, 1);
+		scheduler.ParallelFor(rows, kPlaneRows, [&](int32_t begin, int32_t end) {
+			for (int32_t r = begin; r != end; ++r) {
+				const uint32_t y = std::clamp(r - kSize, 0, height - 1);
+				for (int32_t c = 0; c != stride; ++c) {
+					glm::vec3 color = img.GetPixelColor(std::clamp(c - kSize, 0, width - 1), y);
+					for (int32_t ch = 0; ch != 3; ++ch) {
+						planes[ch][size_t(r) * stride + c] = color[ch];
+					}
+				}
+			}
+		});
+
+		const float *red = planes[0].data();
+		const float *green = planes[1].data();
+		const float *blue = planes[2].data();
 
-		for (int32_t py = 0; py != img.GetHeight(); ++py) {
-			for (int32_t px = 0; px != img.GetWidth(); ++px) {
-
-				// declare stuff
-				glm::vec3 final_colour = glm::vec3(0.0);
-				float Z = 0.0;
-
-				glm::vec3 c = img.GetPixelColor(px, py);
-				glm::vec3 cc;
-				float factor;
-				float bZ = 1.0 / Normpdf(0.0, bsigma);
-				// read out the texels
-				for (int32_t i = -kSize; i <= kSize; ++i) {
-					for (int32_t j = -kSize; j <= kSize; ++j) {
-						cc = img.GetPixelColor(
-							std::clamp(px + j, 0, static_cast<int>(img.GetWidth()) - 1),
-							std::clamp(py + i, 0, static_cast<int>(img.GetHeight()) - 1)
-						);
-						factor = Normpdf3(cc - c, bsigma) * bZ * kernel[kSize + j] * kernel[kSize + i];
+		// every row is a task, so rows with expensive taps are shared between threads
+		scheduler.ParallelFor(height, 1, [&](int32_t py, int32_t) {
+#if ART_USE_SSE
+			for (int32_t px = 0; px < width; px += 4) {
+				const size_t center = size_t(py + kSize) * stride + px + kSize;
+				const __m128 cr = _mm_loadu_ps(red + center);
+				const __m128 cg = _mm_loadu_ps(green + center);
+				const __m128 cb = _mm_loadu_ps(blue + center);
+				const __m128 scale = _mm_set1_ps(rangeScale2);
+
+				__m128 sumR = _mm_setzero_ps(), sumG = _mm_setzero_ps(), sumB = _mm_setzero_ps(), Z = _mm_setzero_ps();
+				for (int32_t i = 0; i != taps; ++i) {
+					const size_t row = size_t(py + i) * stride + px;
+					const float *weights = spatial.data() + i * taps;
+					for (int32_t j = 0; j != taps; ++j) {
+						__m128 r = _mm_loadu_ps(red + row + j);
+						__m128 g = _mm_loadu_ps(green + row + j);
+						__m128 b = _mm_loadu_ps(blue + row + j);
+						__m128 dr = _mm_sub_ps(r, cr);
+						__m128 dg = _mm_sub_ps(g, cg);
+						__m128 db = _mm_sub_ps(b, cb);
+						__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+						__m128 factor = _mm_mul_ps(FastExp2(_mm_mul_ps(d2, scale)), _mm_set1_ps(weights[j]));
+						Z = _mm_add_ps(Z, factor);
+						sumR = _mm_add_ps(sumR, _mm_mul_ps(factor, r));
+						sumG = _mm_add_ps(sumG, _mm_mul_ps(factor, g));
+						sumB = _mm_add_ps(sumB, _mm_mul_ps(factor, b));
+					}
+				}
+
+				alignas(16) float outR[4], outG[4], outB[4];
+				_mm_store_ps(outR, _mm_div_ps(sumR, Z));
+				_mm_store_ps(outG, _mm_div_ps(sumG, Z));
+				_mm_store_ps(outB, _mm_div_ps(sumB, Z));
+				for (int32_t k = 0; k != 4 && px + k < width; ++k) {
+					newImg->SetPixelColor(px + k, py, glm::vec3(outR[k], outG[k], outB[k]), false);
+				}
+			}
+#else
+			for (int32_t px = 0; px != width; ++px) {
+				const size_t center = size_t(py + kSize) * stride + px + kSize;
+				const glm::vec3 c(red[center], green[center], blue[center]);
+
+				glm::vec3 sum(0);
+				float Z = 0;
+				for (int32_t i = 0; i != taps; ++i) {
+					const size_t row = size_t(py + i) * stride + px;
+					for (int32_t j = 0; j != taps; ++j) {
+						glm::vec3 cc(red[row + j], green[row + j], blue[row + j]);
+						glm::vec3 d = cc - c;
+						float factor = std::exp(glm::dot(d, d) * rangeScale) * spatial[i * taps + j];
 						Z += factor;
-						final_colour += factor * cc;
+						sum += factor * cc;
 					}
 				}
-				newImg->SetPixelColor(px, py, final_colour / Z, false);
+				newImg->SetPixelColor(px, py, sum / Z, false);
 			}
-		}
+#endif
+		});
 
 		return newImg;
 	}
-}
\ No newline at end of file
+}
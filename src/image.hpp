@@ -4,6 +4,9 @@
 #include <filesystem>
 
 #ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX  // std::min and std::max are used across renderer
+    #endif
     #include <Windows.h>
 #endif
 
@@ -15,9 +18,21 @@
 
 #include "glm/glm.hpp"
 
+#include "png-writer.hpp"
+
 
 namespace art {
 
+    // path of output file with given extension, it is saved to output directory specified by cmake
+    inline std::string GetOutputPath(const std::string &name, const std::string &extension) {
+        std::string filePath = name;
+        #ifdef OUTPUT_DIR
+            const char* outputDir = OUTPUT_DIR;
+            filePath = std::string(outputDir) + "/" + name;
+        #endif
+        return std::filesystem::path(filePath).replace_extension(extension).string();
+    }
+
     // image can be hdr or not
     // hdr images are read only
     class Image final {
@@ -56,6 +71,9 @@ namespace art {
         const uint32_t GetHeight()      const { return m_height; }
         const uint32_t GetNumChannels() const { return m_numChannels; }
 
+        // rows of 8-bit pixels, for writing whole image at once (framebuffer resolve)
+        uint8_t *GetData() { return m_data; }
+
         glm::vec3 GetPixelColor(uint32_t px, uint32_t py) const {
             // cant sample out of bounds
             if (!(0 <= px && px <= (m_width - 1)) || !(0 <= py && py <= (m_height - 1))) {
@@ -100,22 +118,28 @@ namespace art {
             m_data[m_numChannels * (py * m_width + px) + 2] = ib;
         }
 
-        void SaveAsPng(const std::string &name) const {
-            // saving to output directory specified by cmake
-            std::string filePath = name;
-            #ifdef OUTPUT_DIR
-                const char* outputDir = OUTPUT_DIR;
-                filePath = std::string(outputDir) + "/" + name;
-            #endif
-            filePath = std::filesystem::path(filePath).replace_extension("png").string();
+        // show - open saved image in viewer (only on windows)
+        // rows are compressed on all threads (see PngWriter)
+        void SaveAsPng(const std::string &name, bool show = true) const {
+            std::string filePath = GetOutputPath(name, "png");
 
             std::cout << "saving image: " << filePath << "\n";
 
-            int res = stbi_write_png(filePath.c_str(), m_width, m_height, m_numChannels, m_data, m_width * m_numChannels);
+            PngWriter png(filePath, m_width, m_height, m_numChannels);
+            png.WriteRows(m_data, 0, m_height);
+            png.Finish();
+
+            if (show) {
+                Show(filePath);
+            }
+        }
 
+        // opens image file in viewer (only on windows)
+        static void Show(const std::string &filePath) {
             #ifdef _WIN32
-                // show image in viewer
                 ShellExecute(NULL, "open", filePath.c_str(), NULL, NULL, SW_SHOWDEFAULT);
+            #else
+                (void)filePath;
             #endif
         }
 
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "hittable.hpp"
+#include "object-group.hpp"
+
+namespace art {
+
+	// placed copy of object group, many instances share one group and its bvh
+	// rays are transformed into object space of the group during traversal
+	class Instance : public IHittable {
+	public:
+		Instance(const ObjectGroup *group, const glm::mat4 &objectToWorld) :
+			m_group(group),
+			m_objectToWorld(objectToWorld),
+			m_worldToObject(glm::inverse(objectToWorld)),
+			m_normalToWorld(glm::transpose(glm::inverse(glm::mat3(objectToWorld))))
+		{
+			// bounds of transformed corners of group bounds
+			AABB groupBounds = group->Bounds();
+			for (int i = 0; i != 8; ++i) {
+				glm::vec3 corner(
+					(i & 1) ? groupBounds.GetMax().x : groupBounds.GetMin().x,
+					(i & 2) ? groupBounds.GetMax().y : groupBounds.GetMin().y,
+					(i & 4) ? groupBounds.GetMax().z : groupBounds.GetMin().z
+				);
+				m_bounds.Expand(glm::vec3(m_objectToWorld * glm::vec4(corner, 1.0f)));
+			}
+		}
+
+		bool Intersect(const Ray& r, Interval tSpan, HitRecord& rec) const override {
+			float scale;
+			Ray objectRay = ToObjectSpace(r, scale);
+
+			if (!m_group->Intersect(objectRay, Interval(tSpan.GetMin() * scale, tSpan.GetMax() * scale), rec)) {
+				return false;
+			}
+
+			rec.t /= scale;
+			rec.instance = this;
+			return true;
+		}
+
+		bool Occluded(const Ray& r, Interval tSpan) const override {
+			float scale;
+			Ray objectRay = ToObjectSpace(r, scale);
+			return m_group->Occluded(objectRay, Interval(tSpan.GetMin() * scale, tSpan.GetMax() * scale));
+		}
+
+		// hit info is computed in object space and moved back to world space
+		void ComputeSurfaceInteraction(const Ray& r, const HitRecord& rec, HitInfo& hitInfo) const override {
+			float scale;
+			Ray objectRay = ToObjectSpace(r, scale);
+
+			HitRecord objectRec = rec;
+			objectRec.t *= scale;
+			objectRec.instance = nullptr;
+			rec.object->ComputeSurfaceInteraction(objectRay, objectRec, hitInfo);
+
+			// face orientation is preserved by transformation
+			hitInfo.t = rec.t;
+			hitInfo.p = r.At(hitInfo.t);
+			hitInfo.N = glm::normalize(m_normalToWorld * hitInfo.N);
+			hitInfo.T = glm::normalize(glm::mat3(m_objectToWorld) * hitInfo.T);
+			hitInfo.BT = glm::cross(hitInfo.N, hitInfo.T);
+			hitInfo.objectId = m_objectId;
+		}
+
+		AABB Bounds() const override {
+			return m_bounds;
+		}
+
+	private:
+		// object space ray is normalized, so distances are scaled by length of transformed direction
+		Ray ToObjectSpace(const Ray &r, float &scale) const {
+			glm::vec3 ro = glm::vec3(m_worldToObject * glm::vec4(r.GetOrigin(), 1.0f));
+			glm::vec3 rd = glm::vec3(m_worldToObject * glm::vec4(r.GetDirection(), 0.0f));
+			scale = glm::length(rd);
+			return Ray(ro, rd);
+		}
+
+		const ObjectGroup *m_group;
+		glm::mat4 m_objectToWorld;
+		glm::mat4 m_worldToObject;
+		glm::mat3 m_normalToWorld;
+		AABB      m_bounds;
+	};
+}
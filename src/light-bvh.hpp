@@ -0,0 +1,353 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "hittable.hpp"
+#include "material.hpp"
+#include "utils.hpp"
+
+namespace art {
+
+	// node of light hierarchy, bounds power and normals of all lights below it
+	// interior node: first child is the next node in array, offset is index of second child
+	// leaf node: offset is index of light
+	struct LightNode {
+		AABB      bounds;
+		glm::vec3 axis;      // cone of emitter normals
+		float     cosTheta;  // -1 if normals point everywhere
+		float     power;
+		uint32_t  offset;
+		bool      isLeaf;
+		bool      twoSided;
+	};
+
+
+	// light hierarchy (Conty Estevez and Kulla, "Importance Sampling of Many Lights")
+	// light is chosen by walking down from root, every child is picked with probability
+	// proportional to its importance for shading point, so selection cost is logarithmic
+	// emitters are assumed to be diffuse (emission spreads 90 degrees around normals)
+	class LightBVH final {
+	public:
+		LightBVH() = default;
+
+		// materials are material table of scene, they give emission of lights
+		void Build(const std::vector<const IHittable *> &lights, const std::vector<Material> &materials) {
+			m_nodes.clear();
+			m_lights = lights;
+			m_bitTrails.clear();
+
+			std::vector<BuildLight> items;
+			items.reserve(lights.size());
+			for (uint32_t i = 0; i != lights.size(); ++i) {
+				LightBounds lb;
+				if (!lights[i]->GetLightBounds(lb)) {
+					continue;
+				}
+
+				// power of diffuse emitter is pi * radiance * area
+				glm::vec3 emitted = materials[lb.matIndex].AverageEmitted();
+				float power = pi * Luminance(emitted) * lb.area * (lb.twoSided ? 2 : 1);
+
+				items.push_back(BuildLight{ LightNode{ lb.bounds, lb.axis, lb.cosTheta, power, i, true, lb.twoSided } });
+			}
+
+			if (!items.empty()) {
+				m_nodes.reserve(2 * items.size() - 1);
+				BuildRecursive(items, 0, static_cast<uint32_t>(items.size()), 0, 0);
+			}
+		}
+
+		// n is surface normal at p, it can be zero (for points in media), u is in [0, 1)
+		// returns false if no light can illuminate p
+		bool Sample(const glm::vec3 &p, const glm::vec3 &n, float u, const IHittable *&light, float &pmf) const {
+			if (m_nodes.empty() || Importance(m_nodes[0], p, n) <= 0) {
+				return false;
+			}
+
+			uint32_t current = 0;
+			pmf = 1;
+			while (!m_nodes[current].isLeaf) {
+				const LightNode &node = m_nodes[current];
+				float importance0 = Importance(m_nodes[current + 1], p, n);
+				float importance1 = Importance(m_nodes[node.offset], p, n);
+				if (importance0 <= 0 && importance1 <= 0) {
+					return false;
+				}
+
+				float p0 = importance0 / (importance0 + importance1);
+				// u is rescaled to [0, 1) inside chosen child, so one number is enough for whole descent
+				if (u < p0) {
+					current = current + 1;
+					pmf *= p0;
+					u = std::min(u / p0, 0.99999994f);
+				} else {
+					current = node.offset;
+					pmf *= 1 - p0;
+					u = std::min((u - p0) / (1 - p0), 0.99999994f);
+				}
+			}
+
+			light = m_lights[m_nodes[current].offset];
+			return pmf > 0;
+		}
+
+		// probability that Sample() returns this light, path to it is stored as bit trail
+		float Pmf(const glm::vec3 &p, const glm::vec3 &n, const IHittable *light) const {
+			auto it = m_bitTrails.find(light);
+			if (it == m_bitTrails.end() || Importance(m_nodes[0], p, n) <= 0) {
+				return 0;
+			}
+
+			uint64_t bitTrail = it->second;
+			uint32_t current = 0;
+			float pmf = 1;
+			while (!m_nodes[current].isLeaf) {
+				const LightNode &node = m_nodes[current];
+				float importance0 = Importance(m_nodes[current + 1], p, n);
+				float importance1 = Importance(m_nodes[node.offset], p, n);
+				if (importance0 <= 0 && importance1 <= 0) {
+					return 0;
+				}
+
+				if (bitTrail & 1) {
+					current = node.offset;
+					pmf *= importance1 / (importance0 + importance1);
+				} else {
+					current = current + 1;
+					pmf *= importance0 / (importance0 + importance1);
+				}
+				bitTrail >>= 1;
+			}
+			return pmf;
+		}
+
+		bool Contains(const IHittable *light) const {
+			return m_bitTrails.find(light) != m_bitTrails.end();
+		}
+
+		const std::vector<const IHittable *> &GetLights() const { return m_lights; }
+
+	private:
+		static constexpr uint32_t kBuckets     = 12;
+		static constexpr uint32_t kMedianDepth = 32;  // deeper nodes are split by count, so bit trail fits 64 bits
+
+		struct BuildLight {
+			LightNode node;
+
+			glm::vec3 Centroid() const { return node.bounds.Centroid(); }
+		};
+
+		uint32_t BuildRecursive(std::vector<BuildLight> &items, uint32_t begin, uint32_t end, uint64_t bitTrail, uint32_t depth) {
+			if (end - begin == 1) {
+				m_nodes.push_back(items[begin].node);
+				m_bitTrails[m_lights[items[begin].node.offset]] = bitTrail;
+				return static_cast<uint32_t>(m_nodes.size() - 1);
+			}
+
+			AABB bounds, centroidBounds;
+			for (uint32_t i = begin; i != end; ++i) {
+				bounds.Expand(items[i].node.bounds);
+				centroidBounds.Expand(items[i].Centroid());
+			}
+
+			uint32_t mid = depth < kMedianDepth ? FindSplit(items, begin, end, bounds, centroidBounds) : begin;
+			if (mid == begin || mid == end) {
+				// all centroids are the same or tree is too deep
+				mid = (begin + end) / 2;
+				int axis = centroidBounds.LongestAxis();
+				std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, [axis](const BuildLight &a, const BuildLight &b) {
+					return a.Centroid()[axis] < b.Centroid()[axis];
+				});
+			}
+
+			uint32_t index = static_cast<uint32_t>(m_nodes.size());
+			m_nodes.emplace_back();
+			BuildRecursive(items, begin, mid, bitTrail, depth + 1);
+			uint32_t second = BuildRecursive(items, mid, end, bitTrail | (uint64_t(1) << depth), depth + 1);
+
+			m_nodes[index] = Union(m_nodes[index + 1], m_nodes[second]);
+			m_nodes[index].offset = second;
+			m_nodes[index].isLeaf = false;
+			return index;
+		}
+
+		// bucketed surface area orientation heuristic, returns begin if no split is better
+		uint32_t FindSplit(std::vector<BuildLight> &items, uint32_t begin, uint32_t end, const AABB &bounds, const AABB &centroidBounds) const {
+			glm::vec3 extent = bounds.Extent();
+			float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+
+			float bestCost = infinity;
+			int bestAxis = -1;
+			uint32_t bestBucket = 0;
+			for (int axis = 0; axis != 3; ++axis) {
+				float cMin = centroidBounds.GetMin()[axis];
+				float cMax = centroidBounds.GetMax()[axis];
+				if (cMax <= cMin) {
+					continue;
+				}
+
+				LightNode buckets[kBuckets];
+				bool filled[kBuckets] = {};
+				for (uint32_t i = begin; i != end; ++i) {
+					uint32_t b = Bucket(items[i].Centroid()[axis], cMin, cMax);
+					buckets[b] = filled[b] ? Union(buckets[b], items[i].node) : items[i].node;
+					filled[b] = true;
+				}
+
+				// thin boxes are penalized, otherwise flat clusters would be split along their thin side
+				float kr = maxExtent / std::max(extent[axis], 1e-6f);
+				for (uint32_t split = 1; split != kBuckets; ++split) {
+					LightNode left, right;
+					bool hasLeft = false, hasRight = false;
+					for (uint32_t b = 0; b != kBuckets; ++b) {
+						if (!filled[b]) {
+							continue;
+						}
+						LightNode &side = b < split ? left : right;
+						bool &has = b < split ? hasLeft : hasRight;
+						side = has ? Union(side, buckets[b]) : buckets[b];
+						has = true;
+					}
+					if (!hasLeft || !hasRight) {
+						continue;
+					}
+
+					float cost = kr * (Cost(left) + Cost(right));
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestBucket = split;
+					}
+				}
+			}
+
+			if (bestAxis == -1) {
+				return begin;
+			}
+
+			float cMin = centroidBounds.GetMin()[bestAxis];
+			float cMax = centroidBounds.GetMax()[bestAxis];
+			auto it = std::partition(items.begin() + begin, items.begin() + end, [&](const BuildLight &item) {
+				return Bucket(item.Centroid()[bestAxis], cMin, cMax) < bestBucket;
+			});
+			return static_cast<uint32_t>(it - items.begin());
+		}
+
+		static uint32_t Bucket(float c, float cMin, float cMax) {
+			uint32_t b = static_cast<uint32_t>(kBuckets * (c - cMin) / (cMax - cMin));
+			return std::min(b, kBuckets - 1);
+		}
+
+		// power times solid angle measure of normal cone (extended by emission spread) times area of bounds
+		static float Cost(const LightNode &node) {
+			float thetaO = std::acos(std::clamp(node.cosTheta, -1.0f, 1.0f));
+			float thetaW = std::min(thetaO + pi / 2, pi);
+			float sinThetaO = std::sqrt(std::max(0.0f, 1 - node.cosTheta * node.cosTheta));
+			float mOmega = 2 * pi * (1 - node.cosTheta) +
+				pi / 2 * (2 * thetaW * sinThetaO - std::cos(thetaO - 2 * thetaW) - 2 * thetaO * sinThetaO + node.cosTheta);
+			return node.power * mOmega * node.bounds.SurfaceArea();
+		}
+
+		static LightNode Union(const LightNode &a, const LightNode &b) {
+			LightNode node = a;
+			node.bounds.Expand(b.bounds);
+			node.power = a.power + b.power;
+			node.twoSided = a.twoSided || b.twoSided;
+			UnionCones(a.axis, a.cosTheta, b.axis, b.cosTheta, node.axis, node.cosTheta);
+			return node;
+		}
+
+		// smallest cone containing both cones
+		static void UnionCones(const glm::vec3 &axisA, float cosA, const glm::vec3 &axisB, float cosB, glm::vec3 &axis, float &cosTheta) {
+			axis = axisA;
+			cosTheta = -1;
+			if (cosA <= -1 || cosB <= -1) {
+				return;
+			}
+
+			float thetaA = std::acos(std::clamp(cosA, -1.0f, 1.0f));
+			float thetaB = std::acos(std::clamp(cosB, -1.0f, 1.0f));
+			float thetaD = std::acos(std::clamp(glm::dot(axisA, axisB), -1.0f, 1.0f));
+			if (std::min(thetaD + thetaB, pi) <= thetaA) {
+				cosTheta = cosA;
+				return;
+			}
+			if (std::min(thetaD + thetaA, pi) <= thetaB) {
+				axis = axisB;
+				cosTheta = cosB;
+				return;
+			}
+
+			float thetaO = (thetaA + thetaD + thetaB) / 2;
+			glm::vec3 rotationAxis = glm::cross(axisA, axisB);
+			if (thetaO >= pi || glm::dot(rotationAxis, rotationAxis) < 1e-12f) {
+				return;
+			}
+
+			// rotate axis of first cone towards second one
+			float thetaR = thetaO - thetaA;
+			rotationAxis = glm::normalize(rotationAxis);
+			axis = glm::normalize(axisA * std::cos(thetaR) + glm::cross(rotationAxis, axisA) * std::sin(thetaR));
+			cosTheta = std::cos(thetaO);
+		}
+
+		// conservative estimate of light coming from node to point p with normal n
+		// angles are bounded from below: angle to cone axis minus cone spread minus angle subtended by bounds
+		static float Importance(const LightNode &node, const glm::vec3 &p, const glm::vec3 &n) {
+			// cos(max(0, a - b)) and sin(max(0, a - b)) from sines and cosines
+			auto cosSubClamped = [](float sinA, float cosA, float sinB, float cosB) {
+				return cosA > cosB ? 1.0f : cosA * cosB + sinA * sinB;
+			};
+			auto sinSubClamped = [](float sinA, float cosA, float sinB, float cosB) {
+				return cosA > cosB ? 0.0f : sinA * cosB - cosA * sinB;
+			};
+			auto sinFromCos = [](float cos) {
+				return std::sqrt(std::max(0.0f, 1 - cos * cos));
+			};
+
+			glm::vec3 pc = node.bounds.Centroid();
+			glm::vec3 toPoint = p - pc;
+			float distSq = glm::dot(toPoint, toPoint);
+			float radius = 0.5f * glm::length(node.bounds.Extent());
+			glm::vec3 wi = distSq > 0 ? toPoint / std::sqrt(distSq) : n;
+
+			// cone of directions to bounds, all directions if p is inside
+			float cosThetaB = distSq > radius * radius ? std::sqrt(1 - radius * radius / distSq) : -1.0f;
+			float sinThetaB = sinFromCos(cosThetaB);
+
+			float cosThetaW = glm::dot(node.axis, wi);
+			if (node.twoSided) {
+				cosThetaW = std::fabs(cosThetaW);
+			}
+			float sinThetaW = sinFromCos(cosThetaW);
+			float sinThetaO = sinFromCos(node.cosTheta);
+
+			float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, node.cosTheta);
+			float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, node.cosTheta);
+			float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+			if (cosThetaP <= 0) {
+				return 0;
+			}
+
+			// distance is clamped, so nodes around p don't get infinite importance
+			float importance = node.power * cosThetaP / std::max(distSq, radius);
+
+			// cosine at receiver, both sides are used (glass and glossy lobes can go below surface)
+			if (n != glm::vec3(0)) {
+				float cosThetaI = std::fabs(glm::dot(wi, n));
+				float sinThetaI = sinFromCos(cosThetaI);
+				importance *= cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+			}
+			return std::max(importance, 0.0f);
+		}
+
+		std::vector<LightNode>                         m_nodes;
+		std::vector<const IHittable *>                 m_lights;
+		std::unordered_map<const IHittable *, uint64_t> m_bitTrails;  // bit per level, 1 means second child
+	};
+}
@@ -4,19 +4,25 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <iostream>
+#include <mutex>
 
 #include "timer.hpp"
 #include "scene-parser.hpp"
 #include "image-filters.hpp"
+#include "benchmark.hpp"
 
 
 void ShowTutorial() {
     std::cout << "\n=== Red Eye Path Tracer ===\n\n";
-    std::cout << "Usage:   ./RedEye <scene-name>\n";
-    std::cout << "Example: ./RedEye example\n\n";
+    std::cout << "Usage:   ./RedEye <scene-name> [--threads <count>] [--tile-size <pixels>]\n";
+    std::cout << "Example: ./RedEye example --threads 8 --tile-size 16\n\n";
     std::cout << "Usage:   ./RedEye filter <image-name> <kernel-size> <sigma> <b-sigma>\n";
     std::cout << "Example: ./RedEye filter example-scene.png 15 10 0.1\n\n";
-    std::cout << "None: default search directories are 'project-root/scenes/' and 'project-root/output/'\n";
+    std::cout << "Usage:   ./RedEye benchmark <benchmark-name>\n";
+    std::cout << "Example: ./RedEye benchmark bvh\n\n";
+    std::cout << "Usage:   ./RedEye convert <obj-mesh-name> <binary-mesh-name>\n";
+    std::cout << "Example: ./RedEye convert torus.obj torus.rmesh\n\n";
+    std::cout << "None: default search directories are 'project-root/scenes/', 'project-root/meshes/' and 'project-root/output/'\n";
     std::cout << "(but you can specify absolute path to yaml scene file or image)\n";
     std::cout << "Resulting image will be saved in 'project-root/output/'\n\n";
     std::cout << "For more info see README\n";
@@ -39,47 +45,167 @@ void FilterImage(const std::string &fileName, uint32_t msize, float sigma, float
     std::cout << "filtered image saved as: " << newName << ".png" << "\n";
 }
 
+void ConvertMesh(const std::string &objName, const std::string &meshName) {
+    art::Timer timer{"Converting"};
+
+    std::string objPath = art::GetMeshPath(objName);
+    std::string meshPath = art::GetMeshPath(meshName);
+    if (std::filesystem::path(meshPath).extension() != art::kMeshFileExtension) {
+        meshPath += art::kMeshFileExtension;
+    }
+
+    // mesh builds its bvh, so it is stored in file and not rebuilt on every render
+    std::cout << "loading mesh " << objPath << "\n";
+    art::Mesh mesh(art::OBJLoader::Load(objPath), 0);  // material is not stored in file
+    mesh.Save(meshPath);
+
+    std::cout << "binary mesh saved as: " << meshPath << "\n";
+}
+
 
 int main(int argc, char *argv[]) {
 
     // filtering mode
-    if (argc == 6) {
-        if (std::string(argv[1]) != "filter") {
-            ShowTutorial();
-            return 0;
-        }
-        
+    if (argc == 6 && std::string(argv[1]) == "filter") {
         FilterImage(std::string(argv[2]), std::stoi(argv[3]), std::stof(argv[4]), std::stof(argv[5]));
         return 0;
     }
 
-    if (argc != 2) {
+    // mesh converting mode
+    if (argc == 4 && std::string(argv[1]) == "convert") {
+        ConvertMesh(std::string(argv[2]), std::string(argv[3]));
+        return 0;
+    }
+
+    // benchmarking mode
+    if (argc == 3 && std::string(argv[1]) == "benchmark") {
+        art::RunBenchmark(std::string(argv[2]));
+        return 0;
+    }
+
+    // rendering mode, scene name can be followed by options
+    if (argc < 2 || argc % 2 != 0) {
         ShowTutorial();
         return 0;
     }
 
+    uint32_t nThreads = 0;  // all hardware threads
+    uint32_t tileSize = 16;
+    for (int i = 2; i < argc; i += 2) {
+        std::string option = argv[i];
+        if (option == "--threads") {
+            nThreads = std::stoi(argv[i + 1]);
+        } else if (option == "--tile-size") {
+            tileSize = std::stoi(argv[i + 1]);
+        } else {
+            std::cerr << "unknown option - " << option << "\n";
+            exit(1);
+        }
+    }
+
 
     art::SceneParser parser{std::string(argv[1])};
 
     art::Scene                  scene;
     art::Camera                 camera      = parser.GetCamera(); 
-    std::unique_ptr<art::Image> renderImage = parser.GetImage();
+    glm::uvec2                  imageSize   = parser.GetImageSize();
     std::string                 outputName  = parser.GetOutputFileName();
+    art::HdrFormat              hdrFormat   = parser.GetHdrFormat();
+    camera.SetThreads(nThreads);
+    camera.SetTileSize(tileSize);
 
 
     {  // scopes are created for scoped timers
         art::Timer timer{"Scene parsing"};
         parser.PopulateScene(scene);
     }
+
+    scene.Build();  // reports building time by itself
    
+    // every finished band is resolved and appended to files, memory is bounded by size of band
+    if (parser.IsStreaming()) {
+        art::Timer timer{"Rendering"};
+
+        std::string pngPath = art::GetOutputPath(outputName, "png");
+        std::cout << "streaming image: " << pngPath << "\n";
+        art::PngWriter png(pngPath, imageSize.x, imageSize.y);
+        std::unique_ptr<art::HdrWriter> hdr;
+        if (hdrFormat != art::HdrFormat::None) {
+            std::string hdrPath = art::GetOutputPath(outputName, art::HdrExtension(hdrFormat));
+            std::cout << "streaming hdr image: " << hdrPath << "\n";
+            hdr = std::make_unique<art::HdrWriter>(hdrPath, hdrFormat, imageSize.x, imageSize.y, nThreads);
+        }
+        std::unique_ptr<art::AovWriter> aovs;
+        if (parser.GetAovs().size() != 0) {
+            aovs = std::make_unique<art::AovWriter>(outputName, hdrFormat, parser.GetAovs(), imageSize.x, imageSize.y, nThreads);
+        }
+
+        std::unique_ptr<art::Image> bandImage;
+        camera.RenderStreaming(imageSize.x, imageSize.y, scene, [&](const art::Framebuffer &band, uint32_t y0) {
+            if (!bandImage || bandImage->GetHeight() != band.GetHeight()) {
+                bandImage = std::make_unique<art::Image>(band.GetWidth(), band.GetHeight());
+            }
+            band.Resolve(*bandImage, nThreads);
+            png.WriteRows(bandImage->GetData(), y0, band.GetHeight());
+            if (hdr) {
+                hdr->WriteRows(band, y0);
+            }
+            if (aovs) {
+                aovs->WriteRows(band, y0);
+            }
+        });
+
+        art::Timer savingTimer{"Saving"};  // only the last band is left
+        png.Finish();
+        return 0;
+    }
+
+    std::unique_ptr<art::Image> renderImage = std::make_unique<art::Image>(imageSize.x, imageSize.y);
+    art::Framebuffer framebuffer = camera.CreateFramebuffer(imageSize.x, imageSize.y);
+
+    // hdr image and output variables are written from framebuffer directly,
+    // adaptive sampling also saves map of samples per pixel
+    auto saveExtras = [&](const art::Framebuffer &framebuffer) {
+        art::SaveHdr(framebuffer, outputName, hdrFormat, nThreads);
+        art::SaveAovs(framebuffer, outputName, hdrFormat, nThreads);
+        if (camera.IsAdaptive()) {
+            art::Image sampleMap(renderImage->GetWidth(), renderImage->GetHeight());
+            framebuffer.ResolveCounts(sampleMap);
+            sampleMap.SaveAsPng(std::filesystem::path(outputName).replace_extension().string() + "-samples", false);
+        }
+    };
+
+    // final png is resolved and encoded by rows as soon as they are finished, while the rest is rendered
+    std::string pngPath = art::GetOutputPath(outputName, "png");
+    std::unique_ptr<art::PngWriter> png;
+    std::once_flag pngCreated;
+    auto rowsDone = [&](uint32_t y0, uint32_t y1) {
+        std::call_once(pngCreated, [&]() {
+            std::cout << "saving image: " << pngPath << "\n";
+            png = std::make_unique<art::PngWriter>(pngPath, imageSize.x, imageSize.y, 3, nThreads);
+        });
+        framebuffer.ResolveRows(*renderImage, y0, y1);
+        png->WriteRows(renderImage->GetData() + size_t(y0) * imageSize.x * 3, y0, y1 - y0);
+    };
+
     {
         art::Timer timer{"Rendering"};
-        camera.Render(*renderImage, scene);
+        // progressive rendering saves unfinished image from time to time, so killed render leaves result
+        camera.Render(framebuffer, scene, [&](const art::Framebuffer &framebuffer) {
+            framebuffer.Resolve(*renderImage, nThreads);
+            renderImage->SaveAsPng(outputName, false);
+            saveExtras(framebuffer);
+        }, rowsDone);
     }
 
     {
         art::Timer timer{"Saving"};
-        renderImage->SaveAsPng(outputName);
+        if (!png) {
+            rowsDone(0, imageSize.y);  // renderer didn't report rows (empty image), the whole frame is written now
+        }
+        png->Finish();
+        art::Image::Show(pngPath);
+        saveExtras(framebuffer);
     }
 
     return 0;
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <utility>
+
+#ifdef _WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+namespace art {
+
+	// read-only memory mapped file, pages are loaded by OS on first access
+	class MappedFile final {
+	public:
+		MappedFile() = default;
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+
+		MappedFile(MappedFile &&other) noexcept {
+			*this = std::move(other);
+		}
+
+		MappedFile &operator=(MappedFile &&other) noexcept {
+			if (this != &other) {
+				Close();
+				m_data = other.m_data;
+				m_size = other.m_size;
+				other.m_data = nullptr;
+				other.m_size = 0;
+			}
+			return *this;
+		}
+
+		~MappedFile() {
+			Close();
+		}
+
+		// returns false if file can't be opened or mapped
+		bool Open(const std::string &filePath) {
+			Close();
+
+#ifdef _WIN32
+			HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (file == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+				CloseHandle(file);
+				return false;
+			}
+
+			// view keeps mapping alive, so handles can be closed right away
+			HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			CloseHandle(file);
+			if (mapping == NULL) {
+				return false;
+			}
+			void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+			if (data == NULL) {
+				return false;
+			}
+
+			m_data = static_cast<const char *>(data);
+			m_size = static_cast<size_t>(size.QuadPart);
+#else
+			int fd = open(filePath.c_str(), O_RDONLY);
+			if (fd == -1) {
+				return false;
+			}
+
+			struct stat st;
+			if (fstat(fd, &st) == -1 || st.st_size == 0) {
+				close(fd);
+				return false;
+			}
+
+			// mapping stays valid after descriptor is closed
+			void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if (data == MAP_FAILED) {
+				return false;
+			}
+
+			m_data = static_cast<const char *>(data);
+			m_size = static_cast<size_t>(st.st_size);
+#endif
+			return true;
+		}
+
+		void Close() {
+			if (m_data == nullptr) {
+				return;
+			}
+#ifdef _WIN32
+			UnmapViewOfFile(m_data);
+#else
+			munmap(const_cast<char *>(m_data), m_size);
+#endif
+			m_data = nullptr;
+			m_size = 0;
+		}
+
+		const char *GetData() const { return m_data; }
+		size_t      GetSize() const { return m_size; }
+
+	private:
+		const char *m_data = nullptr;
+		size_t      m_size = 0;
+	};
+}
@@ -1,21 +1,71 @@
 #pragma once
 
 #include <algorithm>
+#include <variant>
 
 #include "hittable.hpp"
 #include "utils.hpp"
 #include "texture.hpp"
 
 namespace art {
-	class IMaterial {
+	// density of direction from origin to uniformly distributed point on sphere (center is relative to origin)
+	// materials sample directions as normalized point on sphere, so this is their pdf
+	inline float SpherePointDirectionPdf(const glm::vec3 &center, float radius, const glm::vec3 &dir) {
+		float b = glm::dot(dir, center);
+		float discriminant = b * b - glm::dot(center, center) + radius * radius;
+		if (discriminant <= 0) {
+			return 0;
+		}
+
+		// every intersection adds area density converted to solid angle density
+		float sqrtd = std::sqrt(discriminant);
+		float pdf = 0;
+		for (float t : { b - sqrtd, b + sqrtd }) {
+			if (t > 0) {
+				pdf += t * t / (4 * pi * radius * sqrtd);
+			}
+		}
+		return pdf;
+	}
+
+
+	// default behaviour of materials, there are no virtual functions:
+	// materials hide methods they implement and are called through Material (see below)
+	//
+	// every material implements
+	//   bool Scatter(const Ray &rayIn, const HitInfo &hitInfo, glm::vec3 &attenuation, Ray &rayOut, float &pdf, float uLobe, const glm::vec2 &uDir) const
+	// uLobe chooses between lobes of material, uDir chooses direction inside lobe (both uniform in [0, 1))
+	// pdf is solid angle density of rayOut direction, 0 if direction can't be sampled
+	// any other way (mirror and glass reflections), then light sampling is not used
+	class MaterialBase {
 	public:
-		virtual ~IMaterial() = default;
+		// brdf multiplied by cosine for given direction and pdf of sampling it with Scatter()
+		// returns false if material can't be evaluated, materials that return pdf > 0 from Scatter() must implement this
+		bool Evaluate(const Ray & /*rayIn*/, const HitInfo & /*hitInfo*/, const glm::vec3 & /*dir*/, glm::vec3 & /*value*/, float & /*pdf*/) const {
+			return false;
+		}
+
+		glm::vec3 Emitted(const HitInfo & /*hitInfo*/) const {
+			return glm::vec3(0);
+		}
+
+		// emission averaged over surface, used only to estimate power of lights
+		glm::vec3 AverageEmitted() const {
+			return glm::vec3(0);
+		}
 
-		virtual bool Scatter(const Ray &rayIn, const HitInfo &hitInfo, glm::vec3 &attenuation, Ray &rayOut) const = 0;
+		// reflectance and normal of surface for output variables (see AovSample)
+		glm::vec3 Albedo(const HitInfo & /*hitInfo*/) const {
+			return glm::vec3(0);
+		}
+
+		glm::vec3 ShadingNormal(const HitInfo &hitInfo) const {
+			return hitInfo.N;
+		}
 	};
 
 
-	class Lambertian : public IMaterial {
+	class Lambertian : public MaterialBase {
 	public:
 		Lambertian(const glm::vec3 &albedo, float smoothness, float specularProbability, const ITexture *normals, float normalsStrength) :
 			m_albedo(albedo),
@@ -23,7 +73,7 @@ namespace art {
 			m_textureNormals(normals),
 			m_normalsStrength(normalsStrength),
 			m_smoothness(smoothness),
-			m_specularProbability(specularProbability) {}
+			m_specularProbability(std::clamp(specularProbability, 0.0f, 1.0f)) {}
 
 		Lambertian(const ITexture *albedo, float smoothness, float specularProbability, const ITexture *normals, float normalsStrength) :
 			m_albedo(glm::vec3(1)),
@@ -31,46 +81,85 @@ namespace art {
 			m_textureNormals(normals),
 			m_normalsStrength(normalsStrength),
 			m_smoothness(smoothness),
-			m_specularProbability(specularProbability) {}
+			m_specularProbability(std::clamp(specularProbability, 0.0f, 1.0f)) {}
 
-		bool Scatter(const Ray &rayIn, const HitInfo &hitInfo, glm::vec3 &attenuation, Ray &rayOut) const override {
+		bool Scatter(const Ray &rayIn, const HitInfo &hitInfo, glm::vec3 &attenuation, Ray &rayOut, float &pdf, float uLobe, const glm::vec2 &uDir) const {
+			glm::vec3 N = ShadingNormal(hitInfo);
 
-			glm::vec3 N;
-			if (m_textureNormals) {
-				glm::vec3 tangentSpaceNormal = m_textureNormals->Sample(hitInfo.u, hitInfo.v, hitInfo.p, glm::vec3(0)) * 2.0f - 1.0f;
-				tangentSpaceNormal.x *= m_normalsStrength;
-				tangentSpaceNormal.y *= m_normalsStrength;
-				tangentSpaceNormal = glm::normalize(tangentSpaceNormal);
-
-				glm::mat3 TBN = glm::mat3(hitInfo.T, hitInfo.BT, hitInfo.N);
-				N = glm::normalize(TBN * tangentSpaceNormal);
-			} else {
-				N = hitInfo.N;
-			}
-			 
-			glm::vec3 diffuseDir = N + RandomVec();
+			glm::vec3 diffuseDir = N + RandomVec(uDir);
 			glm::vec3 reflectDir = glm::reflect(rayIn.GetDirection(), N);
 
 			if (VecNearZero(diffuseDir)) {
 				diffuseDir = N;
 			}
 
-			bool isSpecularBounce = m_specularProbability >= Random();
+			bool isSpecularBounce = m_specularProbability > uLobe;
 
 			glm::vec3 dir = glm::mix(diffuseDir, reflectDir, m_smoothness * isSpecularBounce);
 
-			attenuation = glm::mix(
-				m_textureAlbedo ? m_textureAlbedo->Sample(hitInfo.u, hitInfo.v, hitInfo.p, glm::vec3(0)) : m_albedo,
-				glm::vec3(1),
-				isSpecularBounce
-			);
+			attenuation = glm::mix(Albedo(hitInfo), glm::vec3(1), isSpecularBounce);
 
 			rayOut = Ray(hitInfo.p, dir);
 
+			// perfect reflection can't be hit by light sampling
+			if (isSpecularBounce && m_smoothness >= 1) {
+				pdf = 0;
+			} else {
+				float diffusePdf, glossyPdf;
+				LobePdfs(N, reflectDir, rayOut.GetDirection(), diffusePdf, glossyPdf);
+				pdf = (1 - m_specularProbability) * diffusePdf + m_specularProbability * glossyPdf;
+			}
+
 			return true;
 		}
 
+		// diffuse and glossy lobes are mixed with specular probability,
+		// every lobe scatters with its own attenuation, so brdf * cos is attenuation * pdf
+		bool Evaluate(const Ray &rayIn, const HitInfo &hitInfo, const glm::vec3 &dir, glm::vec3 &value, float &pdf) const {
+			glm::vec3 N = ShadingNormal(hitInfo);
+			glm::vec3 reflectDir = glm::reflect(rayIn.GetDirection(), N);
+
+			float diffusePdf, glossyPdf;
+			LobePdfs(N, reflectDir, dir, diffusePdf, glossyPdf);
+			diffusePdf *= 1 - m_specularProbability;
+			glossyPdf *= m_specularProbability;
+
+			value = diffusePdf * Albedo(hitInfo) + glm::vec3(glossyPdf);
+			pdf = diffusePdf + glossyPdf;
+			return pdf > 0;
+		}
+
+		glm::vec3 Albedo(const HitInfo &hitInfo) const {
+			return m_textureAlbedo ? m_textureAlbedo->Sample(hitInfo.u, hitInfo.v, hitInfo.p, glm::vec3(0)) : m_albedo;
+		}
+
+		// normal with normal map
+		glm::vec3 ShadingNormal(const HitInfo &hitInfo) const {
+			if (!m_textureNormals) {
+				return hitInfo.N;
+			}
+
+			glm::vec3 tangentSpaceNormal = m_textureNormals->Sample(hitInfo.u, hitInfo.v, hitInfo.p, glm::vec3(0)) * 2.0f - 1.0f;
+			tangentSpaceNormal.x *= m_normalsStrength;
+			tangentSpaceNormal.y *= m_normalsStrength;
+			tangentSpaceNormal = glm::normalize(tangentSpaceNormal);
+
+			glm::mat3 TBN = glm::mat3(hitInfo.T, hitInfo.BT, hitInfo.N);
+			return glm::normalize(TBN * tangentSpaceNormal);
+		}
+
 	private:
+		// diffuse direction is N + random unit vector (cosine distribution),
+		// glossy direction is mix of it with reflection, that is point on sphere with center (1 - s) * N + s * R
+		void LobePdfs(const glm::vec3 &N, const glm::vec3 &reflectDir, const glm::vec3 &dir, float &diffusePdf, float &glossyPdf) const {
+			diffusePdf = std::max(glm::dot(dir, N), 0.0f) / pi;
+			if (m_smoothness >= 1) {
+				glossyPdf = 0;  // delta lobe
+			} else {
+				glossyPdf = SpherePointDirectionPdf(glm::mix(N, reflectDir, m_smoothness), 1 - m_smoothness, dir);
+			}
+		}
+
 		glm::vec3       m_albedo;
 		const ITexture *m_textureAlbedo;
 		const ITexture *m_textureNormals;
@@ -80,7 +169,7 @@ namespace art {
 	};
 
 
-	class Metal : public IMaterial {
+	class Metal : public MaterialBase {
 	public:
 		Metal(const glm::vec3 &albedo, float smoothness) : 
 			m_albedo(albedo),
@@ -93,16 +182,34 @@ namespace art {
 			m_smoothness(std::clamp(smoothness, 0.0f, 1.0f)) {
 		}
 
-		bool Scatter(const Ray &rayIn, const HitInfo &hitInfo, glm::vec3 &attenuation, Ray &rayOut) const override {
-			glm::vec3 reflectDir = glm::reflect(rayIn.GetDirection(), hitInfo.N);
-			reflectDir = glm::normalize(glm::normalize(reflectDir) + ((1 - m_smoothness) * RandomVec()));
-			rayOut = Ray(hitInfo.p, reflectDir);
+		bool Scatter(const Ray &rayIn, const HitInfo &hitInfo, glm::vec3 &attenuation, Ray &rayOut, float &pdf, float /*uLobe*/, const glm::vec2 &uDir) const {
+			glm::vec3 reflectDir = glm::normalize(glm::reflect(rayIn.GetDirection(), hitInfo.N));
+			rayOut = Ray(hitInfo.p, reflectDir + ((1 - m_smoothness) * RandomVec(uDir)));
 
 			attenuation = m_textureAlbedo ? m_textureAlbedo->Sample(hitInfo.u, hitInfo.v, hitInfo.p, glm::vec3(0)) : m_albedo;
+			pdf = m_smoothness < 1 ? SpherePointDirectionPdf(reflectDir, 1 - m_smoothness, rayOut.GetDirection()) : 0;
 
 			return (glm::dot(rayOut.GetDirection(), hitInfo.N) > 0);  // check if we are not reflecting inside object
 		}
 
+		// directions inside object are absorbed
+		bool Evaluate(const Ray &rayIn, const HitInfo &hitInfo, const glm::vec3 &dir, glm::vec3 &value, float &pdf) const {
+			if (m_smoothness >= 1) {
+				return false;
+			}
+
+			glm::vec3 reflectDir = glm::normalize(glm::reflect(rayIn.GetDirection(), hitInfo.N));
+			pdf = SpherePointDirectionPdf(reflectDir, 1 - m_smoothness, dir);
+
+			bool outside = glm::dot(dir, hitInfo.N) > 0;
+			value = outside ? pdf * (m_textureAlbedo ? m_textureAlbedo->Sample(hitInfo.u, hitInfo.v, hitInfo.p, glm::vec3(0)) : m_albedo) : glm::vec3(0);
+			return pdf > 0;
+		}
+
+		glm::vec3 Albedo(const HitInfo &hitInfo) const {
+			return m_textureAlbedo ? m_textureAlbedo->Sample(hitInfo.u, hitInfo.v, hitInfo.p, glm::vec3(0)) : m_albedo;
+		}
+
 	private:
 		glm::vec3       m_albedo;
 		const ITexture *m_textureAlbedo;
@@ -110,23 +217,25 @@ namespace art {
 	};
 
 
-	class Dielectric : public IMaterial {
+	class Dielectric : public MaterialBase {
 	public:
 		Dielectric(float refractionIndex, const glm::vec3 &albedo, float smoothness) :
 			m_refractionIndex(refractionIndex),
 			m_albedo(albedo),
 			m_smoothness(std::clamp(smoothness, 0.0f, 1.0f)) {}
 
-		bool Scatter(const Ray &rayIn, const HitInfo &hitInfo, glm::vec3 &attenuation, Ray &rayOut) const override {
+		// rough glass is not evaluated, so its pdf is always 0
+		bool Scatter(const Ray &rayIn, const HitInfo &hitInfo, glm::vec3 &attenuation, Ray &rayOut, float &pdf, float uLobe, const glm::vec2 &uDir) const {
+			pdf = 0;
 			float ri = hitInfo.frontFace ? (1.0 / m_refractionIndex) : m_refractionIndex;
 
 			float cosTh = std::fmin(glm::dot(-rayIn.GetDirection(), hitInfo.N), 1.0);
 			float sinTh = std::sqrt(1.0 - cosTh * cosTh);
 			bool cantRefract = ri * sinTh > 1.0;
 
-			glm::vec3 offset = (1 - m_smoothness) * RandomVec();
+			glm::vec3 offset = (1 - m_smoothness) * RandomVec(uDir);
 			glm::vec3 dir;
-			if (cantRefract || art::SchlicksReflectance(cosTh, ri) > Random()) {
+			if (cantRefract || art::SchlicksReflectance(cosTh, ri) > uLobe) {
 				dir = glm::reflect(rayIn.GetDirection(), hitInfo.N) + offset;
 				attenuation = glm::vec3(1);
 			} else {
@@ -142,6 +251,10 @@ namespace art {
 			return true;
 		}
 
+		glm::vec3 Albedo(const HitInfo & /*hitInfo*/) const {
+			return m_albedo;
+		}
+
 	private:
 
 		float     m_refractionIndex;  // in air or ratio of enclosing media (if not inside air)
@@ -149,7 +262,7 @@ namespace art {
 		float     m_smoothness;
 	};
 
-	class DiffuseLight : public IMaterial {
+	class DiffuseLight : public MaterialBase {
 	public:
 		DiffuseLight(const glm::vec3 &albedo) :
 			m_albedo(albedo),
@@ -160,13 +273,75 @@ namespace art {
 			m_textureAlbedo(albedo) {
 		}
 
-		bool Scatter(const Ray &rayIn, const HitInfo &hitInfo, glm::vec3 &attenuation, Ray &rayOut) const override {
-			attenuation = m_textureAlbedo ? m_textureAlbedo->Sample(hitInfo.u, hitInfo.v, hitInfo.p, glm::vec3(0)) : m_albedo;
+		bool Scatter(const Ray & /*rayIn*/, const HitInfo & /*hitInfo*/, glm::vec3 & /*attenuation*/, Ray & /*rayOut*/, float & /*pdf*/, float /*uLobe*/, const glm::vec2 & /*uDir*/) const {
 			return false;
 		}
 
+		glm::vec3 Emitted(const HitInfo &hitInfo) const {
+			return m_textureAlbedo ? m_textureAlbedo->Sample(hitInfo.u, hitInfo.v, hitInfo.p, glm::vec3(0)) : m_albedo;
+		}
+
+		// textures are approximated by their center
+		glm::vec3 AverageEmitted() const {
+			return m_textureAlbedo ? m_textureAlbedo->Sample(0.5f, 0.5f, glm::vec3(0), glm::vec3(0)) : m_albedo;
+		}
+
+		// emission clamped to reflectance range
+		glm::vec3 Albedo(const HitInfo &hitInfo) const {
+			return glm::min(Emitted(hitInfo), glm::vec3(1));
+		}
+
 	private:
 		glm::vec3       m_albedo;
 		const ITexture *m_textureAlbedo;
 	};
+
+
+	// closed set of materials, scene stores them by value in one contiguous table
+	// and surfaces refer to them by index, dispatch is a switch over variant index
+	class Material final {
+		using Variant = std::variant<Lambertian, Metal, Dielectric, DiffuseLight>;
+
+	public:
+		static constexpr size_t kTypeCount = std::variant_size_v<Variant>;
+
+		template<typename T>
+		Material(T mat) : m_impl(std::move(mat)) {}
+
+		bool Scatter(const Ray &rayIn, const HitInfo &hitInfo, glm::vec3 &attenuation, Ray &rayOut, float &pdf, float uLobe, const glm::vec2 &uDir) const {
+			return std::visit([&](const auto &mat) { return mat.Scatter(rayIn, hitInfo, attenuation, rayOut, pdf, uLobe, uDir); }, m_impl);
+		}
+
+		bool Evaluate(const Ray &rayIn, const HitInfo &hitInfo, const glm::vec3 &dir, glm::vec3 &value, float &pdf) const {
+			return std::visit([&](const auto &mat) { return mat.Evaluate(rayIn, hitInfo, dir, value, pdf); }, m_impl);
+		}
+
+		glm::vec3 Emitted(const HitInfo &hitInfo) const {
+			return std::visit([&](const auto &mat) { return mat.Emitted(hitInfo); }, m_impl);
+		}
+
+		glm::vec3 AverageEmitted() const {
+			return std::visit([&](const auto &mat) { return mat.AverageEmitted(); }, m_impl);
+		}
+
+		glm::vec3 Albedo(const HitInfo &hitInfo) const {
+			return std::visit([&](const auto &mat) { return mat.Albedo(hitInfo); }, m_impl);
+		}
+
+		glm::vec3 ShadingNormal(const HitInfo &hitInfo) const {
+			return std::visit([&](const auto &mat) { return mat.ShadingNormal(hitInfo); }, m_impl);
+		}
+
+		// calls func with concrete material, batches of hits with one material are dispatched once
+		template<typename Func>
+		decltype(auto) Visit(const Func &func) const {
+			return std::visit(func, m_impl);
+		}
+
+		// materials of the same type have the same index, used to sort hits by material
+		size_t GetType() const { return m_impl.index(); }
+
+	private:
+		Variant m_impl;
+	};
 }
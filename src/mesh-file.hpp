@@ -0,0 +1,219 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+#include "hittable.hpp"
+#include "wide-bvh.hpp"
+#include "mapped-file.hpp"
+
+namespace art {
+
+	// views of mesh arrays, they point either to owned vectors or to memory mapped file
+	// index arrays of normals and uvs are null if mesh doesn't have them
+	struct MeshBuffers {
+		const glm::vec3  *positions = nullptr;
+		const glm::vec3  *normals = nullptr;
+		const glm::vec2  *uvs = nullptr;
+		const glm::uvec3 *positionIndices = nullptr;
+		const glm::uvec3 *normalIndices = nullptr;
+		const glm::uvec3 *uvIndices = nullptr;
+
+		uint32_t nPositions = 0;
+		uint32_t nNormals = 0;
+		uint32_t nUVs = 0;
+		uint32_t nTriangles = 0;
+	};
+
+
+	// binary mesh file (.rmesh) is header followed by arrays in the same layout as in memory,
+	// so the file is mapped and used for rendering without parsing and copying
+	// every array starts at 64 byte boundary (wide bvh nodes are cache line aligned)
+	//
+	// header | positions | normals | uvs | position indices | normal indices | uv indices | bvh nodes
+	//
+	// arrays that mesh doesn't have are absent (offset is 0), bvh is optional too
+	// bvh of other width than the one of this build (AVX or not) is ignored and rebuilt
+	struct MeshFileHeader {
+		static constexpr char     kMagic[8] = { 'R', 'E', 'D', 'M', 'E', 'S', 'H', '\0' };
+		static constexpr uint32_t kVersion = 2;  // 2 - bvh width is stored
+		static constexpr uint32_t kAlignment = 64;
+
+		enum Section : uint32_t {
+			kPositions = 0,
+			kNormals,
+			kUVs,
+			kPositionIndices,
+			kNormalIndices,
+			kUVIndices,
+			kNodes,
+			kSectionCount
+		};
+
+		char     magic[8];
+		uint32_t version;
+		uint32_t nPositions;
+		uint32_t nNormals;
+		uint32_t nUVs;
+		uint32_t nTriangles;
+		uint32_t nNodes;           // 0 if file has no bvh
+		uint32_t bvhWidth;         // children of bvh node
+		float    boundsMin[3];     // bounds of bvh
+		float    boundsMax[3];
+		uint64_t offsets[kSectionCount];
+	};
+
+	static_assert(sizeof(glm::vec3) == 12 && sizeof(glm::vec2) == 8 && sizeof(glm::uvec3) == 12, "mesh file expects tightly packed vectors");
+
+
+	// extension of binary mesh files
+	inline const std::string kMeshFileExtension = ".rmesh";
+
+	// relative paths are searched inside meshes folder (setup by cmake)
+	inline std::string GetMeshPath(const std::string &filename) {
+		std::filesystem::path namePath(filename);  // need this to check if path is relative
+
+		if (namePath.is_relative()) {
+			#ifdef MESH_DIR
+				const char* meshDir = MESH_DIR;
+				return std::string(meshDir) + "/" + filename;
+			#endif
+		}
+		return filename;
+	}
+
+
+	// bvh nodes must reference triangles in order of buffers, nodes can be null
+	inline void WriteMeshFile(const std::string &filePath, const MeshBuffers &buffers, const WideBVHNode *nodes, uint32_t nNodes, const AABB &bounds) {
+		std::ofstream file(filePath, std::ios::binary);
+		if (!file) {
+			std::cerr << "error! can't write mesh file: " << filePath << "\n";
+			exit(1);
+		}
+
+		MeshFileHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, MeshFileHeader::kMagic, sizeof(header.magic));
+		header.version = MeshFileHeader::kVersion;
+		header.nPositions = buffers.nPositions;
+		header.nNormals = buffers.nNormals;
+		header.nUVs = buffers.nUVs;
+		header.nTriangles = buffers.nTriangles;
+		header.nNodes = nodes ? nNodes : 0;
+		header.bvhWidth = WideBVH::kWidth;
+		for (int axis = 0; axis != 3; ++axis) {
+			header.boundsMin[axis] = bounds.GetMin()[axis];
+			header.boundsMax[axis] = bounds.GetMax()[axis];
+		}
+
+		const void *data[MeshFileHeader::kSectionCount] = {
+			buffers.positions, buffers.normals, buffers.uvs,
+			buffers.positionIndices, buffers.normalIndices, buffers.uvIndices,
+			header.nNodes > 0 ? nodes : nullptr
+		};
+		const uint64_t sizes[MeshFileHeader::kSectionCount] = {
+			uint64_t(buffers.nPositions) * sizeof(glm::vec3),
+			uint64_t(buffers.nNormals) * sizeof(glm::vec3),
+			uint64_t(buffers.nUVs) * sizeof(glm::vec2),
+			uint64_t(buffers.nTriangles) * sizeof(glm::uvec3),
+			buffers.normalIndices ? uint64_t(buffers.nTriangles) * sizeof(glm::uvec3) : 0,
+			buffers.uvIndices ? uint64_t(buffers.nTriangles) * sizeof(glm::uvec3) : 0,
+			uint64_t(header.nNodes) * sizeof(WideBVHNode)
+		};
+
+		// layout is computed first, so header is written once
+		auto align = [](uint64_t offset) {
+			return (offset + MeshFileHeader::kAlignment - 1) / MeshFileHeader::kAlignment * MeshFileHeader::kAlignment;
+		};
+		uint64_t offset = align(sizeof(MeshFileHeader));
+		for (uint32_t s = 0; s != MeshFileHeader::kSectionCount; ++s) {
+			if (data[s] == nullptr || sizes[s] == 0) {
+				continue;
+			}
+			header.offsets[s] = offset;
+			offset = align(offset + sizes[s]);
+		}
+
+		const char zeros[MeshFileHeader::kAlignment] = {};
+		file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		uint64_t written = sizeof(header);
+		for (uint32_t s = 0; s != MeshFileHeader::kSectionCount; ++s) {
+			if (header.offsets[s] == 0) {
+				continue;
+			}
+			file.write(zeros, header.offsets[s] - written);
+			file.write(static_cast<const char *>(data[s]), sizes[s]);
+			written = header.offsets[s] + sizes[s];
+		}
+
+		if (!file) {
+			std::cerr << "error! failed writing mesh file: " << filePath << "\n";
+			exit(1);
+		}
+	}
+
+
+	// fills views of mapped mesh file, returns false if file is not a valid mesh file
+	// indices are not checked: it would touch every page of the file and defeat lazy loading
+	inline bool ReadMeshFile(const MappedFile &file, MeshBuffers &buffers, const WideBVHNode *&nodes, uint32_t &nNodes, AABB &bounds) {
+		if (file.GetSize() < sizeof(MeshFileHeader)) {
+			return false;
+		}
+
+		MeshFileHeader header;
+		std::memcpy(&header, file.GetData(), sizeof(header));
+		if (std::memcmp(header.magic, MeshFileHeader::kMagic, sizeof(header.magic)) != 0) {
+			return false;
+		}
+		// layout of header differs between versions, so older files can't be read
+		if (header.version != MeshFileHeader::kVersion) {
+			std::cerr << "mesh file version " << header.version << " is not supported (expected " << MeshFileHeader::kVersion << "), convert .obj again\n";
+			return false;
+		}
+
+		// checks that section fits in file and returns pointer to it
+		bool valid = true;
+		auto section = [&](MeshFileHeader::Section s, uint64_t count, uint64_t elementSize, bool required) -> const void * {
+			uint64_t offset = header.offsets[s];
+			if (offset == 0 || count == 0) {
+				valid = valid && !(required && count > 0);
+				return nullptr;
+			}
+			if (offset % MeshFileHeader::kAlignment != 0 || offset + count * elementSize > file.GetSize()) {
+				valid = false;
+				return nullptr;
+			}
+			return file.GetData() + offset;
+		};
+
+		buffers.nPositions = header.nPositions;
+		buffers.nNormals = header.nNormals;
+		buffers.nUVs = header.nUVs;
+		buffers.nTriangles = header.nTriangles;
+		buffers.positions = static_cast<const glm::vec3 *>(section(MeshFileHeader::kPositions, header.nPositions, sizeof(glm::vec3), true));
+		buffers.normals = static_cast<const glm::vec3 *>(section(MeshFileHeader::kNormals, header.nNormals, sizeof(glm::vec3), true));
+		buffers.uvs = static_cast<const glm::vec2 *>(section(MeshFileHeader::kUVs, header.nUVs, sizeof(glm::vec2), true));
+		buffers.positionIndices = static_cast<const glm::uvec3 *>(section(MeshFileHeader::kPositionIndices, header.nTriangles, sizeof(glm::uvec3), true));
+		buffers.normalIndices = static_cast<const glm::uvec3 *>(section(MeshFileHeader::kNormalIndices, header.nTriangles, sizeof(glm::uvec3), false));
+		buffers.uvIndices = static_cast<const glm::uvec3 *>(section(MeshFileHeader::kUVIndices, header.nTriangles, sizeof(glm::uvec3), false));
+
+		nNodes = header.bvhWidth == WideBVH::kWidth ? header.nNodes : 0;
+		nodes = static_cast<const WideBVHNode *>(section(MeshFileHeader::kNodes, nNodes, sizeof(WideBVHNode), true));
+		bounds = AABB(
+			glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]),
+			glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2])
+		);
+
+		// normal and uv indices are meaningless without their buffers
+		if ((buffers.normalIndices && !buffers.normals) || (buffers.uvIndices && !buffers.uvs)) {
+			valid = false;
+		}
+
+		return valid;
+	}
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "hittable.hpp"
+#include "bvh.hpp"
+#include "wide-bvh.hpp"
+#include "obj-loader.hpp"
+#include "mesh-file.hpp"
+#include "mapped-file.hpp"
+#include "timer.hpp"
+
+namespace art {
+
+	// triangle mesh with shared indexed vertex buffers
+	// triangles are not separate objects, mesh has its own bvh over them
+	// buffers are either owned by mesh or live in memory mapped binary mesh file
+	class Mesh final : public IHittable {
+	public:
+		Mesh(MeshData data, uint32_t matIndex) : m_data(std::move(data)), m_matIndex(matIndex) {
+			// index arrays are not stored if none of triangles use them
+			if (m_data.normals.empty()) {
+				m_data.normalIndices = std::vector<glm::uvec3>();
+			}
+			if (m_data.uvs.empty()) {
+				m_data.uvIndices = std::vector<glm::uvec3>();
+			}
+
+			SetOwnedBuffers();
+			Build();
+		}
+
+		// mesh is intersected directly from pages of the file
+		// if file has no bvh, it is built and only index arrays are copied to memory
+		Mesh(MappedFile file, uint32_t matIndex, const std::string &filePath) : m_file(std::move(file)), m_matIndex(matIndex) {
+			const WideBVHNode *nodes;
+			uint32_t nNodes;
+			AABB bounds;
+			if (!ReadMeshFile(m_file, m_buffers, nodes, nNodes, bounds)) {
+				std::cerr << "error! incorrect mesh file: " << filePath << "\n";
+				exit(1);
+			}
+
+			if (nodes != nullptr) {
+				m_bvh.Attach(nodes, nNodes, bounds);
+				return;
+			}
+
+			auto copy = [&](const glm::uvec3 *indices, std::vector<glm::uvec3> &target) {
+				if (indices != nullptr) {
+					target.assign(indices, indices + m_buffers.nTriangles);
+				}
+			};
+			copy(m_buffers.positionIndices, m_data.positionIndices);
+			copy(m_buffers.normalIndices, m_data.normalIndices);
+			copy(m_buffers.uvIndices, m_data.uvIndices);
+			SetOwnedIndices();
+			Build();
+		}
+
+		Mesh(const Mesh &) = delete;
+		Mesh &operator=(const Mesh &) = delete;
+
+		// writes binary mesh file with bvh, that can be mapped later
+		void Save(const std::string &filePath) const {
+			WriteMeshFile(filePath, m_buffers, m_bvh.GetNodes(), m_bvh.GetNodeCount(), m_bvh.Bounds());
+		}
+
+		bool Intersect(const Ray& r, Interval tSpan, HitRecord& rec) const override {
+			return m_bvh.Intersect(r, tSpan, [&](uint32_t index, Interval span, float &tClosest) {
+				float t, u, v;
+				if (!IntersectTriangle(r, index, span, t, u, v)) {
+					return false;
+				}
+				tClosest = t;
+				rec.t = t;
+				rec.b1 = u;
+				rec.b2 = v;
+				rec.primId = index;
+				rec.object = this;
+				rec.instance = nullptr;
+				return true;
+			});
+		}
+
+		bool Occluded(const Ray& r, Interval tSpan) const override {
+			return m_bvh.Occluded(r, tSpan, [&](uint32_t index, Interval span) {
+				float t, u, v;
+				return IntersectTriangle(r, index, span, t, u, v);
+			});
+		}
+
+		void ComputeSurfaceInteraction(const Ray& r, const HitRecord& rec, HitInfo& hitInfo) const override {
+			const uint32_t closest = rec.primId;
+			const float b1 = rec.b1;
+			const float b2 = rec.b2;
+
+			const glm::uvec3 &pi = m_buffers.positionIndices[closest];
+			const glm::vec3 &p0 = m_buffers.positions[pi.x];
+			const glm::vec3 e1 = m_buffers.positions[pi.y] - p0;
+			const glm::vec3 e2 = m_buffers.positions[pi.z] - p0;
+			const float b0 = 1.0f - b1 - b2;
+
+			hitInfo.t = rec.t;
+			hitInfo.p = p0 + b1 * e1 + b2 * e2;
+			hitInfo.matIndex = m_matIndex;
+			hitInfo.objectId = m_objectId;
+
+			// shading normal is interpolated, but side of surface is decided by geometric normal
+			glm::vec3 geomN = glm::normalize(glm::cross(e1, e2));
+			glm::vec3 shadingN = geomN;
+			if (m_buffers.normalIndices != nullptr) {
+				const glm::uvec3 &ni = m_buffers.normalIndices[closest];
+				if (ni.x != MeshData::kNoIndex && ni.y != MeshData::kNoIndex && ni.z != MeshData::kNoIndex) {
+					glm::vec3 n = b0 * m_buffers.normals[ni.x] + b1 * m_buffers.normals[ni.y] + b2 * m_buffers.normals[ni.z];
+					if (glm::dot(n, n) > 0) {
+						shadingN = glm::normalize(n);
+					}
+				}
+			}
+			hitInfo.frontFace = glm::dot(r.GetDirection(), geomN) < 0;
+			glm::vec3 faceN = hitInfo.frontFace ? geomN : -geomN;
+			hitInfo.N = glm::dot(shadingN, faceN) < 0 ? -shadingN : shadingN;
+
+			// texture coordinates, barycentrics are used if mesh has no uvs
+			glm::vec3 tangent = e1;
+			const glm::uvec3 ti = m_buffers.uvIndices != nullptr ? m_buffers.uvIndices[closest] : glm::uvec3(MeshData::kNoIndex);
+			if (ti.x != MeshData::kNoIndex && ti.y != MeshData::kNoIndex && ti.z != MeshData::kNoIndex) {
+				const glm::vec2 &uv0 = m_buffers.uvs[ti.x];
+				const glm::vec2 duv1 = m_buffers.uvs[ti.y] - uv0;
+				const glm::vec2 duv2 = m_buffers.uvs[ti.z] - uv0;
+				glm::vec2 uv = uv0 + b1 * duv1 + b2 * duv2;
+				hitInfo.u = uv.x;
+				hitInfo.v = uv.y;
+
+				// tangent points along u direction of texture (for normal maps)
+				float det = duv1.x * duv2.y - duv1.y * duv2.x;
+				if (std::fabs(det) > 1e-12f) {
+					tangent = (duv2.y * e1 - duv1.y * e2) / det;
+				}
+			} else {
+				hitInfo.u = b1;
+				hitInfo.v = b2;
+			}
+
+			// calculate tangent space for normal maps
+			tangent -= hitInfo.N * glm::dot(hitInfo.N, tangent);
+			hitInfo.T = glm::dot(tangent, tangent) > 0 ? glm::normalize(tangent) : glm::normalize(e1);
+			hitInfo.BT = glm::cross(hitInfo.N, hitInfo.T);
+		}
+
+		AABB Bounds() const override {
+			return m_bvh.Bounds();
+		}
+
+		size_t GetTriangleCount() const { return m_buffers.nTriangles; }
+
+	private:
+		// Moller-Trumbore ray-triangle intersection
+		bool IntersectTriangle(const Ray &r, uint32_t index, Interval tSpan, float &t, float &u, float &v) const {
+			const glm::uvec3 &pi = m_buffers.positionIndices[index];
+			const glm::vec3 &p0 = m_buffers.positions[pi.x];
+			const glm::vec3 e1 = m_buffers.positions[pi.y] - p0;
+			const glm::vec3 e2 = m_buffers.positions[pi.z] - p0;
+
+			glm::vec3 pvec = glm::cross(r.GetDirection(), e2);
+			float det = glm::dot(e1, pvec);
+			if (std::fabs(det) < 1e-12f) {
+				return false;
+			}
+			float invDet = 1.0f / det;
+
+			glm::vec3 tvec = r.GetOrigin() - p0;
+			u = glm::dot(tvec, pvec) * invDet;
+			if (u < 0 || u > 1) {
+				return false;
+			}
+
+			glm::vec3 qvec = glm::cross(tvec, e1);
+			v = glm::dot(r.GetDirection(), qvec) * invDet;
+			if (v < 0 || u + v > 1) {
+				return false;
+			}
+
+			t = glm::dot(e2, qvec) * invDet;
+			return tSpan.Surrounds(t);
+		}
+
+		void SetOwnedBuffers() {
+			m_buffers.positions = m_data.positions.data();
+			m_buffers.normals = m_data.normals.data();
+			m_buffers.uvs = m_data.uvs.data();
+			m_buffers.nPositions = static_cast<uint32_t>(m_data.positions.size());
+			m_buffers.nNormals = static_cast<uint32_t>(m_data.normals.size());
+			m_buffers.nUVs = static_cast<uint32_t>(m_data.uvs.size());
+			m_buffers.nTriangles = static_cast<uint32_t>(m_data.positionIndices.size());
+			SetOwnedIndices();
+		}
+
+		void SetOwnedIndices() {
+			m_buffers.positionIndices = m_data.positionIndices.data();
+			m_buffers.normalIndices = m_data.normalIndices.empty() ? nullptr : m_data.normalIndices.data();
+			m_buffers.uvIndices = m_data.uvIndices.empty() ? nullptr : m_data.uvIndices.data();
+		}
+
+		// index arrays must be owned (they are reordered), vertex arrays can be mapped
+		void Build() {
+			art::Timer timer{"BVH building (" + std::to_string(m_buffers.nTriangles) + " triangles)"};
+
+			const size_t nTriangles = m_buffers.nTriangles;
+			std::vector<AABB> bounds(nTriangles);
+			for (size_t i = 0; i != nTriangles; ++i) {
+				const glm::uvec3 &pi = m_buffers.positionIndices[i];
+				bounds[i] = AABB(m_buffers.positions[pi.x], m_buffers.positions[pi.x]);
+				bounds[i].Expand(m_buffers.positions[pi.y]);
+				bounds[i].Expand(m_buffers.positions[pi.z]);
+
+				// pad flat boxes so slab test doesn't miss axis-aligned triangles
+				glm::vec3 pad = 1e-4f * glm::vec3(glm::lessThan(bounds[i].Extent(), glm::vec3(1e-4f)));
+				bounds[i] = AABB(bounds[i].GetMin() - pad, bounds[i].GetMax() + pad);
+			}
+
+			BVH bvh;
+			bvh.Build(bounds);
+			bounds = std::vector<AABB>();
+
+			// index buffers are reordered so that bvh leaves reference contiguous ranges,
+			// vertex buffers stay untouched
+			auto reorder = [&](std::vector<glm::uvec3> &indices) {
+				if (indices.empty()) {
+					return;
+				}
+				std::vector<glm::uvec3> ordered;
+				ordered.reserve(indices.size());
+				for (uint32_t index : bvh.GetPrimIndices()) {
+					ordered.push_back(indices[index]);
+				}
+				indices = std::move(ordered);
+			};
+			reorder(m_data.positionIndices);
+			reorder(m_data.normalIndices);
+			reorder(m_data.uvIndices);
+			SetOwnedIndices();
+
+			m_bvh.Build(bvh);
+		}
+
+		MeshData    m_data;     // owned arrays, empty if they are mapped
+		MappedFile  m_file;
+		MeshBuffers m_buffers;  // arrays used for intersection
+		uint32_t    m_matIndex;
+		WideBVH     m_bvh;
+	};
+}
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <future>
+#include <thread>
+#include <filesystem>
+#include <iostream>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+namespace art {
+
+	// indexed triangle buffers shared by all triangles of a mesh
+	// every triangle corner has its own position, normal and uv index (as in OBJ)
+	struct MeshData {
+		static constexpr uint32_t kNoIndex = 0xFFFFFFFF;
+
+		std::vector<glm::vec3>  positions;
+		std::vector<glm::vec3>  normals;
+		std::vector<glm::vec2>  uvs;
+
+		std::vector<glm::uvec3> positionIndices;
+		std::vector<glm::uvec3> normalIndices;  // kNoIndex if triangle has no normals
+		std::vector<glm::uvec3> uvIndices;      // kNoIndex if triangle has no uvs
+
+		size_t GetTriangleCount() const { return positionIndices.size(); }
+	};
+
+
+	// Wavefront OBJ loader, supports v, vn, vt and f (polygons are triangulated as fans)
+	// file is split into chunks at line boundaries that are parsed in parallel
+	class OBJLoader final {
+	public:
+		static MeshData Load(const std::string &filePath) {
+			std::string text = ReadFile(filePath);
+
+			// no need in many threads for small files
+			const size_t minChunkSize = 1 << 20;
+			size_t nChunks = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), text.size() / minChunkSize));
+
+			std::vector<size_t> bounds(nChunks + 1, text.size());
+			bounds[0] = 0;
+			for (size_t i = 1; i != nChunks; ++i) {
+				size_t pos = std::max(bounds[i - 1], text.size() * i / nChunks);
+				while (pos < text.size() && text[pos - 1] != '\n') {
+					++pos;
+				}
+				bounds[i] = pos;
+			}
+
+			std::vector<Chunk> chunks(nChunks);
+			std::vector<std::future<void>> tasks;
+			for (size_t i = 1; i < nChunks; ++i) {
+				tasks.push_back(std::async(std::launch::async, [&, i]() {
+					ParseChunk(text.data() + bounds[i], text.data() + bounds[i + 1], chunks[i]);
+				}));
+			}
+			ParseChunk(text.data() + bounds[0], text.data() + bounds[1], chunks[0]);
+			for (auto &task : tasks) {
+				task.get();
+			}
+
+			return Merge(chunks, filePath);
+		}
+
+	private:
+		// indices of chunk are already zero based and absolute,
+		// except negative (relative) ones which are known only after previous chunks are counted
+		struct Chunk {
+			std::vector<glm::vec3>  positions;
+			std::vector<glm::vec3>  normals;
+			std::vector<glm::vec2>  uvs;
+			std::vector<glm::uvec3> positionIndices;
+			std::vector<glm::uvec3> normalIndices;
+			std::vector<glm::uvec3> uvIndices;
+
+			// position of relative index in (positionIndices, normalIndices, uvIndices) as
+			// 3 * triangle + corner, relative index is stored as offset from chunk start
+			std::vector<size_t> relativePositions;
+			std::vector<size_t> relativeNormals;
+			std::vector<size_t> relativeUVs;
+
+			bool error = false;
+		};
+
+		static std::string ReadFile(const std::string &filePath) {
+			std::ifstream file(filePath, std::ios::binary);
+			if (!file) {
+				std::cerr << "error! no such mesh: " << filePath << "\n";
+				exit(1);
+			}
+
+			std::string text;
+			text.resize(std::filesystem::file_size(filePath));
+			file.read(text.data(), text.size());
+			return text;
+		}
+
+		static void ParseChunk(const char *begin, const char *end, Chunk &chunk) {
+			std::vector<uint32_t> facePositions, faceNormals, faceUVs;
+			std::vector<bool>     faceRelative;
+
+			const char *c = begin;
+			while (c < end) {
+				SkipSpaces(c, end);
+
+				if (c + 1 < end && c[0] == 'v' && c[1] == ' ') {
+					c += 2;
+					glm::vec3 p;
+					p.x = ParseFloat(c, end);
+					p.y = ParseFloat(c, end);
+					p.z = ParseFloat(c, end);
+					chunk.positions.push_back(p);
+				} else if (c + 2 < end && c[0] == 'v' && c[1] == 'n' && c[2] == ' ') {
+					c += 3;
+					glm::vec3 n;
+					n.x = ParseFloat(c, end);
+					n.y = ParseFloat(c, end);
+					n.z = ParseFloat(c, end);
+					chunk.normals.push_back(n);
+				} else if (c + 2 < end && c[0] == 'v' && c[1] == 't' && c[2] == ' ') {
+					c += 3;
+					glm::vec2 uv;
+					uv.x = ParseFloat(c, end);
+					uv.y = ParseFloat(c, end);
+					chunk.uvs.push_back(uv);
+				} else if (c + 1 < end && c[0] == 'f' && c[1] == ' ') {
+					c += 2;
+					facePositions.clear();
+					faceNormals.clear();
+					faceUVs.clear();
+					faceRelative.clear();
+
+					// corner is v, v/vt, v//vn or v/vt/vn
+					SkipSpaces(c, end);
+					while (c < end && *c != '\n' && *c != '\r' && *c != '#') {
+						int64_t v = ParseInt(c, end);
+						int64_t vt = 0;
+						int64_t vn = 0;
+						if (c < end && *c == '/') {
+							++c;
+							if (c < end && *c != '/') {
+								vt = ParseInt(c, end);
+							}
+							if (c < end && *c == '/') {
+								++c;
+								vn = ParseInt(c, end);
+							}
+						}
+						if (v == 0) {
+							chunk.error = true;
+							break;
+						}
+
+						facePositions.push_back(ResolveIndex(v, chunk.positions.size()));
+						faceUVs.push_back(ResolveIndex(vt, chunk.uvs.size()));
+						faceNormals.push_back(ResolveIndex(vn, chunk.normals.size()));
+						faceRelative.push_back(v < 0);
+						faceRelative.push_back(vt < 0);
+						faceRelative.push_back(vn < 0);
+						SkipSpaces(c, end);
+					}
+
+					for (size_t i = 2; i < facePositions.size(); ++i) {
+						const size_t corners[3] = { 0, i - 1, i };
+						for (int k = 0; k != 3; ++k) {
+							size_t slot = 3 * chunk.positionIndices.size() + k;
+							if (faceRelative[3 * corners[k] + 0]) chunk.relativePositions.push_back(slot);
+							if (faceRelative[3 * corners[k] + 1]) chunk.relativeUVs.push_back(slot);
+							if (faceRelative[3 * corners[k] + 2]) chunk.relativeNormals.push_back(slot);
+						}
+						chunk.positionIndices.emplace_back(facePositions[0], facePositions[i - 1], facePositions[i]);
+						chunk.uvIndices.emplace_back(faceUVs[0], faceUVs[i - 1], faceUVs[i]);
+						chunk.normalIndices.emplace_back(faceNormals[0], faceNormals[i - 1], faceNormals[i]);
+					}
+				}
+
+				// everything else (comments, groups, materials) is ignored
+				while (c < end && *c != '\n') {
+					++c;
+				}
+				++c;
+			}
+		}
+
+		// positive indices are absolute (starting from 1), negative are relative to the last element
+		static uint32_t ResolveIndex(int64_t index, size_t localCount) {
+			if (index > 0) {
+				return static_cast<uint32_t>(index - 1);
+			} else if (index < 0) {
+				return static_cast<uint32_t>(static_cast<int64_t>(localCount) + index);
+			}
+			return MeshData::kNoIndex;
+		}
+
+		static MeshData Merge(std::vector<Chunk> &chunks, const std::string &filePath) {
+			MeshData mesh;
+
+			size_t nPositions = 0, nNormals = 0, nUVs = 0, nTriangles = 0;
+			for (const Chunk &chunk : chunks) {
+				if (chunk.error) {
+					std::cerr << "error! incorrect face in mesh: " << filePath << "\n";
+					exit(1);
+				}
+				nPositions += chunk.positions.size();
+				nNormals += chunk.normals.size();
+				nUVs += chunk.uvs.size();
+				nTriangles += chunk.positionIndices.size();
+			}
+			mesh.positions.reserve(nPositions);
+			mesh.normals.reserve(nNormals);
+			mesh.uvs.reserve(nUVs);
+			mesh.positionIndices.reserve(nTriangles);
+			mesh.normalIndices.reserve(nTriangles);
+			mesh.uvIndices.reserve(nTriangles);
+
+			for (Chunk &chunk : chunks) {
+				// relative indices become absolute when previous chunks are known
+				auto offsetRelative = [](std::vector<glm::uvec3> &indices, const std::vector<size_t> &slots, size_t offset) {
+					for (size_t slot : slots) {
+						indices[slot / 3][slot % 3] += static_cast<uint32_t>(offset);
+					}
+				};
+				offsetRelative(chunk.positionIndices, chunk.relativePositions, mesh.positions.size());
+				offsetRelative(chunk.normalIndices, chunk.relativeNormals, mesh.normals.size());
+				offsetRelative(chunk.uvIndices, chunk.relativeUVs, mesh.uvs.size());
+
+				mesh.positions.insert(mesh.positions.end(), chunk.positions.begin(), chunk.positions.end());
+				mesh.normals.insert(mesh.normals.end(), chunk.normals.begin(), chunk.normals.end());
+				mesh.uvs.insert(mesh.uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+				mesh.positionIndices.insert(mesh.positionIndices.end(), chunk.positionIndices.begin(), chunk.positionIndices.end());
+				mesh.normalIndices.insert(mesh.normalIndices.end(), chunk.normalIndices.begin(), chunk.normalIndices.end());
+				mesh.uvIndices.insert(mesh.uvIndices.end(), chunk.uvIndices.begin(), chunk.uvIndices.end());
+
+				chunk = Chunk();  // free memory early
+			}
+
+			// triangles with out of range indices would crash renderer later
+			auto checkIndices = [&](const std::vector<glm::uvec3> &indices, size_t count, bool optional) {
+				for (const glm::uvec3 &tri : indices) {
+					for (int k = 0; k != 3; ++k) {
+						if (optional && tri[k] == MeshData::kNoIndex) {
+							continue;
+						}
+						if (tri[k] >= count) {
+							std::cerr << "error! index out of range in mesh: " << filePath << "\n";
+							exit(1);
+						}
+					}
+				}
+			};
+			checkIndices(mesh.positionIndices, mesh.positions.size(), false);
+			checkIndices(mesh.normalIndices, mesh.normals.size(), true);
+			checkIndices(mesh.uvIndices, mesh.uvs.size(), true);
+
+			return mesh;
+		}
+
+		static void SkipSpaces(const char *&c, const char *end) {
+			while (c < end && (*c == ' ' || *c == '\t')) {
+				++c;
+			}
+		}
+
+		static int64_t ParseInt(const char *&c, const char *end) {
+			SkipSpaces(c, end);
+			bool negative = false;
+			if (c < end && (*c == '-' || *c == '+')) {
+				negative = *c == '-';
+				++c;
+			}
+			int64_t value = 0;
+			while (c < end && *c >= '0' && *c <= '9') {
+				value = value * 10 + (*c - '0');
+				++c;
+			}
+			return negative ? -value : value;
+		}
+
+		// std::strtof is locale dependent and several times slower
+		static float ParseFloat(const char *&c, const char *end) {
+			SkipSpaces(c, end);
+			bool negative = false;
+			if (c < end && (*c == '-' || *c == '+')) {
+				negative = *c == '-';
+				++c;
+			}
+
+			double value = 0.0;
+			while (c < end && *c >= '0' && *c <= '9') {
+				value = value * 10.0 + (*c - '0');
+				++c;
+			}
+			if (c < end && *c == '.') {
+				++c;
+				double scale = 0.1;
+				while (c < end && *c >= '0' && *c <= '9') {
+					value += (*c - '0') * scale;
+					scale *= 0.1;
+					++c;
+				}
+			}
+			if (c < end && (*c == 'e' || *c == 'E')) {
+				++c;
+				value *= std::pow(10.0, static_cast<double>(ParseInt(c, end)));
+			}
+			return static_cast<float>(negative ? -value : value);
+		}
+	};
+}
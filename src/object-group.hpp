@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <string>
+
+#include "hittable.hpp"
+#include "bvh.hpp"
+#include "wide-bvh.hpp"
+#include "timer.hpp"
+
+namespace art {
+
+	// set of objects with its own acceleration structure
+	// scene's top level objects are stored in one group,
+	// named groups are shared between instances (bottom level structures)
+	class ObjectGroup final : public IHittable {
+	public:
+		ObjectGroup() = default;
+
+		void AddObject(std::unique_ptr<IHittable> obj) {
+			m_objects.push_back(std::move(obj));
+		}
+
+		// builds acceleration structure, must be called after all objects were added
+		void Build() {
+			art::Timer timer{"BVH building (" + std::to_string(m_objects.size()) + " objects)"};
+
+			std::vector<AABB> bounds(m_objects.size());
+			for (size_t i = 0; i != m_objects.size(); ++i) {
+				bounds[i] = m_objects[i]->Bounds();
+			}
+
+			BVH bvh;
+			bvh.Build(bounds);
+
+			// reorder objects so that bvh leaves reference contiguous ranges
+			std::vector<std::unique_ptr<IHittable>> ordered;
+			ordered.reserve(m_objects.size());
+			for (uint32_t index : bvh.GetPrimIndices()) {
+				ordered.push_back(std::move(m_objects[index]));
+			}
+			m_objects = std::move(ordered);
+
+			// binary tree is only needed to build the wide one
+			m_bvh.Build(bvh);
+		}
+
+		bool Intersect(const Ray& r, Interval tSpan, HitRecord& rec) const override {
+			return m_bvh.Intersect(r, tSpan, [&](uint32_t index, Interval span, float &tClosest) {
+				if (!m_objects[index]->Intersect(r, span, rec)) {
+					return false;
+				}
+				tClosest = rec.t;
+				return true;
+			});
+		}
+
+		bool Occluded(const Ray& r, Interval tSpan) const override {
+			return m_bvh.Occluded(r, tSpan, [&](uint32_t index, Interval span) {
+				return m_objects[index]->Occluded(r, span);
+			});
+		}
+
+		void ComputeSurfaceInteraction(const Ray& r, const HitRecord& rec, HitInfo& hitInfo) const override {
+			ForwardSurfaceInteraction(r, rec, hitInfo);
+		}
+
+		AABB Bounds() const override {
+			return m_bvh.Bounds();
+		}
+
+		size_t GetObjectCount() const { return m_objects.size(); }
+
+	private:
+		std::vector<std::unique_ptr<IHittable>> m_objects;
+		WideBVH m_bvh;
+	};
+}
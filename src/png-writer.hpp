@@ -0,0 +1,519 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+namespace art {
+
+	// checksum of png chunks, crc is value for previous bytes
+	inline uint32_t Crc32(const uint8_t *data, size_t size, uint32_t crc = 0) {
+		static const std::vector<uint32_t> table = []() {
+			std::vector<uint32_t> t(256);
+			for (uint32_t n = 0; n != 256; ++n) {
+				uint32_t c = n;
+				for (int k = 0; k != 8; ++k) {
+					c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				}
+				t[n] = c;
+			}
+			return t;
+		}();
+
+		crc = ~crc;
+		for (size_t i = 0; i != size; ++i) {
+			crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		}
+		return ~crc;
+	}
+
+	// checksum of zlib stream, adler is value for previous bytes
+	inline uint32_t Adler32(const uint8_t *data, size_t size, uint32_t adler = 1) {
+		const uint32_t kBase = 65521;
+		const size_t kBlock = 5552;  // sums don't overflow in block
+
+		uint32_t s1 = adler & 0xffff;
+		uint32_t s2 = adler >> 16;
+		while (size != 0) {
+			size_t n = std::min(size, kBlock);
+			for (size_t i = 0; i != n; ++i) {
+				s1 += data[i];
+				s2 += s1;
+			}
+			s1 %= kBase;
+			s2 %= kBase;
+			data += n;
+			size -= n;
+		}
+		return (s2 << 16) | s1;
+	}
+
+
+	// deflate with fixed huffman codes and LZ77 matches found with hash chains (like stb_image_write)
+	// every call is one block that refers only to its own data, block that is not final ends with
+	// empty stored block (sync flush), so it ends at byte boundary and blocks can be concatenated
+	class Deflater final {
+	public:
+		static void Compress(const uint8_t *data, size_t size, bool final, std::vector<uint8_t> &out) {
+			const size_t start = out.size();
+			out.reserve(start + size / 2);
+			BitWriter bits{ out };
+			bits.Add(final ? 1 : 0, 1);
+			bits.Add(1, 2);  // fixed huffman codes
+
+			std::vector<int32_t> head(size_t(1) << kHashBits, -1);
+			std::vector<int32_t> prev(size);
+			auto insert = [&](size_t i) {
+				uint32_t h = Hash(data + i);
+				prev[i] = head[h];
+				head[h] = static_cast<int32_t>(i);
+			};
+
+			size_t i = 0;
+			while (i + kMinMatch <= size) {
+				uint32_t distance;
+				uint32_t length = FindMatch(data, size, i, head, prev, distance);
+				insert(i);
+
+				// lazy matching: literal is better if match at next byte is longer (long matches are kept)
+				if (length != 0 && length < kMaxLazy && i + 1 + kMinMatch <= size) {
+					uint32_t nextDistance;
+					if (FindMatch(data, size, i + 1, head, prev, nextDistance) > length) {
+						length = 0;
+					}
+				}
+
+				if (length != 0) {
+					WriteMatch(bits, length, distance);
+					for (size_t k = i + 1; k != i + length && k + kMinMatch <= size; ++k) {
+						insert(k);
+					}
+					i += length;
+				} else {
+					WriteSymbol(bits, data[i]);
+					++i;
+				}
+			}
+			for (; i != size; ++i) {
+				WriteSymbol(bits, data[i]);
+			}
+			WriteSymbol(bits, 256);  // end of block
+
+			if (!final) {
+				bits.Add(0, 3);  // stored block
+				bits.Align();
+				const uint8_t empty[4] = { 0x00, 0x00, 0xff, 0xff };  // length and its complement
+				out.insert(out.end(), empty, empty + 4);
+			}
+			bits.Align();
+
+			// noise doesn't compress, stored blocks are a bit larger than data
+			const size_t kStoredBlock = 65535;
+			if (out.size() - start > size + (size / kStoredBlock + 1) * 5) {
+				out.resize(start);
+				size_t offset = 0;
+				do {
+					size_t n = std::min(kStoredBlock, size - offset);
+					bool last = offset + n == size;
+					out.push_back(final && last ? 1 : 0);  // stored block, already at byte boundary
+					out.insert(out.end(), { uint8_t(n), uint8_t(n >> 8), uint8_t(~n), uint8_t(~n >> 8) });
+					out.insert(out.end(), data + offset, data + offset + n);
+					offset += n;
+				} while (offset != size);
+			}
+		}
+
+	private:
+		static constexpr uint32_t kHashBits = 15;
+		static constexpr uint32_t kMinMatch = 3;
+		static constexpr uint32_t kMaxMatch = 258;
+		static constexpr uint32_t kWindow = 32768;
+		static constexpr uint32_t kMaxChain = 32;  // candidates checked for every position
+		static constexpr uint32_t kMaxLazy = 32;   // matches that are not compared with match at next byte
+
+		// bits are packed starting from least significant bit of byte
+		struct BitWriter {
+			std::vector<uint8_t> &out;
+			uint32_t buffer = 0;
+			uint32_t count = 0;
+
+			void Add(uint32_t code, uint32_t nBits) {
+				buffer |= code << count;
+				count += nBits;
+				while (count >= 8) {
+					out.push_back(static_cast<uint8_t>(buffer));
+					buffer >>= 8;
+					count -= 8;
+				}
+			}
+
+			void Align() {
+				if (count != 0) {
+					Add(0, 8 - count);
+				}
+			}
+		};
+
+		static uint32_t Hash(const uint8_t *p) {
+			uint32_t v = p[0] | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16);
+			return (v * 2654435761u) >> (32 - kHashBits);
+		}
+
+		// longest earlier match of bytes at position i (0 if it is shorter than kMinMatch)
+		static uint32_t FindMatch(const uint8_t *data, size_t size, size_t i, const std::vector<int32_t> &head, const std::vector<int32_t> &prev, uint32_t &distance) {
+			const uint32_t limit = static_cast<uint32_t>(std::min<size_t>(kMaxMatch, size - i));
+			uint32_t best = 0;
+			int32_t candidate = head[Hash(data + i)];
+			for (uint32_t n = 0; candidate >= 0 && i - candidate <= kWindow && n != kMaxChain; candidate = prev[candidate], ++n) {
+				const uint8_t *a = data + candidate;
+				const uint8_t *b = data + i;
+				if (a[best] != b[best]) {
+					continue;  // can't be longer than best (the same check as in zlib)
+				}
+				uint32_t length = 0;
+				while (length != limit && a[length] == b[length]) {
+					++length;
+				}
+				if (length > best) {
+					best = length;
+					distance = static_cast<uint32_t>(i - candidate);
+					if (length == limit) {
+						break;
+					}
+				}
+			}
+			return best >= kMinMatch ? best : 0;
+		}
+
+		// huffman codes are written from most significant bit
+		static uint32_t ReverseBits(uint32_t code, uint32_t nBits) {
+			uint32_t result = 0;
+			for (uint32_t k = 0; k != nBits; ++k, code >>= 1) {
+				result = (result << 1) | (code & 1);
+			}
+			return result;
+		}
+
+		// literal, end of block or length symbol with fixed huffman code
+		static void WriteSymbol(BitWriter &bits, uint32_t symbol) {
+			// codes are reversed once, table is code in low 16 bits and its length in high bits
+			static const std::vector<uint32_t> table = []() {
+				std::vector<uint32_t> t(288);
+				for (uint32_t s = 0; s != 288; ++s) {
+					uint32_t code, nBits;
+					if (s <= 143) {
+						code = 0x30 + s, nBits = 8;
+					} else if (s <= 255) {
+						code = 0x190 + s - 144, nBits = 9;
+					} else if (s <= 279) {
+						code = s - 256, nBits = 7;
+					} else {
+						code = 0xc0 + s - 280, nBits = 8;
+					}
+					t[s] = ReverseBits(code, nBits) | (nBits << 16);
+				}
+				return t;
+			}();
+			bits.Add(table[symbol] & 0xffff, table[symbol] >> 16);
+		}
+
+		static void WriteMatch(BitWriter &bits, uint32_t length, uint32_t distance) {
+			static const uint16_t lengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 259 };
+			static const uint8_t  lengthExtra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+			static const uint16_t distanceBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577, 32769 };
+			static const uint8_t  distanceExtra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+			uint32_t j = 0;
+			while (length >= lengthBase[j + 1]) {
+				++j;
+			}
+			WriteSymbol(bits, 257 + j);
+			bits.Add(length - lengthBase[j], lengthExtra[j]);
+
+			j = 0;
+			while (distance >= distanceBase[j + 1]) {
+				++j;
+			}
+			bits.Add(ReverseBits(j, 5), 5);
+			bits.Add(distance - distanceBase[j], distanceExtra[j]);
+		}
+	};
+
+
+	// adler of concatenated data from adlers of its parts, length is size of second part (as adler32_combine of zlib)
+	inline uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, uint64_t length2) {
+		const uint32_t kBase = 65521;
+		uint32_t rem = static_cast<uint32_t>(length2 % kBase);
+		uint32_t sum1 = adler1 & 0xffff;
+		uint32_t sum2 = static_cast<uint32_t>(uint64_t(rem) * sum1 % kBase);
+		sum1 += (adler2 & 0xffff) + kBase - 1;
+		sum2 += (adler1 >> 16) + (adler2 >> 16) + kBase - rem;
+		if (sum1 >= kBase) sum1 -= kBase;
+		if (sum1 >= kBase) sum1 -= kBase;
+		if (sum2 >= (kBase << 1)) sum2 -= (kBase << 1);
+		if (sum2 >= kBase) sum2 -= kBase;
+		return (sum2 << 16) | sum1;
+	}
+
+
+	// 8-bit png that is written by bands of rows, rows are copied and compressed on threads of writer,
+	// so caller can go on rendering while finished rows are encoded
+	// every job (band of about kJobBytes) is filtered and compressed independently: its first row
+	// doesn't use filters with previous row and its deflate blocks refer only to its own data,
+	// so jobs can run in parallel and their deflate blocks are concatenated into one zlib stream,
+	// adler of stream is combined from adlers of jobs
+	// file is written in order of rows as soon as all previous rows are compressed
+	// rows that are not compressed yet take at most about kQueuedJobsPerThread jobs per thread,
+	// callers wait when encoders are behind, so memory doesn't grow if rendering is faster than deflate
+	class PngWriter final {
+	public:
+		// 0 threads means number of hardware threads
+		PngWriter(const std::string &filePath, uint32_t width, uint32_t height, uint32_t nChannels = 3, uint32_t nThreads = 0) :
+			m_file(filePath, std::ios::binary),
+			m_width(width),
+			m_height(height),
+			m_nChannels(nChannels),
+			m_nThreads(nThreads != 0 ? nThreads : std::max(1u, std::thread::hardware_concurrency()))
+		{
+			if (!m_file) {
+				std::cerr << "failed to open file for writing - " << filePath << "\n";
+				exit(1);
+			}
+			if (nChannels == 0 || nChannels > 4) {
+				std::cerr << "png can't have " << nChannels << " channels - " << filePath << "\n";
+				exit(1);
+			}
+
+			const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+			m_file.write(reinterpret_cast<const char *>(signature), 8);
+
+			const uint8_t colorTypes[4] = { 0, 4, 2, 6 };  // gray, gray with alpha, rgb, rgba
+			std::vector<uint8_t> header;
+			PushBigEndian(header, width);
+			PushBigEndian(header, height);
+			header.insert(header.end(), { 8, colorTypes[nChannels - 1], 0, 0, 0 });  // 8 bits, deflate, adaptive filters, no interlace
+			WriteChunk("IHDR", header);
+			WriteChunk("IDAT", { 0x78, 0x01 });  // zlib header: deflate with 32k window
+
+			for (uint32_t t = 0; t != m_nThreads; ++t) {
+				m_threads.emplace_back([this]() { Work(); });
+			}
+		}
+
+		~PngWriter() { Finish(); }
+
+		// rows [y0, y0 + nRows) of image, every row is width * nChannels bytes
+		// can be called from any thread and in any order of bands,
+		// returns when the last job of rows is queued (earlier jobs can be compressed by then)
+		void WriteRows(const uint8_t *rows, uint32_t y0, uint32_t nRows) {
+			const size_t rowBytes = RowBytes();
+			const uint32_t jobRows = static_cast<uint32_t>(std::max<size_t>(1, kJobBytes / rowBytes));
+			const size_t maxQueuedBytes = kQueuedJobsPerThread * m_nThreads * kJobBytes;
+			for (uint32_t r = 0; r < nRows; r += jobRows) {
+				uint32_t n = std::min(jobRows, nRows - r);
+				const uint8_t *first = rows + size_t(r) * rowBytes;
+				Job job{ y0 + r, n, std::vector<uint8_t>(first, first + size_t(n) * rowBytes) };
+				{
+					// jobs are always taken in order of queue, so waiting can't block rows that others wait for
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_jobDone.wait(lock, [&]() { return m_queuedBytes < maxQueuedBytes; });
+					m_queuedBytes += job.rows.size();
+					m_jobs.push_back(std::move(job));
+				}
+				m_jobReady.notify_one();
+			}
+		}
+
+		// waits until all rows are written and finishes zlib stream and file
+		void Finish() {
+			if (m_threads.empty()) {
+				return;
+			}
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_idle.wait(lock, [&]() { return m_jobs.empty() && m_nBusy == 0; });
+				m_stop = true;
+			}
+			m_jobReady.notify_all();
+			for (std::thread &thread : m_threads) {
+				thread.join();
+			}
+			m_threads.clear();
+
+			if (m_nextRow != m_height) {
+				std::cerr << "png is incomplete: " << m_nextRow << " of " << m_height << " rows are written\n";
+				exit(1);
+			}
+
+			std::vector<uint8_t> end;
+			Deflater::Compress(nullptr, 0, true, end);  // empty final block
+			PushBigEndian(end, m_adler);
+			WriteChunk("IDAT", end);
+			WriteChunk("IEND", {});
+			m_file.close();
+		}
+
+	private:
+		static constexpr size_t kJobBytes = 256 * 1024;  // rows of one job, smaller jobs compress worse
+		static constexpr size_t kQueuedJobsPerThread = 4;
+
+		struct Job {
+			uint32_t             y0;
+			uint32_t             nRows;
+			std::vector<uint8_t> rows;
+		};
+
+		// compressed job
+		struct Band {
+			uint32_t             nRows;
+			std::vector<uint8_t> data;    // deflate blocks ending at byte boundary
+			uint32_t             adler;   // of filtered rows
+			size_t               length;  // of filtered rows
+		};
+
+		size_t RowBytes() const { return size_t(m_width) * m_nChannels; }
+
+		void Work() {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (true) {
+				m_jobReady.wait(lock, [&]() { return m_stop || !m_jobs.empty(); });
+				if (m_jobs.empty()) {
+					return;
+				}
+				Job job = std::move(m_jobs.front());
+				m_jobs.pop_front();
+				++m_nBusy;
+
+				lock.unlock();
+				Band band = Encode(job);
+				lock.lock();
+				m_queuedBytes -= job.rows.size();
+				m_jobDone.notify_all();
+
+				// bands are written when all rows above them are written
+				m_bands.emplace(job.y0, std::move(band));
+				for (auto it = m_bands.begin(); it != m_bands.end() && it->first == m_nextRow; it = m_bands.erase(it)) {
+					WriteChunk("IDAT", it->second.data);
+					m_adler = Adler32Combine(m_adler, it->second.adler, it->second.length);
+					m_nextRow += it->second.nRows;
+				}
+
+				--m_nBusy;
+				if (m_jobs.empty() && m_nBusy == 0) {
+					m_idle.notify_all();
+				}
+			}
+		}
+
+		Band Encode(const Job &job) const {
+			const size_t rowBytes = RowBytes();
+			std::vector<uint8_t> filtered((rowBytes + 1) * job.nRows);
+			std::vector<uint8_t> candidate(rowBytes);
+			for (uint32_t r = 0; r != job.nRows; ++r) {
+				const uint8_t *row = job.rows.data() + r * rowBytes;
+				const uint8_t *prev = r == 0 ? nullptr : row - rowBytes;
+				FilterRow(row, prev, rowBytes, candidate, filtered.data() + r * (rowBytes + 1));
+			}
+
+			Band band{ job.nRows, {}, Adler32(filtered.data(), filtered.size()), filtered.size() };
+			Deflater::Compress(filtered.data(), filtered.size(), false, band.data);
+			return band;
+		}
+
+		static void PushBigEndian(std::vector<uint8_t> &out, uint32_t value) {
+			out.insert(out.end(), { uint8_t(value >> 24), uint8_t(value >> 16), uint8_t(value >> 8), uint8_t(value) });
+		}
+
+		void WriteChunk(const char *type, const std::vector<uint8_t> &data) {
+			std::vector<uint8_t> chunk;
+			PushBigEndian(chunk, static_cast<uint32_t>(data.size()));
+			chunk.insert(chunk.end(), type, type + 4);
+			chunk.insert(chunk.end(), data.begin(), data.end());
+			PushBigEndian(chunk, Crc32(chunk.data() + 4, chunk.size() - 4));  // crc of type and data
+			m_file.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+		}
+
+		// filter type byte and filtered row, filter with the smallest sum of absolute values
+		// is chosen (the same heuristic as stb_image_write), without previous row only
+		// filters that don't need it are tried
+		void FilterRow(const uint8_t *row, const uint8_t *prev, size_t rowBytes, std::vector<uint8_t> &candidate, uint8_t *out) const {
+			const size_t bpp = m_nChannels;
+			const uint8_t nTypes = prev != nullptr ? 5 : 2;
+			uint64_t bestSum = ~uint64_t(0);
+			for (uint8_t type = 0; type != nTypes; ++type) {
+				// every filter has its own loop, first pixel has no left neighbours
+				uint8_t *filtered = candidate.data();
+				size_t i = 0;
+				switch (type) {
+					case 0:
+						std::memcpy(filtered, row, rowBytes);
+						break;
+					case 1:
+						for (; i != bpp; ++i) filtered[i] = row[i];
+						for (; i != rowBytes; ++i) filtered[i] = uint8_t(row[i] - row[i - bpp]);
+						break;
+					case 2:
+						for (; i != rowBytes; ++i) filtered[i] = uint8_t(row[i] - prev[i]);
+						break;
+					case 3:
+						for (; i != bpp; ++i) filtered[i] = uint8_t(row[i] - prev[i] / 2);
+						for (; i != rowBytes; ++i) filtered[i] = uint8_t(row[i] - (row[i - bpp] + prev[i]) / 2);
+						break;
+					case 4:
+						for (; i != bpp; ++i) filtered[i] = uint8_t(row[i] - prev[i]);  // paeth of (0, b, 0) is b
+						for (; i != rowBytes; ++i) filtered[i] = uint8_t(row[i] - Paeth(row[i - bpp], prev[i], prev[i - bpp]));
+						break;
+				}
+
+				uint64_t sum = 0;
+				for (i = 0; i != rowBytes; ++i) {
+					sum += std::abs(int(int8_t(filtered[i])));
+				}
+				if (sum < bestSum) {
+					bestSum = sum;
+					out[0] = type;
+					std::memcpy(out + 1, filtered, rowBytes);
+				}
+			}
+		}
+
+		static uint8_t Paeth(int a, int b, int c) {
+			int p = a + b - c;
+			int pa = std::abs(p - a);
+			int pb = std::abs(p - b);
+			int pc = std::abs(p - c);
+			if (pa <= pb && pa <= pc) {
+				return uint8_t(a);
+			}
+			return uint8_t(pb <= pc ? b : c);
+		}
+
+		std::ofstream        m_file;
+		uint32_t             m_width;
+		uint32_t             m_height;
+		uint32_t             m_nChannels;
+		uint32_t             m_nThreads;
+
+		std::vector<std::thread> m_threads;
+		std::mutex               m_mutex;       // guards everything below and writing to file
+		std::condition_variable  m_jobReady;
+		std::condition_variable  m_jobDone;
+		std::condition_variable  m_idle;
+		std::deque<Job>          m_jobs;
+		size_t                   m_queuedBytes = 0;  // rows of jobs that are queued or being compressed
+		std::map<uint32_t, Band> m_bands;       // compressed bands waiting for rows above them, by first row
+		uint32_t                 m_nBusy = 0;   // jobs being compressed
+		uint32_t                 m_nextRow = 0; // first row that is not written to file
+		uint32_t                 m_adler = 1;   // of all filtered rows written so far
+		bool                     m_stop = false;
+	};
+}
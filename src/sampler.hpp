@@ -0,0 +1,179 @@
+#pragma once
+
+#include <variant>
+
+#include <glm/glm.hpp>
+
+#include "utils.hpp"
+
+namespace art {
+
+	// samplers give uniform numbers in [0, 1) for every dimension of one path (pixel position,
+	// lens, light choice, scattering, ...), sampler is created for every sample of pixel
+	//
+	// every sampler implements
+	//   float     Get1D()
+	//   glm::vec2 Get2D()
+
+
+	// independent random numbers (white noise), samples of pixel know nothing about each other
+	class IndependentSampler final {
+	public:
+		IndependentSampler() = default;
+
+		IndependentSampler(uint32_t pixel, uint32_t sample) : m_rng(pixel, sample) {}
+
+		float Get1D() {
+			return Random(m_rng);
+		}
+
+		glm::vec2 Get2D() {
+			float x = Random(m_rng);
+			return glm::vec2(x, Random(m_rng));
+		}
+
+	private:
+		PCG32 m_rng;
+	};
+
+
+	// padded Owen-scrambled Sobol sampler (Burley 2020, "Practical Hash-based Owen Scrambling")
+	// every 1D and 2D request is a new dimension that uses first two Sobol dimensions ((0, 2)-sequence),
+	// indices of samples are shuffled for every dimension, so dimensions are not correlated
+	// shuffle is nested uniform scrambling of index, it maps first 2^k samples to aligned block of 2^k
+	// Sobol points, so every prefix of power of two samples is well distributed and pixel can be
+	// sampled in passes without knowing final number of samples (adaptive sampling)
+	//
+	// Sobol points are computed with reversed bits (index bit k is value bit 31 - k),
+	// there Owen scrambling is a hash where every bit depends only on lower bits
+	class SobolSampler final {
+	public:
+		SobolSampler(uint32_t pixel, uint32_t sample) :
+			m_pixel(pixel),
+			m_sample(sample),
+			m_dimension(0) {}
+
+		float Get1D() {
+			uint64_t seeds = Seeds(m_dimension++);
+			uint32_t index = Shuffle(static_cast<uint32_t>(seeds));
+			return ToFloat(LaineKarras(index, static_cast<uint32_t>(seeds >> 32)));
+		}
+
+		glm::vec2 Get2D() {
+			uint64_t seeds = Seeds(m_dimension++);
+			uint32_t index = Shuffle(static_cast<uint32_t>(seeds));
+			uint32_t seedX = static_cast<uint32_t>(seeds >> 32);
+			uint32_t seedY = seedX * 0x2c1b3c6d + 0x297a2d39;
+			return glm::vec2(
+				ToFloat(LaineKarras(index, seedX)),
+				ToFloat(LaineKarras(SobolDimension1(index), seedY))
+			);
+		}
+
+	private:
+		uint64_t Seeds(uint32_t dimension) const {
+			return MixBits((uint64_t(m_pixel) << 32) | dimension);
+		}
+
+		// index of sample in dimension, every bit depends only on itself and higher bits
+		uint32_t Shuffle(uint32_t seed) const {
+			return ReverseBits(LaineKarras(ReverseBits(m_sample), seed));
+		}
+
+		// bits of second Sobol dimension in reversed order, its generator matrix is Pascal matrix mod 2:
+		// bit i of result is xor of index bits k where bits of i are subset of bits of k
+		static uint32_t SobolDimension1(uint32_t index) {
+			index ^= (index >> 1)  & 0x55555555;
+			index ^= (index >> 2)  & 0x33333333;
+			index ^= (index >> 4)  & 0x0f0f0f0f;
+			index ^= (index >> 8)  & 0x00ff00ff;
+			index ^= (index >> 16) & 0x0000ffff;
+			return index;
+		}
+
+		// bijection where every bit depends only on itself and lower bits (nested uniform scrambling)
+		static uint32_t LaineKarras(uint32_t x, uint32_t seed) {
+			x ^= x * 0x3d20adea;
+			x += seed;
+			x *= (seed >> 16) | 1;
+			x ^= x * 0x05526c56;
+			x ^= x * 0x53a22864;
+			return x;
+		}
+
+		// value with reversed bits to float in [0, 1)
+		static float ToFloat(uint32_t reversed) {
+			return (ReverseBits(reversed) >> 8) * 0x1p-24f;
+		}
+
+		static uint32_t ReverseBits(uint32_t x) {
+			x = (x << 16) | (x >> 16);
+			x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+			x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+			x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+			x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+			return x;
+		}
+
+		uint32_t m_pixel;
+		uint32_t m_sample;
+		uint32_t m_dimension;
+	};
+
+
+	enum class SamplerType {
+		Independent,
+		Sobol
+	};
+
+
+	// closed set of samplers, dispatch is a switch over variant index (like Material)
+	class Sampler final {
+		using Variant = std::variant<IndependentSampler, SobolSampler>;
+
+	public:
+		Sampler() = default;
+
+		template<typename T>
+		Sampler(T sampler) : m_impl(std::move(sampler)) {}
+
+		// sampler of one sample of pixel
+		static Sampler Create(SamplerType type, uint32_t pixel, uint32_t sample) {
+			if (type == SamplerType::Sobol) {
+				return SobolSampler(pixel, sample);
+			}
+			return IndependentSampler(pixel, sample);
+		}
+
+		float Get1D() {
+			return std::visit([](auto &sampler) { return sampler.Get1D(); }, m_impl);
+		}
+
+		glm::vec2 Get2D() {
+			return std::visit([](auto &sampler) { return sampler.Get2D(); }, m_impl);
+		}
+
+	private:
+		Variant m_impl;
+	};
+
+
+	// numbers used at one vertex of path, they are always drawn in the same order,
+	// so paths of pixel use the same dimensions of sampler at the same depth
+	struct VertexSamples {
+		float     light;     // choice of light
+		glm::vec2 lightDir;  // point on light
+		glm::vec2 skybox;    // direction of skybox sample
+		float     lobe;      // choice of lobe (specular, reflection or refraction)
+		glm::vec2 scatter;   // direction of scattering
+		float     roulette;
+
+		explicit VertexSamples(Sampler &sampler) :
+			light(sampler.Get1D()),
+			lightDir(sampler.Get2D()),
+			skybox(sampler.Get2D()),
+			lobe(sampler.Get1D()),
+			scatter(sampler.Get2D()),
+			roulette(sampler.Get1D()) {}
+	};
+}
@@ -2,15 +2,24 @@
 
 #include "yaml-cpp/yaml.h"
 
+#include <glm/gtc/matrix_transform.hpp>
+
 #include <string>
 #include <unordered_map>
 #include <map>
+#include <optional>
 
 #include "hittable.hpp"
 #include "material.hpp"
 #include "texture.hpp"
 #include "camera.hpp"
 #include "scene.hpp"
+#include "object-group.hpp"
+#include "instance.hpp"
+#include "mesh.hpp"
+#include "obj-loader.hpp"
+#include "hdr-writer.hpp"
+#include "png-writer.hpp"
 
 namespace art {
 
@@ -23,12 +32,30 @@ namespace art {
 
 			ParseSkybox(scene);
 
+			// scene needs at least one of these blocks
+			if (!m_file["instances"]) {
+				ErrorCheck(m_file, "objects");
+			}
+
 			// allocate objects and transfer ownership to scene
-			ErrorCheck(m_file, "objects");
+			// objects and then instances get ids from 1 in order of file (0 - nothing was hit)
+			uint32_t objectId = 0;
 			YAML::Node objects = m_file["objects"];
 			for (YAML::const_iterator it = objects.begin(); it != objects.end(); ++it) {
 				YAML::Node objectProperties = it->second;
-				ParseObject(objectProperties, scene);
+				std::unique_ptr<IHittable> object = ParseObject(objectProperties, scene);
+				object->SetObjectId(++objectId);
+				if (IsLight(objectProperties)) {
+					scene.AddLight(object.get());
+				}
+				scene.AddObject(std::move(object));
+			}
+
+			// instances reference groups, each group is parsed only once
+			YAML::Node instances = m_file["instances"];
+			for (YAML::const_iterator it = instances.begin(); it != instances.end(); ++it) {
+				YAML::Node instanceProperties = it->second;
+				ParseInstance(instanceProperties, scene, ++objectId);
 			}
 		}
 
@@ -41,29 +68,95 @@ namespace art {
 			ErrorCheck(camera, "position");
 			ErrorCheck(camera, "look at");
 
-			return Camera(
+			Camera result(
 				camera["samples"].as<int>(),
 				camera["bounces"].as<int>(),
 				camera["position"].as<glm::vec3>(),
 				camera["look at"].as<glm::vec3>(),
 				camera["fov"] ? camera["fov"].as<float>() : 45,
 				camera["defocus angle"] ? camera["defocus angle"].as<float>() : 0,
-				camera["focus distance"] ? camera["focus distance"].as<float>() : 1
+				camera["focus distance"] ? camera["focus distance"].as<float>() : 1,
+				camera["roulette depth"] ? camera["roulette depth"].as<int>() : 3,
+				camera["roulette threshold"] ? camera["roulette threshold"].as<float>() : 0.1
 			);
+
+			if (camera["integrator"]) {
+				std::string integrator = camera["integrator"].as<std::string>();
+				if (integrator == "wavefront") {
+					result.SetIntegrator(Integrator::Wavefront);
+				} else if (integrator != "path") {
+					std::cerr << "incorrect integrator - " << integrator << "\n";
+					exit(1);
+				}
+			}
+
+			if (camera["sampler"]) {
+				std::string sampler = camera["sampler"].as<std::string>();
+				if (sampler == "independent") {
+					result.SetSampler(SamplerType::Independent);
+				} else if (sampler != "sobol") {
+					std::cerr << "incorrect sampler - " << sampler << "\n";
+					exit(1);
+				}
+			}
+
+			// progressive rendering, samples become maximum number of samples of pixel
+			if (camera["adaptive threshold"] || camera["time limit"] || camera["target error"]) {
+				if (camera["integrator"] && camera["integrator"].as<std::string>() == "wavefront") {
+					std::cerr << "adaptive and progressive rendering are supported only by path integrator\n";
+					exit(1);
+				}
+			}
+			if (camera["adaptive threshold"]) {
+				result.SetAdaptiveThreshold(camera["adaptive threshold"].as<float>());
+			}
+			if (camera["time limit"]) {
+				result.SetTimeLimit(camera["time limit"].as<float>());
+			}
+			if (camera["target error"]) {
+				result.SetTargetError(camera["target error"].as<float>());
+			}
+			if (camera["checkpoint interval"]) {
+				result.SetCheckpointInterval(camera["checkpoint interval"].as<float>());
+			}
+
+			// output variables are listed with output image, but camera records them
+			std::vector<Aov> aovs = GetAovs();
+			if (!aovs.empty() && camera["integrator"] && camera["integrator"].as<std::string>() == "wavefront") {
+				std::cerr << "output variables are supported only by path integrator\n";
+				exit(1);
+			}
+			result.SetAovs(aovs);
+
+			return result;
 		}
 
 		std::unique_ptr<Image> GetImage() { 
+			glm::uvec2 size = GetImageSize();
+			return std::make_unique<Image>(size.x, size.y);
+		} 
+
+		glm::uvec2 GetImageSize() const {
 			ErrorCheck(m_file, "output");
 
 			YAML::Node image = m_file["output"];
 			ErrorCheck(image, "width");
 			ErrorCheck(image, "height");
 
-			return std::make_unique<Image>(
-				image["width"].as<int>(),
-				image["height"].as<int>()
-			);
-		} 
+			glm::uvec2 size(image["width"].as<uint32_t>(), image["height"].as<uint32_t>());
+			if (size.x == 0 || size.y == 0) {
+				std::cerr << "image is empty - " << size.x << "x" << size.y << "\n";
+				exit(1);
+			}
+			return size;
+		}
+
+		// finished bands of image are written to files and released, image is never in memory as a whole
+		bool IsStreaming() const {
+			ErrorCheck(m_file, "output");
+			YAML::Node output = m_file["output"];
+			return output["streaming"] && output["streaming"].as<bool>();
+		}
 
 		const std::string GetOutputFileName() const { 
 			ErrorCheck(m_file, "output");
@@ -71,6 +164,54 @@ namespace art {
 			return m_file["output"]["file name"].as<std::string>();
 		}
 
+		// linear radiance is saved next to png only if hdr format is specified
+		HdrFormat GetHdrFormat() const {
+			ErrorCheck(m_file, "output");
+			YAML::Node output = m_file["output"];
+			if (!output["hdr"]) {
+				return HdrFormat::None;
+			}
+
+			std::string format = output["hdr"].as<std::string>();
+			std::string type = output["hdr type"] ? output["hdr type"].as<std::string>() : "half";
+			if (type != "half" && type != "float") {
+				std::cerr << "incorrect hdr type - " << type << "\n";
+				exit(1);
+			}
+
+			if (format == "pfm") {
+				return HdrFormat::PFM;
+			} else if (format == "exr") {
+				return type == "half" ? HdrFormat::EXRHalf : HdrFormat::EXRFloat;
+			}
+			std::cerr << "incorrect hdr format - " << format << "\n";
+			exit(1);
+		}
+
+		// list of output variables saved next to image (see Aov)
+		std::vector<Aov> GetAovs() const {
+			ErrorCheck(m_file, "output");
+			YAML::Node output = m_file["output"];
+			std::vector<Aov> result;
+			if (!output["aovs"]) {
+				return result;
+			}
+
+			const Aov all[] = { Aov::Albedo, Aov::Normal, Aov::Depth, Aov::Position, Aov::MaterialId, Aov::ObjectId };
+			for (const YAML::Node &node : output["aovs"]) {
+				std::string name = node.as<std::string>();
+				auto it = std::find_if(std::begin(all), std::end(all), [&](Aov aov) { return name == AovName(aov); });
+				if (it == std::end(all)) {
+					std::cerr << "incorrect aov - " << name << "\n";
+					exit(1);
+				}
+				if (std::find(result.begin(), result.end(), *it) == result.end()) {
+					result.push_back(*it);
+				}
+			}
+			return result;
+		}
+
 	private:
 
 		YAML::Node OpenFile(const std::string &filename) {
@@ -95,7 +236,7 @@ namespace art {
 			return YAML::LoadFile(filePath);
 		}
 
-		void ParseObject(const YAML::Node &object, Scene &scene) {
+		std::unique_ptr<IHittable> ParseObject(const YAML::Node &object, Scene &scene) {
 
 			const std::string type = object["type"].as<std::string>();
 
@@ -104,31 +245,121 @@ namespace art {
 				ErrorCheck(object, "radius");
 				ErrorCheck(object, "material");
 
-				scene.AddObject(std::make_unique<Sphere>(
+				return std::make_unique<Sphere>(
 					object["position"].as<glm::vec3>(),
 					object["radius"].as<float>(),
 					ParseMaterial(object["material"].as<std::string>(), scene)
-				));
+				);
 			} else if (type == "quad") {
 				ErrorCheck(object, "q");
 				ErrorCheck(object, "u");
 				ErrorCheck(object, "v");
 
-				scene.AddObject(std::make_unique<Quad>(
+				return std::make_unique<Quad>(
 					object["q"].as<glm::vec3>(),
 					object["u"].as<glm::vec3>(),
 					object["v"].as<glm::vec3>(),
 					ParseMaterial(object["material"].as<std::string>(), scene),
 					object["one side"] ? object["one side"].as<bool>() : false
-				));
+				);
+			} else if (type == "mesh") {
+				ErrorCheck(object, "file name");
+				ErrorCheck(object, "material");
+
+				return LoadMesh(
+					object["file name"].as<std::string>(),
+					ParseMaterial(object["material"].as<std::string>(), scene)
+				);
 			} else {
 				std::cerr << "incorrect object type - " << object["type"].as<std::string>() << "\n";
 				exit(1);
 			}
 		}
 
-		IMaterial* ParseMaterial(std::string materialName, Scene &scene) {
-			std::unique_ptr<IMaterial> result;
+		// spheres and quads with light material are sampled directly
+		bool IsLight(const YAML::Node &object) const {
+			const std::string type = object["type"].as<std::string>();
+			if (type != "sphere" && type != "quad") {
+				return false;
+			}
+			YAML::Node material = m_file["materials"][object["material"].as<std::string>()];
+			return material["type"].as<std::string>() == "light";
+		}
+
+		std::unique_ptr<Mesh> LoadMesh(const std::string &filename, uint32_t mat) {
+			std::string filePath = GetMeshPath(filename);
+
+			if (!std::filesystem::exists(filePath)) {
+				std::cerr << "parsing error! No such mesh: " << filePath << "\n";
+				exit(1);
+			}
+
+			std::cout << "loading mesh " << filePath << "\n";
+			art::Timer timer{"Mesh loading"};
+
+			// binary meshes are mapped into memory, text ones are parsed
+			if (std::filesystem::path(filePath).extension() == kMeshFileExtension) {
+				MappedFile file;
+				if (!file.Open(filePath)) {
+					std::cerr << "parsing error! Can't map mesh: " << filePath << "\n";
+					exit(1);
+				}
+				return std::make_unique<Mesh>(std::move(file), mat, filePath);
+			}
+			return std::make_unique<Mesh>(OBJLoader::Load(filePath), mat);
+		}
+
+		void ParseInstance(const YAML::Node &instance, Scene &scene, uint32_t objectId) {
+			ErrorCheck(instance, "group");
+
+			glm::mat4 transform(1.0f);
+			if (instance["transform"]) {
+				transform = instance["transform"].as<glm::mat4>();
+			} else {
+				// transformation is applied in order: scale, rotation (x, y, z), translation
+				glm::vec3 position = instance["position"] ? instance["position"].as<glm::vec3>() : glm::vec3(0);
+				glm::vec3 rotation = instance["rotation"] ? instance["rotation"].as<glm::vec3>() : glm::vec3(0);
+				float scale = instance["scale"] ? instance["scale"].as<float>() : 1.0f;
+
+				transform = glm::translate(transform, position);
+				transform = glm::rotate(transform, glm::radians(rotation.z), glm::vec3(0, 0, 1));
+				transform = glm::rotate(transform, glm::radians(rotation.y), glm::vec3(0, 1, 0));
+				transform = glm::rotate(transform, glm::radians(rotation.x), glm::vec3(1, 0, 0));
+				transform = glm::scale(transform, glm::vec3(scale));
+			}
+
+			std::unique_ptr<Instance> object = std::make_unique<Instance>(
+				ParseGroup(instance["group"].as<std::string>(), scene),
+				transform
+			);
+			object->SetObjectId(objectId);
+			scene.AddObject(std::move(object));
+		}
+
+		const ObjectGroup* ParseGroup(std::string groupName, Scene &scene) {
+			// check if group with that name already created
+			if (m_parsedGroups.find(groupName) != m_parsedGroups.end()) {
+				return m_parsedGroups[groupName];
+			}
+
+			ErrorCheck(m_file, "groups");
+			ErrorCheck(m_file["groups"], groupName);
+			YAML::Node objects = m_file["groups"][groupName];
+
+			std::unique_ptr<ObjectGroup> group = std::make_unique<ObjectGroup>();
+			for (YAML::const_iterator it = objects.begin(); it != objects.end(); ++it) {
+				YAML::Node objectProperties = it->second;
+				group->AddObject(ParseObject(objectProperties, scene));
+			}
+			group->Build();
+
+			ObjectGroup *ptr = scene.AddGroup(std::move(group));
+			m_parsedGroups[groupName] = ptr;
+			return ptr;
+		}
+
+		uint32_t ParseMaterial(std::string materialName, Scene &scene) {
+			std::optional<Material> result;
 
 			// check if material with that name already created
 			if (m_parsedMaterials.find(materialName) != m_parsedMaterials.end()) {
@@ -145,7 +376,7 @@ namespace art {
 				ErrorCheck(material, "albedo");
 
 				if (material["albedo"].IsSequence()) {
-					result = std::make_unique<Lambertian>(
+					result = Lambertian(
 						material["albedo"].as<glm::vec3>(),
 						material["smoothness"] ? material["smoothness"].as<float>() : 0.0,
 						material["specular probability"] ? material["specular probability"].as<float>() : 0.0,
@@ -153,7 +384,7 @@ namespace art {
 						material["normal map strength"] ? material["normal map strength"].as<float>() : 1.0
 					);
 				} else {
-					result = std::make_unique<Lambertian>(
+					result = Lambertian(
 						ParseTexture(material["albedo"].as<std::string>(), scene),
 						material["smoothness"] ? material["smoothness"].as<float>() : 0.0,
 						material["specular probability"] ? material["specular probability"].as<float>() : 0.0,
@@ -166,12 +397,12 @@ namespace art {
 				ErrorCheck(material, "smoothness");
 
 				if (material["albedo"].IsSequence()) {
-					result = std::make_unique<Metal>(
+					result = Metal(
 						material["albedo"].as<glm::vec3>(),
 						material["smoothness"].as<float>()
 					);
 				} else {
-					result = std::make_unique<Metal>(
+					result = Metal(
 						ParseTexture(material["albedo"].as<std::string>(), scene),
 						material["smoothness"].as<float>()
 					);
@@ -181,7 +412,7 @@ namespace art {
 				ErrorCheck(material, "albedo");
 				ErrorCheck(material, "smoothness");
 
-				result = std::make_unique<Dielectric>(
+				result = Dielectric(
 					material["refraction index"].as<float>(),
 					material["albedo"].as<glm::vec3>(),
 					material["smoothness"].as<float>()
@@ -190,11 +421,11 @@ namespace art {
 				ErrorCheck(material, "albedo");
 
 				if (material["albedo"].IsSequence()) {
-					result = std::make_unique<DiffuseLight>(
+					result = DiffuseLight(
 						material["albedo"].as<glm::vec3>()
 					);
 				} else {
-					result = std::make_unique<DiffuseLight>(
+					result = DiffuseLight(
 						ParseTexture(material["albedo"].as<std::string>(), scene)
 					);
 				}
@@ -203,10 +434,9 @@ namespace art {
 				exit(1);
 			}
 
-			IMaterial *ptr = result.get();
-			m_parsedMaterials[materialName] = ptr;
-			scene.AddMaterial(std::move(result));
-			return ptr;
+			uint32_t index = scene.AddMaterial(std::move(*result));
+			m_parsedMaterials[materialName] = index;
+			return index;
 		}
 
 		ITexture* ParseTexture(std::string textureName, Scene &scene, bool forSkybox = false) {
@@ -303,8 +533,9 @@ namespace art {
 
 		// need these containers to check if parsed object already exists
 		// Scene object is owner of these, so we dont delete them in destructor
-		std::unordered_map<std::string, IMaterial*> m_parsedMaterials;
+		std::unordered_map<std::string, uint32_t> m_parsedMaterials;  // indices in material table of scene
 		std::unordered_map<std::string, ITexture*> m_parsedTextures;
+		std::unordered_map<std::string, ObjectGroup*> m_parsedGroups;
 	};
 
 }
@@ -332,4 +563,44 @@ namespace YAML {
 			return true;
 		}
 	};
+
+	// matrix is written row by row, as 4 rows or 16 numbers
+	template<>
+	struct convert<glm::mat4> {
+		static Node encode(const glm::mat4& rhs) {
+			Node node;
+			for (int row = 0; row != 4; ++row) {
+				for (int col = 0; col != 4; ++col) {
+					node.push_back(rhs[col][row]);
+				}
+			}
+			return node;
+		}
+
+		static bool decode(const Node& node, glm::mat4& rhs) {
+			if (!node.IsSequence()) {
+				return false;
+			}
+
+			if (node.size() == 16) {
+				for (int i = 0; i != 16; ++i) {
+					rhs[i % 4][i / 4] = node[i].as<float>();  // glm matrices are column major
+				}
+				return true;
+			}
+
+			if (node.size() != 4) {
+				return false;
+			}
+			for (int row = 0; row != 4; ++row) {
+				if (!node[row].IsSequence() || node[row].size() != 4) {
+					return false;
+				}
+				for (int col = 0; col != 4; ++col) {
+					rhs[col][row] = node[row][col].as<float>();
+				}
+			}
+			return true;
+		}
+	};
 }
\ No newline at end of file
@@ -1,27 +1,84 @@
 #pragma once
 
+#include <vector>
+
 #include "hittable.hpp"
+#include "object-group.hpp"
+#include "instance.hpp"
+#include "light-bvh.hpp"
 
 
 namespace art {
 
 	class Scene : public IHittable {
 	public:
-		Scene() : m_skyboxTextureIndex(-1), m_skyboxColor(glm::vec3(0)) {}
+		Scene() : m_skyboxTextureIndex(-1), m_skyboxColor(glm::vec3(0)), m_skyboxSampled(false), m_uniformLightSelection(false) {}
 
 		void AddObject(std::unique_ptr<IHittable> obj) {
-			m_objects.push_back(std::move(obj));
+			m_objects.AddObject(std::move(obj));
+		}
+
+		// lights are sampled directly, object must be added to scene as well
+		// only top level spheres and quads can be lights (they implement light sampling)
+		void AddLight(const IHittable *light) {
+			m_lights.push_back(light);
 		}
 
-		void AddMaterial(std::unique_ptr<IMaterial> mat) {
+		size_t GetLightCount() const { return m_lights.size(); }
+
+		// true if hit object could be chosen by light sampling
+		bool IsLight(const HitRecord &rec) const {
+			return rec.instance == nullptr && m_lightBVH.Contains(rec.object);
+		}
+
+		// chooses light for point p with surface normal n, lights that are close,
+		// powerful and facing p are chosen more often (see LightBVH)
+		bool SampleLight(const glm::vec3 &p, const glm::vec3 &n, float u, const IHittable *&light, float &pmf) const {
+			if (m_uniformLightSelection) {
+				if (m_lights.empty()) {
+					return false;
+				}
+				light = m_lights[std::min(size_t(u * m_lights.size()), m_lights.size() - 1)];
+				pmf = 1.0f / m_lights.size();
+				return true;
+			}
+			return m_lightBVH.Sample(p, n, u, light, pmf);
+		}
+
+		// probability of choosing light with SampleLight()
+		float LightPmf(const glm::vec3 &p, const glm::vec3 &n, const IHittable *light) const {
+			if (m_uniformLightSelection) {
+				return 1.0f / m_lights.size();
+			}
+			return m_lightBVH.Pmf(p, n, light);
+		}
+
+		// uniform selection is left for comparison in benchmarks
+		void SetUniformLightSelection(bool enabled) { m_uniformLightSelection = enabled; }
+
+		// scene owns groups, instances only reference them
+		ObjectGroup *AddGroup(std::unique_ptr<ObjectGroup> group) {
+			m_groups.push_back(std::move(group));
+			return m_groups.back().get();
+		}
+
+		// returns index of material, objects refer to materials by it
+		uint32_t AddMaterial(Material mat) {
 			m_materials.push_back(std::move(mat));
+			return static_cast<uint32_t>(m_materials.size() - 1);
 		}
 
+		const Material &GetMaterial(uint32_t index) const { return m_materials[index]; }
+		size_t          GetMaterialCount()         const { return m_materials.size(); }
+
 		void AddTexture(std::unique_ptr<ITexture> tex) {
 			m_textures.push_back(std::move(tex));
 		}
 
+		// distribution over luminance of skybox is built here, so bright parts
+		// of skybox (sun, windows) can be sampled directly
 		void AddSkybox(std::unique_ptr<ITexture> tex) {
+			m_skyboxSampled = tex->BuildDirectionDistribution();
 			m_textures.push_back(std::move(tex));
 			m_skyboxTextureIndex = m_textures.size() - 1;
 		}
@@ -34,29 +91,57 @@ namespace art {
 			return (m_skyboxTextureIndex != -1) ? m_textures[m_skyboxTextureIndex]->Sample(0, 0, glm::vec3(0), dir) : m_skyboxColor;
 		}
 
-		bool Hit(const Ray& r, Interval tSpan, HitInfo& hitInfo) const override {
-			HitInfo tempInfo;
-			bool hit = false;
-			float tClosest = tSpan.GetMax();
+		// true if skybox is a texture with direction distribution
+		bool IsSkyboxSampled() const { return m_skyboxSampled; }
 
-			for (const auto &object : m_objects) {
-				if (object->Hit(r, Interval(tSpan.GetMin(), tClosest), tempInfo)) {
-					hit = true;
-					tClosest = tempInfo.t;
-					hitInfo = tempInfo;
-				}
-			}
+		bool SampleSkyboxDirection(const glm::vec2 &u, glm::vec3 &dir, float &pdf) const {
+			return m_skyboxSampled && m_textures[m_skyboxTextureIndex]->SampleDirection(u, dir, pdf);
+		}
+
+		// probability density (over solid angle) of choosing dir with SampleSkyboxDirection()
+		float SkyboxPdf(const glm::vec3 &dir) const {
+			return m_skyboxSampled ? m_textures[m_skyboxTextureIndex]->DirectionPdf(dir) : 0;
+		}
+
+		// builds top level acceleration structure, must be called after all objects were added
+		void Build() {
+			m_objects.Build();
+			m_lightBVH.Build(m_lights, m_materials);
+		}
+
+		bool Intersect(const Ray& r, Interval tSpan, HitRecord& rec) const override {
+			return m_objects.Intersect(r, tSpan, rec);
+		}
 
-			return hit;
+		bool Occluded(const Ray& r, Interval tSpan) const override {
+			return m_objects.Occluded(r, tSpan);
 		}
 
+		void ComputeSurfaceInteraction(const Ray& r, const HitRecord& rec, HitInfo& hitInfo) const override {
+			ForwardSurfaceInteraction(r, rec, hitInfo);
+		}
+
+		AABB Bounds() const override {
+			return m_objects.Bounds();
+		}
+
+		size_t GetObjectCount() const { return m_objects.GetObjectCount(); }
+
 	private:
-		std::vector<std::unique_ptr<IHittable>> m_objects;
-		std::vector<std::unique_ptr<IMaterial>> m_materials;
-		std::vector<std::unique_ptr<ITexture>>  m_textures;
+		ObjectGroup m_objects;  // top level objects (instances are among them)
+
+		std::vector<const IHittable *>            m_lights;
+		LightBVH                                  m_lightBVH;
+
+		std::vector<std::unique_ptr<ObjectGroup>> m_groups;
+		std::vector<Material>                     m_materials;
+		std::vector<std::unique_ptr<ITexture>>    m_textures;
 
 		glm::vec3 m_skyboxColor;
 		int m_skyboxTextureIndex;  // if this index is -1 then skybox is solid color
+		bool m_skyboxSampled;
+
+		bool m_uniformLightSelection;
 	};
 
 }
\ No newline at end of file
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+namespace art {
+
+	// rectangle [x0, x1) x [y0, y1) of image
+	struct Tile {
+		uint32_t x0, y0;
+		uint32_t x1, y1;
+	};
+
+
+	// splits image into square tiles and renders them on its own threads
+	// every worker has deque of tiles: it takes tiles from the front of its deque and
+	// when it is empty, steals half of tiles from the back of another worker's deque,
+	// so expensive regions of image are shared between all workers until the last tile
+	class TileScheduler final {
+	public:
+		// 0 threads means number of hardware threads
+		TileScheduler(uint32_t nThreads, uint32_t tileSize) :
+			m_nThreads(nThreads != 0 ? nThreads : std::max(1u, std::thread::hardware_concurrency())),
+			m_tileSize(std::max(1u, tileSize)) {}
+
+		// calls render(tile) for every tile of image, returns when all tiles are done
+		// progress(done, total) is called after every tile (from worker thread)
+		template<typename RenderFunc, typename ProgressFunc>
+		void Run(uint32_t width, uint32_t height, const RenderFunc &render, const ProgressFunc &progress) {
+			Run(Split(width, height), render, progress);
+		}
+
+		// the same for any set of tiles (for example tiles that are not converged yet)
+		template<typename RenderFunc, typename ProgressFunc>
+		void Run(std::vector<Tile> tiles, const RenderFunc &render, const ProgressFunc &progress) {
+			m_tiles = std::move(tiles);
+
+			const uint32_t nTiles = static_cast<uint32_t>(m_tiles.size());
+			const uint32_t nWorkers = std::min(m_nThreads, std::max(nTiles, 1u));
+
+			// every worker starts with contiguous band of tiles, neighbouring tiles share cache lines of scene
+			std::vector<WorkerQueue> queues(nWorkers);
+			for (uint32_t w = 0; w != nWorkers; ++w) {
+				for (uint32_t t = uint64_t(nTiles) * w / nWorkers, te = uint64_t(nTiles) * (w + 1) / nWorkers; t != te; ++t) {
+					queues[w].tiles.push_back(t);
+				}
+			}
+
+			std::atomic<uint32_t> done(0);
+			std::atomic<uint32_t> untaken(nTiles);  // tiles moved between queues by thief are still counted
+			std::vector<double> busy(nWorkers);
+			auto start = std::chrono::steady_clock::now();
+
+			auto work = [&](uint32_t w) {
+				uint32_t t;
+				while (untaken.load() != 0) {
+					if (!Pop(queues[w], t) && !Steal(queues, w, t)) {
+						std::this_thread::yield();  // stolen tiles are not in thief's queue yet
+						continue;
+					}
+					--untaken;
+					render(m_tiles[t]);
+					progress(++done, nTiles);
+				}
+				// worker is never idle before this point, only when nothing is left to steal
+				busy[w] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			};
+
+			std::vector<std::thread> threads;
+			threads.reserve(nWorkers);
+			for (uint32_t w = 1; w < nWorkers; ++w) {
+				threads.emplace_back(work, w);
+			}
+			if (nWorkers != 0) {
+				work(0);
+			}
+			for (std::thread &thread : threads) {
+				thread.join();
+			}
+
+			double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			double sum = 0;
+			for (double b : busy) {
+				sum += b;
+			}
+			m_utilization = total > 0 && nWorkers != 0 ? sum / (total * nWorkers) : 1;
+			m_nWorkers = nWorkers;
+		}
+
+		// calls func(begin, end) for chunks of [0, count) with grain items (the last one can be shorter),
+		// chunks start at multiples of grain and are shared between workers the same way as tiles
+		template<typename Func>
+		void ParallelFor(uint32_t count, uint32_t grain, const Func &func) {
+			grain = std::max(1u, grain);
+			std::vector<Tile> chunks;
+			chunks.reserve((count + grain - 1) / grain);
+			for (uint32_t begin = 0; begin != count;) {
+				uint32_t end = begin + std::min(grain, count - begin);
+				chunks.push_back({ begin, 0, end, 1 });
+				begin = end;
+			}
+			Run(std::move(chunks), [&](const Tile &chunk) { func(chunk.x0, chunk.x1); }, [](uint32_t, uint32_t) {});
+		}
+
+		// tiles of image in scanline order
+		std::vector<Tile> Split(uint32_t width, uint32_t height) const {
+			std::vector<Tile> tiles;
+			for (uint32_t y = 0; y < height; y += m_tileSize) {
+				for (uint32_t x = 0; x < width; x += m_tileSize) {
+					tiles.push_back({ x, y, std::min(x + m_tileSize, width), std::min(y + m_tileSize, height) });
+				}
+			}
+			return tiles;
+		}
+
+		uint32_t GetTileCount()   const { return static_cast<uint32_t>(m_tiles.size()); }
+		uint32_t GetWorkerCount() const { return m_nWorkers; }
+		uint32_t GetThreadCount() const { return m_nThreads; }
+
+		// share of time workers were rendering during last run (1 - all workers finished together)
+		double GetUtilization() const { return m_utilization; }
+
+	private:
+		// aligned, so locks of different workers are not in one cache line
+		struct alignas(64) WorkerQueue {
+			std::mutex           mutex;
+			std::deque<uint32_t> tiles;
+		};
+
+		static bool Pop(WorkerQueue &queue, uint32_t &tile) {
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.tiles.empty()) {
+				return false;
+			}
+			tile = queue.tiles.front();
+			queue.tiles.pop_front();
+			return true;
+		}
+
+		// stolen tiles except the first one are added to the back of thief's queue after victim is unlocked,
+		// so empty queues don't mean that work is done (untaken counter of Run() is checked instead)
+		static bool Steal(std::vector<WorkerQueue> &queues, uint32_t thief, uint32_t &tile) {
+			const uint32_t n = static_cast<uint32_t>(queues.size());
+			std::vector<uint32_t> stolen;
+			for (uint32_t offset = 1; offset < n && stolen.empty(); ++offset) {
+				WorkerQueue &victim = queues[(thief + offset) % n];
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				size_t count = (victim.tiles.size() + 1) / 2;
+				stolen.assign(victim.tiles.end() - count, victim.tiles.end());
+				victim.tiles.erase(victim.tiles.end() - count, victim.tiles.end());
+			}
+			if (stolen.empty()) {
+				return false;
+			}
+
+			tile = stolen.front();
+			std::lock_guard<std::mutex> lock(queues[thief].mutex);
+			queues[thief].tiles.insert(queues[thief].tiles.end(), stolen.begin() + 1, stolen.end());
+			return true;
+		}
+
+		uint32_t          m_nThreads;
+		uint32_t          m_tileSize;
+		uint32_t          m_nWorkers = 0;
+		double            m_utilization = 1;
+		std::vector<Tile> m_tiles;
+	};
+}
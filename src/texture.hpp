@@ -1,7 +1,12 @@
 #pragma once
 
+#include <vector>
+#include <memory>
+
 #include "glm/glm.hpp"
 #include "image.hpp"
+#include "utils.hpp"
+#include "distribution.hpp"
 
 namespace art {
 	class ITexture {
@@ -9,9 +14,50 @@ namespace art {
 		virtual ~ITexture() = default;
 
 		virtual glm::vec3 Sample(float u, float v, const glm::vec3 &p, const glm::vec3 &dir) const = 0;
+
+		// skybox textures can be importance sampled by direction,
+		// distribution is built once and returns false if texture doesn't support it
+		// or is too uniform to benefit from it
+		virtual bool BuildDirectionDistribution() { return false; }
+
+		// direction with probability proportional to luminance chosen by u in [0, 1)^2, pdf is over solid angle
+		virtual bool SampleDirection(const glm::vec2 & /*u*/, glm::vec3 & /*dir*/, float & /*pdf*/) const { return false; }
+
+		virtual float DirectionPdf(const glm::vec3 & /*dir*/) const { return 0; }
 	};
 
 
+	// skyboxes with lower ratio of brightest part to average are not importance sampled,
+	// scattered rays already find their light and extra shadow ray only costs time
+	// (uniform sky gives about 1.6 because of solid angle weights)
+	constexpr float kMinSkyboxContrast = 8.0f;
+
+
+	// average luminance of image texels that are looked up inside cells of nu * nv grid
+	// (texel px is used for u in [px / (width - 1), (px + 1) / (width - 1)))
+	// texels partially covered by cell are counted, so cell is never empty if it has radiance
+	inline void ImageLuminanceGrid(const Image &image, uint32_t nu, uint32_t nv, float *grid) {
+		const uint32_t w = image.GetWidth() - 1;
+		const uint32_t h = image.GetHeight() - 1;
+		for (uint32_t j = 0; j != nv; ++j) {
+			uint32_t y0 = j * h / nv;
+			uint32_t y1 = std::max(y0 + 1, ((j + 1) * h + nv - 1) / nv);
+			for (uint32_t i = 0; i != nu; ++i) {
+				uint32_t x0 = i * w / nu;
+				uint32_t x1 = std::max(x0 + 1, ((i + 1) * w + nu - 1) / nu);
+
+				float sum = 0;
+				for (uint32_t y = y0; y != y1; ++y) {
+					for (uint32_t x = x0; x != x1; ++x) {
+						sum += Luminance(image.GetPixelColor(x, y));
+					}
+				}
+				grid[j * nu + i] = sum / ((x1 - x0) * (y1 - y0));
+			}
+		}
+	}
+
+
 	class SolidColorTexture : public ITexture {
 	public:
 		SolidColorTexture(const glm::vec3 &albedo) : m_albedo(albedo) {}
@@ -79,8 +125,61 @@ namespace art {
 
 		}
 
+		// distribution over (u, v) of equirectangular mapping, luminance is weighted by sin(theta)
+		// because rows near poles cover less solid angle
+		bool BuildDirectionDistribution() override {
+			if (m_image.GetWidth() < 2 || m_image.GetHeight() < 2) {
+				return false;
+			}
+
+			uint32_t nu = std::min(m_image.GetWidth() - 1, kMaxDistributionSize);
+			uint32_t nv = std::min(m_image.GetHeight() - 1, kMaxDistributionSize / 2);
+			std::vector<float> grid(nu * nv);
+			ImageLuminanceGrid(m_image, nu, nv, grid.data());
+			for (uint32_t j = 0; j != nv; ++j) {
+				float sinTheta = std::sin(art::pi * (j + 0.5f) / nv);
+				for (uint32_t i = 0; i != nu; ++i) {
+					grid[j * nu + i] *= sinTheta;
+				}
+			}
+
+			m_distribution = Distribution2D(grid.data(), nu, nv);
+			return m_distribution.MaxPdf() >= kMinSkyboxContrast;
+		}
+
+		bool SampleDirection(const glm::vec2 &u, glm::vec3 &dir, float &pdf) const override {
+			float uvPdf;
+			glm::vec2 uv = m_distribution.Sample(u, uvPdf);
+
+			// inverse of mapping in Sample()
+			float theta = art::pi * uv.y;
+			float phi = 2.0f * art::pi * uv.x - art::pi;
+			float sinTheta = std::sin(theta);
+			if (uvPdf <= 0 || sinTheta <= 0) {
+				return false;
+			}
+
+			dir = glm::vec3(sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi));
+			pdf = uvPdf / (2.0f * art::pi * art::pi * sinTheta);
+			return true;
+		}
+
+		float DirectionPdf(const glm::vec3 &dir) const override {
+			float theta = std::acos(std::clamp(dir.y, -1.0f, 1.0f));
+			float sinTheta = std::sin(theta);
+			if (sinTheta <= 0) {
+				return 0;
+			}
+
+			glm::vec2 uv((std::atan2(dir.z, dir.x) + art::pi) / (2.0f * art::pi), theta / art::pi);
+			return m_distribution.Pdf(uv) / (2.0f * art::pi * art::pi * sinTheta);
+		}
+
 	private:
-		const Image m_image;
+		static constexpr uint32_t kMaxDistributionSize = 2048;
+
+		const Image    m_image;
+		Distribution2D m_distribution;
 	};
 
 	class CubemapTexture : public ITexture {
@@ -108,7 +207,83 @@ namespace art {
 			return m_images[faceIndex]->GetPixelColor(px, py);
 		}
 
+		// faces are stacked vertically into one distribution (face f takes rows [f / 6, (f + 1) / 6)),
+		// texel on face at (a, b) in [-1, 1] covers solid angle proportional to 1 / (1 + a^2 + b^2)^1.5
+		bool BuildDirectionDistribution() override {
+			for (const auto &image : m_images) {
+				if (image->GetWidth() < 2 || image->GetHeight() < 2) {
+					return false;
+				}
+			}
+
+			uint32_t nu = std::min(m_images[0]->GetWidth() - 1, kMaxDistributionSize);
+			uint32_t nv = std::min(m_images[0]->GetHeight() - 1, kMaxDistributionSize);
+			std::vector<float> grid(6 * nu * nv);
+			for (uint32_t face = 0; face != 6; ++face) {
+				float *faceGrid = grid.data() + face * nu * nv;
+				ImageLuminanceGrid(*m_images[face], nu, nv, faceGrid);
+				for (uint32_t j = 0; j != nv; ++j) {
+					for (uint32_t i = 0; i != nu; ++i) {
+						float a = 2.0f * (i + 0.5f) / nu - 1.0f;
+						float b = 2.0f * (j + 0.5f) / nv - 1.0f;
+						float len = std::sqrt(1.0f + a * a + b * b);
+						faceGrid[j * nu + i] /= len * len * len;
+					}
+				}
+			}
+
+			m_distribution = Distribution2D(grid.data(), nu, 6 * nv);
+			return m_distribution.MaxPdf() >= kMinSkyboxContrast;
+		}
+
+		bool SampleDirection(const glm::vec2 &u, glm::vec3 &dir, float &pdf) const override {
+			float uvPdf;
+			glm::vec2 uv = m_distribution.Sample(u, uvPdf);
+			if (uvPdf <= 0) {
+				return false;
+			}
+
+			int faceIndex = std::min(static_cast<int>(uv.y * 6), 5);
+			float a = 2.0f * uv.x - 1.0f;
+			float b = 2.0f * (uv.y * 6 - faceIndex) - 1.0f;
+
+			// inverse of GetUVOnFace()
+			glm::vec3 q;
+			switch (faceIndex) {
+				case 0: q = glm::vec3( 1, -b, -a); break;
+				case 1: q = glm::vec3(-1, -b,  a); break;
+				case 2: q = glm::vec3( a,  1,  b); break;
+				case 3: q = glm::vec3( a, -1, -b); break;
+				case 4: q = glm::vec3( a, -b,  1); break;
+				case 5: q = glm::vec3(-a, -b, -1); break;
+			}
+
+			float len = glm::length(q);
+			dir = q / len;
+			pdf = FacePdfToSolidAngle(uvPdf, len);
+			return true;
+		}
+
+		float DirectionPdf(const glm::vec3 &dir) const override {
+			glm::vec3 normDir = glm::normalize(dir);
+			int faceIndex = GetFaceIndex(normDir);
+			glm::vec2 uv = GetUVOnFace(faceIndex, normDir);
+			glm::vec2 ab = 2.0f * uv - 1.0f;
+
+			float len = std::sqrt(1.0f + glm::dot(ab, ab));
+			float uvPdf = m_distribution.Pdf(glm::vec2(uv.x, (faceIndex + std::min(uv.y, 0.99999994f)) / 6.0f));
+			return FacePdfToSolidAngle(uvPdf, len);
+		}
+
 	private:
+		static constexpr uint32_t kMaxDistributionSize = 512;
+
+		// stacked (u, v) pdf -> face (u, v) is 1 / 6, face (u, v) -> (a, b) is 1 / 4,
+		// (a, b) -> solid angle is |q|^3
+		float FacePdfToSolidAngle(float uvPdf, float len) const {
+			return uvPdf * len * len * len / 24.0f;
+		}
+
 		int GetFaceIndex(const glm::vec3 &dir) const {
 			glm::vec3 absDir = glm::abs(dir);
 			float maxComponent = std::fmax(absDir.x, std::fmax(absDir.y, absDir.z));
@@ -154,6 +329,7 @@ namespace art {
 		}
 
 		std::vector<std::unique_ptr<Image>> m_images;
+		Distribution2D                      m_distribution;
 	};
 }
 
@@ -1,56 +1,80 @@
 #pragma once
 
 #include <cstdlib>
-#include <random>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+
+#include <glm/glm.hpp>
 
 namespace art {
+	const float infinity = std::numeric_limits<float>::infinity();
+	const float pi = 3.1415926;
 
-	// Generate random number in range [0, 1)
-	inline float Random() {
-		static thread_local std::mt19937 generator(std::random_device{}());
-		std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
-		return distribution(generator);
+	// mixes bits of x, so values that differ in few bits (neighbouring pixels, dimensions) become unrelated
+	inline uint64_t MixBits(uint64_t x) {
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
 	}
 
-	inline float Random(float min, float max) {
-		return min + (max - min) * Random();
-	}
+	// PCG32 generator (O'Neill, pcg-random.org): 8 bytes of state, one multiply-add per number
+	// generator is seeded by pixel and sample index (see IndependentSampler),
+	// so image doesn't depend on which thread rendered which pixel
+	class PCG32 final {
+	public:
+		explicit PCG32(uint64_t seed = 0) : m_state(0) {
+			Next();
+			m_state += MixBits(seed);
+			Next();
+		}
+
+		PCG32(uint32_t pixel, uint32_t sample) : PCG32((uint64_t(pixel) << 32) | sample) {}
+
+		uint32_t Next() {
+			uint64_t old = m_state;
+			m_state = old * 6364136223846793005ULL + kIncrement;
+			uint32_t xorShifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+			uint32_t rot = static_cast<uint32_t>(old >> 59u);
+			return (xorShifted >> rot) | (xorShifted << ((32 - rot) & 31));
+		}
+
+		// float in [0, 1) with 24 random bits
+		float NextFloat() {
+			return (Next() >> 8) * 0x1p-24f;
+		}
+
+	private:
+		static constexpr uint64_t kIncrement = 1442695040888963407ULL;
+
+		uint64_t m_state;
+	};
 
-	// Returns random point in the [-0.5, -0.5]-[0.5, 0.5] unit square.
-	inline glm::vec2 RandomInSquare() {
-		return glm::vec2(art::Random() - 0.5, art::Random() - 0.5);
+	// Generate random number in range [0, 1)
+	inline float Random(PCG32 &rng) {
+		return rng.NextFloat();
 	}
 
-	// Random value from normal distribution (range is infinite)
-	float RandomNormalDistribution() {
-		float theta = 2 * art::pi * Random();
-		float rho = std::sqrt(-2 * std::log(Random()));
-		return rho * std::cos(theta);
+	inline float Random(float min, float max, PCG32 &rng) {
+		return min + (max - min) * Random(rng);
 	}
 
-	// Returns vector to a random point in the stratified region of unit square
-	glm::vec2 RandomInStratifiedSquare(uint32_t s_i, uint32_t s_j, float regionSize) {
-		return glm::vec2(
-			((s_i + Random()) * regionSize) - 0.5,
-			((s_j + Random()) * regionSize) - 0.5
-		);
+	// uniform point on unit sphere for u in [0, 1)^2
+	inline glm::vec3 RandomVec(const glm::vec2 &u) {
+		float z = 1 - 2 * u.x;
+		float r = std::sqrt(std::max(0.0f, 1 - z * z));
+		float phi = 2 * pi * u.y;
+		return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
 	}
 
 	// Get random unit vector
-	// this funcion uses simple rejection sampling
-	// i tried Gaussian distribution but it was slower
-	glm::vec3 RandomVec() {
-		while (true) {
-			glm::vec3 v = glm::vec3(Random(-1, 1), Random(-1, 1), Random(-1, 1));
-			float lensq = glm::dot(v, v);
-			if (1e-160 < lensq && lensq <= 1) {
-				return v / std::sqrt(lensq);
-			}
-		}
+	inline glm::vec3 RandomVec(PCG32 &rng) {
+		float x = Random(rng);
+		return RandomVec(glm::vec2(x, Random(rng)));
 	}
 
-	glm::vec3 RandomOnHemisphere(const glm::vec3 &N) {
-		glm::vec3 v = RandomVec();
+	inline glm::vec3 RandomOnHemisphere(const glm::vec3 &N, PCG32 &rng) {
+		glm::vec3 v = RandomVec(rng);
 		if (glm::dot(v, N) > 0.0) {
 			return v;
 		} else {
@@ -58,12 +82,11 @@ namespace art {
 		}
 	}
 
-	glm::vec3 RandomOnDisk() {
-		while (true) {
-			auto p = glm::vec3(Random(-1, 1), Random(-1, 1), 0);
-			if (glm::dot(p, p) < 1)
-				return p;
-		}
+	// uniform point inside unit disk (z = 0) for u in [0, 1)^2
+	inline glm::vec3 RandomOnDisk(const glm::vec2 &u) {
+		float r = std::sqrt(u.x);
+		float phi = 2 * pi * u.y;
+		return glm::vec3(r * std::cos(phi), r * std::sin(phi), 0);
 	}
 
 	bool VecNearZero(const glm::vec3& v) {
@@ -76,4 +99,32 @@ namespace art {
 		r0 = r0 * r0;
 		return r0 + (1 - r0) * std::pow((1 - cos), 5);
 	}
-}
\ No newline at end of file
+
+	// direction inside cone around unit axis (uniform in solid angle) for u in [0, 1)^2
+	inline glm::vec3 RandomInCone(const glm::vec3 &axis, float cosThetaMax, const glm::vec2 &u) {
+		float cosTheta = 1 + u.x * (cosThetaMax - 1);
+		float sinTheta = std::sqrt(std::max(0.0f, 1 - cosTheta * cosTheta));
+		float phi = 2 * pi * u.y;
+
+		// orthonormal basis around axis (Duff et al. 2017)
+		float sign = std::copysign(1.0f, axis.z);
+		float a = -1.0f / (sign + axis.z);
+		float b = axis.x * axis.y * a;
+		glm::vec3 t(1 + sign * axis.x * axis.x * a, sign * b, -sign * axis.x);
+		glm::vec3 bt(b, sign + axis.y * axis.y * a, -axis.y);
+
+		return sinTheta * std::cos(phi) * t + sinTheta * std::sin(phi) * bt + cosTheta * axis;
+	}
+
+	// relative luminance of linear rgb color
+	inline float Luminance(const glm::vec3 &color) {
+		return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+	}
+
+	// weight of sample from strategy A when strategy B could produce it too
+	inline float PowerHeuristic(float pdfA, float pdfB) {
+		float a = pdfA * pdfA;
+		float b = pdfB * pdfB;
+		return (a + b) > 0 ? a / (a + b) : 0;
+	}
+}
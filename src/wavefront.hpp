@@ -0,0 +1,402 @@
+#pragma once
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "hittable.hpp"
+#include "material.hpp"
+#include "scene.hpp"
+#include "direct-light.hpp"
+#include "sampler.hpp"
+#include "scheduler.hpp"
+#include "utils.hpp"
+
+namespace art {
+
+	// wavefront path tracer: paths of a wave are advanced one bounce at a time by separate kernels,
+	// every kernel runs on threads of tile scheduler over chunks of paths that are still alive
+	//
+	// extend  - closest hit of path rays, surface data of hits, skybox for missed rays
+	// compact - finished paths leave the wave, the rest are moved together and sorted by material
+	// shade   - emission, light and skybox sampling (shadow rays are only generated), scattering, roulette,
+	//           runs separately for every material on its range of sorted paths
+	// shadow  - occlusion of generated shadow rays, visible ones add their contribution
+	//
+	// estimate is the same as in Camera::RayColor(), only order of work differs:
+	// every kernel touches one kind of data (bvh, materials, textures), so caches stay warm
+	// and batches are coherent
+	class WavefrontIntegrator final {
+	public:
+		// 0 threads means number of hardware threads
+		WavefrontIntegrator(uint32_t maxDepth, uint32_t rouletteDepth, float rouletteThreshold, bool lightSampling, uint32_t nThreads) :
+			m_maxDepth(maxDepth),
+			m_rouletteDepth(rouletteDepth),
+			m_rouletteThreshold(rouletteThreshold),
+			m_lightSampling(lightSampling),
+			m_scheduler(nThreads, kChunkSize) {}
+
+		// traces nSamples paths for every pixel, rayGen(i, j, sample, sampler) creates sampler of path and returns camera ray,
+		// pixels receive average radiance (row by row)
+		template<typename RayGen>
+		void Render(uint32_t width, uint32_t height, uint32_t nSamples, const RayGen &rayGen, const Scene &scene, std::vector<glm::vec3> &pixels) {
+			pixels.assign(size_t(width) * height, glm::vec3(0));
+			const uint64_t nPaths = uint64_t(width) * height * nSamples;
+			const uint32_t waveSize = static_cast<uint32_t>(std::min<uint64_t>(nPaths, kMaxWaveSize));
+			Allocate(waveSize);
+			SetupMaterialOrder(scene);
+
+			// paths of one wave are consecutive samples of neighbouring pixels
+			const uint64_t nWaves = (nPaths + waveSize - 1) / waveSize;
+			for (uint64_t wave = 0; wave != nWaves; ++wave) {
+				const uint64_t first = wave * waveSize;
+				m_count = static_cast<uint32_t>(std::min<uint64_t>(waveSize, nPaths - first));
+				const uint32_t waveCount = m_count;
+
+				ForEachPath([&](uint32_t path) {
+					uint64_t index = first + path;
+					uint32_t pixel = static_cast<uint32_t>(index / nSamples);
+					uint32_t sample = static_cast<uint32_t>(index % nSamples);
+					Ray ray = rayGen(pixel % width, pixel / width, sample, m_paths.sampler[path]);
+
+					m_paths.origin[path] = ray.GetOrigin();
+					m_paths.direction[path] = ray.GetDirection();
+					m_paths.throughput[path] = glm::vec3(1);
+					m_paths.radiance[path] = glm::vec3(0);
+					m_paths.scatterPdf[path] = 0;
+					m_paths.scatterN[path] = glm::vec3(0);
+					m_paths.id[path] = path;
+					m_paths.alive[path] = true;
+				});
+
+				for (uint32_t depth = 0; depth != m_maxDepth && m_count != 0; ++depth) {
+					Extend(scene);
+					Compact();
+					Shade(scene, depth);
+					TraceShadowRays(scene);
+				}
+
+				// paths that reached max depth
+				ForEachPath([&](uint32_t path) {
+					m_results[m_paths.id[path]] = m_paths.radiance[path];
+				});
+
+				// samples of one pixel are neighbours in wave
+				for (uint32_t id = 0; id != waveCount; ++id) {
+					pixels[(first + id) / nSamples] += m_results[id];
+				}
+
+				// percent is printed only when it changes (as progress of tiles)
+				const uint64_t done = wave + 1;
+				if (done * 100 / nWaves != wave * 100 / nWaves) {
+					std::stringstream msg;
+					msg << "\tProgress: " << done * 100 / nWaves << "%\n";
+					std::cout << msg.str();
+				}
+			}
+
+			for (glm::vec3 &pixel : pixels) {
+				pixel /= float(nSamples);
+			}
+		}
+
+	private:
+		// every path of wave occupies one slot in these arrays, alive paths are always at the beginning
+		struct PathStates {
+			std::vector<glm::vec3> origin;
+			std::vector<glm::vec3> direction;
+			std::vector<glm::vec3> throughput;
+			std::vector<glm::vec3> radiance;
+			std::vector<float>     scatterPdf;  // pdf of ray direction, 0 for camera ray and perfect reflections
+			std::vector<glm::vec3> scatterN;    // normal at origin of ray, light selection depends on it
+			std::vector<uint32_t>  id;          // slot of path at the start of wave, radiance is written there
+			std::vector<uint8_t>   alive;       // false if path was absorbed or terminated in shade kernel
+			std::vector<Sampler>   sampler;     // the same numbers as path integrator uses for this sample
+
+			// results of extend kernel, materials take surface data as one struct
+			std::vector<HitInfo>   info;
+			std::vector<float>     emissionWeight;  // MIS weight of emission at hit
+			std::vector<uint8_t>   hit;
+
+			void Resize(size_t size) {
+				origin.resize(size);
+				direction.resize(size);
+				throughput.resize(size);
+				radiance.resize(size);
+				scatterPdf.resize(size);
+				scatterN.resize(size);
+				id.resize(size);
+				alive.resize(size);
+				sampler.resize(size);
+				info.resize(size);
+				emissionWeight.resize(size);
+				hit.resize(size);
+			}
+
+			// hit flag is not copied, compacted paths are hits
+			void CopyTo(PathStates &to, uint32_t toIndex, uint32_t fromIndex) const {
+				to.origin[toIndex] = origin[fromIndex];
+				to.direction[toIndex] = direction[fromIndex];
+				to.throughput[toIndex] = throughput[fromIndex];
+				to.radiance[toIndex] = radiance[fromIndex];
+				to.scatterPdf[toIndex] = scatterPdf[fromIndex];
+				to.scatterN[toIndex] = scatterN[fromIndex];
+				to.id[toIndex] = id[fromIndex];
+				to.alive[toIndex] = alive[fromIndex];
+				to.sampler[toIndex] = sampler[fromIndex];
+				to.info[toIndex] = info[fromIndex];
+				to.emissionWeight[toIndex] = emissionWeight[fromIndex];
+			}
+		};
+
+		// every path has two slots for shadow rays (light and skybox)
+		struct ShadowStates {
+			std::vector<glm::vec3> origin;
+			std::vector<glm::vec3> direction;
+			std::vector<float>     tMax;
+			std::vector<glm::vec3> contribution;  // multiplied by throughput, zero if slot is unused
+		};
+
+		// range of sorted paths that hit one material
+		struct ShadeBatch {
+			uint32_t begin, end;
+			uint32_t material;
+		};
+
+		void Allocate(uint32_t waveSize) {
+			m_paths.Resize(waveSize);
+			m_compacted.Resize(waveSize);
+
+			m_shadows.origin.resize(2 * size_t(waveSize));
+			m_shadows.direction.resize(2 * size_t(waveSize));
+			m_shadows.tMax.resize(2 * size_t(waveSize));
+			m_shadows.contribution.resize(2 * size_t(waveSize));
+
+			m_results.resize(waveSize);
+		}
+
+		// materials of the same type get neighbouring keys, so shade kernel runs
+		// the same code for long stretches of paths
+		void SetupMaterialOrder(const Scene &scene) {
+			std::vector<uint32_t> order(scene.GetMaterialCount());
+			std::iota(order.begin(), order.end(), 0);
+			std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+				return scene.GetMaterial(a).GetType() < scene.GetMaterial(b).GetType();
+			});
+
+			m_materialKey.resize(order.size());
+			for (uint32_t key = 0; key != order.size(); ++key) {
+				m_materialKey[order[key]] = key;
+			}
+			m_keyMaterial = std::move(order);
+		}
+
+		// runs func(begin, end) in parallel for chunks of paths [0, count), chunk starts at multiple of kChunkSize
+		template<typename Func>
+		void ForEachChunk(const Func &func) {
+			m_scheduler.ParallelFor(m_count, kChunkSize, func);
+		}
+
+		// runs func(path) in parallel for paths [0, count)
+		template<typename Func>
+		void ForEachPath(const Func &func) {
+			ForEachChunk([&](uint32_t begin, uint32_t end) {
+				for (uint32_t path = begin; path != end; ++path) {
+					func(path);
+				}
+			});
+		}
+
+		void Extend(const Scene &scene) {
+			ForEachPath([&](uint32_t path) {
+				m_paths.hit[path] = false;
+				if (!m_paths.alive[path]) {
+					return;
+				}
+
+				Ray ray(m_paths.origin[path], m_paths.direction[path]);
+				HitRecord rec;
+				if (!scene.Intersect(ray, Interval(0.001, infinity), rec)) {
+					float weight = m_lightSampling ? SkyboxWeight(ray, m_paths.scatterPdf[path], scene) : 1;
+					m_paths.radiance[path] += m_paths.throughput[path] * scene.SampleSkybox(ray.GetDirection()) * weight;
+					return;
+				}
+
+				scene.ComputeSurfaceInteraction(ray, rec, m_paths.info[path]);
+				m_paths.emissionWeight[path] = m_lightSampling ? EmissionWeight(ray, rec, m_paths.scatterPdf[path], m_paths.scatterN[path], scene) : 1;
+				m_paths.hit[path] = true;
+			});
+		}
+
+		// counting sort of hit paths by material key, states are moved (not only indices),
+		// so following kernels read arrays in order
+		// every chunk counts its keys, prefix sum over keys and then chunks gives every chunk
+		// its own place for every key, so chunks are scattered in parallel and sort is stable
+		// finished paths write radiance to their slot of wave, so samples of one pixel don't race
+		void Compact() {
+			const uint32_t nKeys = static_cast<uint32_t>(m_materialKey.size());
+			const uint32_t nChunks = (m_count + kChunkSize - 1) / kChunkSize;
+			m_chunkOffsets.assign(size_t(nChunks) * nKeys, 0);
+
+			ForEachChunk([&](uint32_t begin, uint32_t end) {
+				uint32_t *counts = m_chunkOffsets.data() + size_t(begin / kChunkSize) * nKeys;
+				for (uint32_t path = begin; path != end; ++path) {
+					if (m_paths.hit[path]) {
+						++counts[m_materialKey[m_paths.info[path].matIndex]];
+					} else {
+						m_results[m_paths.id[path]] = m_paths.radiance[path];
+					}
+				}
+			});
+
+			m_counts.resize(nKeys + 1);
+			uint32_t offset = 0;
+			for (uint32_t key = 0; key != nKeys; ++key) {
+				m_counts[key] = offset;
+				for (uint32_t chunk = 0; chunk != nChunks; ++chunk) {
+					uint32_t &count = m_chunkOffsets[size_t(chunk) * nKeys + key];
+					uint32_t n = count;
+					count = offset;
+					offset += n;
+				}
+			}
+			m_counts[nKeys] = offset;
+
+			ForEachChunk([&](uint32_t begin, uint32_t end) {
+				uint32_t *offsets = m_chunkOffsets.data() + size_t(begin / kChunkSize) * nKeys;
+				for (uint32_t path = begin; path != end; ++path) {
+					if (m_paths.hit[path]) {
+						m_paths.CopyTo(m_compacted, offsets[m_materialKey[m_paths.info[path].matIndex]]++, path);
+					}
+				}
+			});
+
+			m_count = offset;
+			std::swap(m_paths, m_compacted);
+		}
+
+		// range of every material is split into batches, batch calls concrete material directly
+		void Shade(const Scene &scene, uint32_t depth) {
+			const bool sampleLights = m_lightSampling && depth + 1 != m_maxDepth;
+
+			m_batches.clear();
+			for (uint32_t key = 0; key + 1 < m_counts.size(); ++key) {
+				for (uint32_t begin = m_counts[key]; begin != m_counts[key + 1];) {
+					uint32_t end = begin + std::min(kChunkSize, m_counts[key + 1] - begin);
+					m_batches.push_back({ begin, end, m_keyMaterial[key] });
+					begin = end;
+				}
+			}
+
+			m_scheduler.ParallelFor(static_cast<uint32_t>(m_batches.size()), 1, [&](uint32_t first, uint32_t last) {
+				for (uint32_t b = first; b != last; ++b) {
+					const ShadeBatch &batch = m_batches[b];
+					scene.GetMaterial(batch.material).Visit([&](const auto &mat) {
+						ShadePaths(mat, batch.begin, batch.end, scene, depth, sampleLights);
+					});
+				}
+			});
+		}
+
+		template<typename MaterialType>
+		void ShadePaths(const MaterialType &mat, uint32_t begin, uint32_t end, const Scene &scene, uint32_t depth, bool sampleLights) {
+			for (uint32_t path = begin; path != end; ++path) {
+				m_shadows.contribution[2 * path] = glm::vec3(0);
+				m_shadows.contribution[2 * path + 1] = glm::vec3(0);
+
+				const HitInfo &info = m_paths.info[path];
+				Ray ray(m_paths.origin[path], m_paths.direction[path]);
+				glm::vec3 throughput = m_paths.throughput[path];
+				VertexSamples u(m_paths.sampler[path]);
+
+				glm::vec3 emitted = mat.Emitted(info);
+				if (emitted != glm::vec3(0)) {
+					m_paths.radiance[path] += throughput * emitted * m_paths.emissionWeight[path];
+				}
+
+				// light is not sampled at last vertex, scattered ray wouldn't reach it either
+				if (sampleLights) {
+					ShadowRay shadow;
+					if (scene.GetLightCount() != 0 && SampleLight(ray, info, scene, u.light, u.lightDir, shadow)) {
+						PushShadowRay(2 * path, shadow, throughput);
+					}
+					if (scene.IsSkyboxSampled() && SampleSkybox(ray, info, scene, u.skybox, shadow)) {
+						PushShadowRay(2 * path + 1, shadow, throughput);
+					}
+				}
+
+				Ray rayOut;
+				glm::vec3 attenuation;
+				m_paths.alive[path] = false;
+				if (!mat.Scatter(ray, info, attenuation, rayOut, m_paths.scatterPdf[path], u.lobe, u.scatter)) {
+					continue;
+				}
+
+				throughput *= attenuation;
+				if (depth + 1 >= m_rouletteDepth) {
+					float survival = std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)) / m_rouletteThreshold, 1.0f);
+					if (u.roulette >= survival) {
+						continue;
+					}
+					throughput /= survival;
+				}
+
+				m_paths.origin[path] = rayOut.GetOrigin();
+				m_paths.direction[path] = rayOut.GetDirection();
+				m_paths.throughput[path] = throughput;
+				m_paths.scatterN[path] = info.N;
+				m_paths.alive[path] = true;
+			}
+		}
+
+		void PushShadowRay(uint32_t slot, const ShadowRay &shadow, const glm::vec3 &throughput) {
+			m_shadows.origin[slot] = shadow.ray.GetOrigin();
+			m_shadows.direction[slot] = shadow.ray.GetDirection();
+			m_shadows.tMax[slot] = shadow.tMax;
+			m_shadows.contribution[slot] = throughput * shadow.contribution;
+		}
+
+		// only used slots are traced, both slots of path are in one chunk, so radiance doesn't race
+		void TraceShadowRays(const Scene &scene) {
+			ForEachPath([&](uint32_t path) {
+				for (uint32_t slot = 2 * path; slot != 2 * path + 2; ++slot) {
+					if (m_shadows.contribution[slot] == glm::vec3(0)) {
+						continue;
+					}
+					Ray ray(m_shadows.origin[slot], m_shadows.direction[slot]);
+					if (!scene.Occluded(ray, Interval(0.001, m_shadows.tMax[slot]))) {
+						m_paths.radiance[path] += m_shadows.contribution[slot];
+					}
+				}
+			});
+		}
+
+		// 16K paths, about 7 MB of path and shadow states, so states of wave mostly stay in cache between kernels
+		static constexpr uint32_t kMaxWaveSize = 1 << 14;
+		// paths in one task of kernel and in one batch of shade kernel
+		static constexpr uint32_t kChunkSize = 256;
+
+		uint32_t m_maxDepth;
+		uint32_t m_rouletteDepth;
+		float    m_rouletteThreshold;
+		bool     m_lightSampling;
+
+		TileScheduler m_scheduler;
+
+		PathStates   m_paths;
+		PathStates   m_compacted;  // target of compaction, swapped with paths
+		ShadowStates m_shadows;
+		uint32_t     m_count = 0;  // number of paths in wave that are not finished
+
+		std::vector<glm::vec3>  m_results;       // radiance of finished paths by slot at the start of wave
+		std::vector<uint32_t>   m_materialKey;   // sort key of every material in scene
+		std::vector<uint32_t>   m_keyMaterial;   // material of every sort key
+		std::vector<uint32_t>   m_counts;        // first sorted path of every key (and count of paths at the end)
+		std::vector<uint32_t>   m_chunkOffsets;  // counts and then scatter offsets of every chunk and key
+		std::vector<ShadeBatch> m_batches;
+	};
+}
@@ -0,0 +1,424 @@
+#pragma once
+
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define ART_USE_SSE 1
+	#include <emmintrin.h>
+#else
+	#define ART_USE_SSE 0
+#endif
+
+// 8-wide nodes need AVX (-mavx or /arch:AVX, see REDEYE_AVX option of cmake)
+#if defined(__AVX__)
+	#define ART_USE_AVX 1
+	#include <immintrin.h>
+#else
+	#define ART_USE_AVX 0
+#endif
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+#include "hittable.hpp"
+#include "bvh.hpp"
+
+namespace art {
+
+	// children of wide node: 8 with AVX, 4 otherwise
+	constexpr uint32_t kWideBVHWidth = ART_USE_AVX ? 8 : 4;
+
+	// wide bvh node, children bounds are stored in SoA form so that
+	// one ray is tested against all children with a single SSE (AVX) slab test
+	// empty child slots have empty bounds and are never hit
+	struct alignas(64) WideBVHNode {
+		float    bMin[3][kWideBVHWidth];  // [axis][child]
+		float    bMax[3][kWideBVHWidth];
+		uint32_t offset[kWideBVHWidth];   // index of wide node for interior child, first primitive for leaf child
+		uint16_t nPrims[kWideBVHWidth];   // 0 for interior child
+	};
+
+
+	// bvh with branching factor of kWideBVHWidth collapsed from binary bvh
+	// leaves reference ranges of primitives of binary bvh (one or several of its small leaves)
+	class WideBVH final {
+	public:
+		static constexpr uint32_t kWidth = kWideBVHWidth;
+
+		WideBVH() = default;
+
+		// traversal may use node array owned by someone else, so copy is forbidden
+		WideBVH(const WideBVH &) = delete;
+		WideBVH &operator=(const WideBVH &) = delete;
+		WideBVH(WideBVH &&) = default;
+		WideBVH &operator=(WideBVH &&) = default;
+
+		void Build(const BVH &bvh) {
+			m_nodes.clear();
+			m_nodeData = nullptr;
+			m_nodeCount = 0;
+
+			const std::vector<BVHNode> &nodes = bvh.GetNodes();
+			if (nodes.empty()) {
+				return;
+			}
+
+			m_bounds = bvh.Bounds();
+			m_nodes.reserve(nodes.size() / 2 + 1);
+			Collapse(nodes, 0);
+
+			m_nodeData = m_nodes.data();
+			m_nodeCount = static_cast<uint32_t>(m_nodes.size());
+		}
+
+		// uses nodes stored outside (for example in memory mapped file) without copying,
+		// nodes must be alive while bvh is used
+		void Attach(const WideBVHNode *nodes, uint32_t nodeCount, const AABB &bounds) {
+			m_nodes.clear();
+			m_nodeData = nodeCount > 0 ? nodes : nullptr;
+			m_nodeCount = nodeCount;
+			m_bounds = bounds;
+		}
+
+		// same contract as BVH::Intersect(), children are visited in near to far order
+		template<typename PrimHit>
+		bool Intersect(const Ray &r, Interval tSpan, PrimHit &&primHit) const {
+			if (m_nodeCount == 0) {
+				return false;
+			}
+
+			struct StackEntry {
+				uint32_t offset;
+				uint32_t nPrims;
+				float    tNear;
+			};
+
+			RayData ray(r);
+
+			float tClosest = tSpan.GetMax();
+			bool hit = false;
+
+			StackEntry stack[kStackSize];
+			uint32_t stackSize = 0;
+			StackEntry current{ 0, 0, tSpan.GetMin() };
+
+			while (true) {
+				if (current.nPrims > 0) {
+					for (uint32_t i = current.offset, ie = current.offset + current.nPrims; i != ie; ++i) {
+						if (primHit(i, Interval(tSpan.GetMin(), tClosest), tClosest)) {
+							hit = true;
+						}
+					}
+				} else {
+					const WideBVHNode &node = m_nodeData[current.offset];
+					float tNear[kWidth];
+					uint32_t mask = IntersectChildren(node, ray, tSpan.GetMin(), tClosest, tNear);
+
+					if (mask != 0) {
+						uint32_t c = CountTrailingZeros(mask);
+						mask &= mask - 1;
+
+						// common case, only one child is hit and stack is not touched
+						if (mask == 0) {
+							current = StackEntry{ node.offset[c], node.nPrims[c], tNear[c] };
+							continue;
+						}
+
+						// several children are hit, they are sorted by distance (insertion sort)
+						// farther children go to stack, nearest one is visited next
+						uint32_t order[kWidth];
+						uint32_t nHit = 1;
+						order[0] = c;
+						while (mask != 0) {
+							c = CountTrailingZeros(mask);
+							mask &= mask - 1;
+
+							uint32_t j = nHit++;
+							while (j > 0 && tNear[order[j - 1]] < tNear[c]) {
+								order[j] = order[j - 1];
+								--j;
+							}
+							order[j] = c;
+						}
+
+						for (uint32_t k = 0; k != nHit - 1; ++k) {
+							c = order[k];
+							stack[stackSize++] = StackEntry{ node.offset[c], node.nPrims[c], tNear[c] };
+#if ART_USE_SSE
+							// traversal is bound by memory latency, start loading postponed nodes early
+							if (node.nPrims[c] == 0) {
+								const char *child = reinterpret_cast<const char *>(&m_nodeData[node.offset[c]]);
+								for (size_t line = 0; line < sizeof(WideBVHNode); line += 64) {
+									_mm_prefetch(child + line, _MM_HINT_T0);
+								}
+							}
+#endif
+						}
+
+						c = order[nHit - 1];
+						current = StackEntry{ node.offset[c], node.nPrims[c], tNear[c] };
+						continue;
+					}
+				}
+
+				// pop next subtree, skip ones that were pushed before closer hit was found
+				do {
+					if (stackSize == 0) {
+						return hit;
+					}
+					current = stack[--stackSize];
+				} while (current.tNear > tClosest);
+			}
+
+			return hit;
+		}
+
+		// same contract as BVH::Occluded(), children are not sorted
+		template<typename PrimHit>
+		bool Occluded(const Ray &r, Interval tSpan, PrimHit &&primHit) const {
+			if (m_nodeCount == 0) {
+				return false;
+			}
+
+			struct StackEntry {
+				uint32_t offset;
+				uint32_t nPrims;
+			};
+
+			RayData ray(r);
+
+			StackEntry stack[kStackSize];
+			uint32_t stackSize = 0;
+			StackEntry current{ 0, 0 };
+
+			while (true) {
+				if (current.nPrims > 0) {
+					for (uint32_t i = current.offset, ie = current.offset + current.nPrims; i != ie; ++i) {
+						if (primHit(i, tSpan)) {
+							return true;
+						}
+					}
+				} else {
+					const WideBVHNode &node = m_nodeData[current.offset];
+					float tNear[kWidth];
+					uint32_t mask = IntersectChildren(node, ray, tSpan.GetMin(), tSpan.GetMax(), tNear);
+
+					if (mask != 0) {
+						// first hit child is visited next, the rest go to stack
+						uint32_t c = CountTrailingZeros(mask);
+						mask &= mask - 1;
+						current = StackEntry{ node.offset[c], node.nPrims[c] };
+						while (mask != 0) {
+							c = CountTrailingZeros(mask);
+							mask &= mask - 1;
+							stack[stackSize++] = StackEntry{ node.offset[c], node.nPrims[c] };
+						}
+						continue;
+					}
+				}
+
+				if (stackSize == 0) {
+					return false;
+				}
+				current = stack[--stackSize];
+			}
+		}
+
+		AABB Bounds() const { return m_nodeCount == 0 ? AABB() : m_bounds; }
+
+		const WideBVHNode *GetNodes() const { return m_nodeData; }
+		uint32_t           GetNodeCount() const { return m_nodeCount; }
+
+	private:
+		static constexpr uint32_t kStackSize = 64 * kWidth;
+
+		// small binary subtrees become one leaf child, otherwise 8-wide nodes near leaves are half empty
+		static constexpr uint32_t kMaxLeafPrims = 4;
+
+		static uint32_t CountTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return index;
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
+
+		// per ray data used by slab tests, near and far planes are selected by direction signs
+		struct RayData {
+			float    origin[3];
+			float    invDir[3];
+			uint32_t nearSide[3];  // 0 - min plane is near, 1 - max plane is near
+#if ART_USE_AVX
+			__m256   originAVX[3];
+			__m256   invDirAVX[3];
+#elif ART_USE_SSE
+			__m128   originSSE[3];
+			__m128   invDirSSE[3];
+#endif
+
+			explicit RayData(const Ray &r) {
+				glm::vec3 ro = r.GetOrigin();
+				glm::vec3 invD = 1.0f / r.GetDirection();
+				for (int axis = 0; axis != 3; ++axis) {
+					origin[axis] = ro[axis];
+					invDir[axis] = invD[axis];
+					nearSide[axis] = invD[axis] < 0 ? 1 : 0;
+#if ART_USE_AVX
+					originAVX[axis] = _mm256_set1_ps(ro[axis]);
+					invDirAVX[axis] = _mm256_set1_ps(invD[axis]);
+#elif ART_USE_SSE
+					originSSE[axis] = _mm_set1_ps(ro[axis]);
+					invDirSSE[axis] = _mm_set1_ps(invD[axis]);
+#endif
+				}
+			}
+		};
+
+		// returns bit mask of hit children, writes entry distances to tNear
+		static uint32_t IntersectChildren(const WideBVHNode &node, const RayData &ray, float tMin, float tMax, float *tNear) {
+#if ART_USE_AVX
+			// the same as SSE version below for 8 children
+			const float *planes = &node.bMin[0][0];
+			const uint32_t maxOffset = 3 * kWidth;
+
+			__m256 tn = _mm256_set1_ps(tMin);
+			__m256 tf = _mm256_set1_ps(tMax);
+			for (int axis = 0; axis != 3; ++axis) {
+				uint32_t nearOffset = axis * kWidth + ray.nearSide[axis] * maxOffset;
+				uint32_t farOffset = axis * kWidth + (ray.nearSide[axis] ^ 1) * maxOffset;
+
+				__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(planes + nearOffset), ray.originAVX[axis]), ray.invDirAVX[axis]);
+				__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(planes + farOffset), ray.originAVX[axis]), ray.invDirAVX[axis]);
+
+				tn = _mm256_max_ps(t0, tn);
+				tf = _mm256_min_ps(t1, tf);
+			}
+			_mm256_storeu_ps(tNear, tn);
+			return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ)));
+#elif ART_USE_SSE
+			// bMin and bMax are adjacent, so near plane is selected by offset
+			const float *planes = &node.bMin[0][0];
+			const uint32_t maxOffset = 3 * kWidth;
+
+			__m128 tn = _mm_set1_ps(tMin);
+			__m128 tf = _mm_set1_ps(tMax);
+			for (int axis = 0; axis != 3; ++axis) {
+				uint32_t nearOffset = axis * kWidth + ray.nearSide[axis] * maxOffset;
+				uint32_t farOffset = axis * kWidth + (ray.nearSide[axis] ^ 1) * maxOffset;
+
+				__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(planes + nearOffset), ray.originSSE[axis]), ray.invDirSSE[axis]);
+				__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(planes + farOffset), ray.originSSE[axis]), ray.invDirSSE[axis]);
+
+				// if slab distance is NaN (0 * inf) min/max return second operand and the slab is ignored
+				tn = _mm_max_ps(t0, tn);
+				tf = _mm_min_ps(t1, tf);
+			}
+			_mm_storeu_ps(tNear, tn);
+			return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tn, tf)));
+#else
+			uint32_t mask = 0;
+			for (uint32_t c = 0; c != kWidth; ++c) {
+				float tn = tMin;
+				float tf = tMax;
+				for (int axis = 0; axis != 3; ++axis) {
+					float nearPlane = ray.nearSide[axis] ? node.bMax[axis][c] : node.bMin[axis][c];
+					float farPlane = ray.nearSide[axis] ? node.bMin[axis][c] : node.bMax[axis][c];
+					float t0 = (nearPlane - ray.origin[axis]) * ray.invDir[axis];
+					float t1 = (farPlane - ray.origin[axis]) * ray.invDir[axis];
+					tn = t0 > tn ? t0 : tn;
+					tf = t1 < tf ? t1 : tf;
+				}
+				tNear[c] = tn;
+				mask |= (tn <= tf) ? (1u << c) : 0;
+			}
+			return mask;
+#endif
+		}
+
+		// creates wide node from binary node, binary children are opened
+		// (largest surface area first) until there are kWidth of them
+		uint32_t Collapse(const std::vector<BVHNode> &nodes, uint32_t binaryIndex) {
+			uint32_t wideIndex = static_cast<uint32_t>(m_nodes.size());
+			m_nodes.emplace_back();
+
+			uint32_t children[kWidth];
+			uint32_t nChildren = 0;
+			if (nodes[binaryIndex].nPrims > 0) {
+				children[nChildren++] = binaryIndex;
+			} else {
+				children[nChildren++] = binaryIndex + 1;
+				children[nChildren++] = nodes[binaryIndex].offset;
+			}
+
+			while (nChildren < kWidth) {
+				int   largest = -1;
+				float largestArea = -1;
+				for (uint32_t c = 0; c != nChildren; ++c) {
+					const BVHNode &child = nodes[children[c]];
+					if (child.nPrims == 0 && child.bounds.SurfaceArea() > largestArea) {
+						largest = c;
+						largestArea = child.bounds.SurfaceArea();
+					}
+				}
+				if (largest == -1) {
+					break;
+				}
+
+				uint32_t opened = children[largest];
+				children[largest] = opened + 1;
+				children[nChildren++] = nodes[opened].offset;
+			}
+
+			for (uint32_t c = 0; c != kWidth; ++c) {
+				AABB bounds = c < nChildren ? nodes[children[c]].bounds : AABB();
+				for (int axis = 0; axis != 3; ++axis) {
+					m_nodes[wideIndex].bMin[axis][c] = bounds.GetMin()[axis];
+					m_nodes[wideIndex].bMax[axis][c] = bounds.GetMax()[axis];
+				}
+
+				uint32_t offset = 0;
+				uint16_t nPrims = 0;
+				if (c < nChildren) {
+					const BVHNode &child = nodes[children[c]];
+					uint32_t first, count;
+					if (child.nPrims > 0) {
+						offset = child.offset;
+						nPrims = child.nPrims;
+					} else if (SubtreePrims(nodes, children[c], first, count) <= kMaxLeafPrims) {
+						offset = first;
+						nPrims = static_cast<uint16_t>(count);
+					} else {
+						offset = Collapse(nodes, children[c]);  // m_nodes can be reallocated here
+					}
+				}
+				m_nodes[wideIndex].offset[c] = offset;
+				m_nodes[wideIndex].nPrims[c] = nPrims;
+			}
+
+			return wideIndex;
+		}
+
+		// primitives of binary subtree are contiguous, returns their range
+		static uint32_t SubtreePrims(const std::vector<BVHNode> &nodes, uint32_t index, uint32_t &first, uint32_t &count) {
+			uint32_t left = index;
+			while (nodes[left].nPrims == 0) {
+				++left;
+			}
+			uint32_t right = index;
+			while (nodes[right].nPrims == 0) {
+				right = nodes[right].offset;
+			}
+			first = nodes[left].offset;
+			count = nodes[right].offset + nodes[right].nPrims - first;
+			return count;
+		}
+
+		std::vector<WideBVHNode> m_nodes;               // empty if nodes are attached
+		const WideBVHNode       *m_nodeData = nullptr;  // nodes used by traversal
+		uint32_t                 m_nodeCount = 0;
+		AABB                     m_bounds;
+	};
+}